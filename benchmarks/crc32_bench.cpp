@@ -0,0 +1,88 @@
+// CRC32 throughput: FLUX::crc32 against the byte-at-a-time table loop it
+// replaced, for whole buffers and for FCode sized (1 - 29 byte) writes.
+//
+// Build & run:
+//   g++ -O2 -std=c++11 -Isrc/toolpath benchmarks/crc32_bench.cpp src/toolpath/crc32.cpp -o crc32_bench
+//   ./crc32_bench
+//
+// Results of both implementations and of crc32_combine over split buffers
+// are checked before anything is timed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include "crc32.h"
+
+
+static uint32_t reference_table[256];
+
+static void init_reference(void) {
+    for(uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for(int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ 0xedb88320 : c >> 1;
+        reference_table[n] = c;
+    }
+}
+
+static uint32_t reference_crc32(uint32_t crc, const void *buf, size_t size) {
+    const uint8_t *p = (const uint8_t *)buf;
+    crc = crc ^ ~0U;
+    while(size--) crc = reference_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc ^ ~0U;
+}
+
+template <typename F>
+static double measure(F fn, size_t bytes, uint32_t* result) {
+    auto begin = std::chrono::steady_clock::now();
+    *result = fn();
+    auto end = std::chrono::steady_clock::now();
+    double sec = std::chrono::duration<double>(end - begin).count();
+    return bytes / sec / 1e6;
+}
+
+int main(void) {
+    init_reference();
+    const size_t size = 64 << 20;
+    std::vector<unsigned char> buf(size);
+    srand(1);
+    for(size_t i = 0; i < size; i++) buf[i] = (unsigned char)rand();
+
+    for(size_t offset = 0; offset < 16; offset++) {
+        for(size_t len = 0; len < 4096; len += 7) {
+            if(FLUX::crc32(offset, &buf[offset], len) != reference_crc32(offset, &buf[offset], len)) {
+                fprintf(stderr, "Mismatch at offset %i size %i\n", (int)offset, (int)len);
+                return 1;
+            }
+        }
+    }
+    for(size_t split = 0; split < size; split += size / 17) {
+        uint32_t a = FLUX::crc32(0, &buf[0], split);
+        uint32_t b = FLUX::crc32(0, &buf[split], size - split);
+        if(FLUX::crc32_combine(a, b, size - split) != FLUX::crc32(0, &buf[0], size)) {
+            fprintf(stderr, "crc32_combine mismatch at %i\n", (int)split);
+            return 1;
+        }
+    }
+
+    uint32_t r1, r2;
+    double ref = measure([&]() { return reference_crc32(0, buf.data(), size); }, size, &r1);
+    double cur = measure([&]() { return FLUX::crc32(0, buf.data(), size); }, size, &r2);
+    printf("buffer   reference %8.1f MB/s  crc32 %8.1f MB/s  (%s)\n", ref, cur, r1 == r2 ? "OK" : "MISMATCH");
+
+    // Command sized updates, like FCodeV1Base::write
+    auto small_writes = [&](uint32_t (*fn)(uint32_t, const void*, size_t)) {
+        uint32_t crc = 0;
+        size_t i = 0, step = 1;
+        while(i + 29 < size) {
+            crc = fn(crc, &buf[i], step);
+            i += step;
+            step = step == 29 ? 1 : step + 4;
+        }
+        return crc;
+    };
+    ref = measure([&]() { return small_writes(reference_crc32); }, size, &r1);
+    cur = measure([&]() { return small_writes(FLUX::crc32); }, size, &r2);
+    printf("commands reference %8.1f MB/s  crc32 %8.1f MB/s  (%s)\n", ref, cur, r1 == r2 ? "OK" : "MISMATCH");
+    return r1 == r2 ? 0 : 1;
+}
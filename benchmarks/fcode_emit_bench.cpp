@@ -0,0 +1,72 @@
+// FCode V1 emission throughput for a moves-only toolpath.
+//
+// Build & run:
+//   g++ -O2 -std=c++11 -Isrc/toolpath benchmarks/fcode_emit_bench.cpp src/toolpath/fcode_v1_writer.cpp src/toolpath/crc32.cpp -o fcode_emit_bench
+//   ./fcode_emit_bench [output.fc]
+//
+// 5M XYE moves are sent one by one with moveto() to a FCodeV1MemoryWriter
+// and, if a filename is given, to a FCodeV1FileWriter. Both outputs are
+// checked to be identical.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "fcode.h"
+
+
+struct Move {
+    float x, y, e;
+};
+
+template <typename W>
+static double emit(W* writer, const std::vector<Move>& moves) {
+    auto begin = std::chrono::steady_clock::now();
+    writer->moveto(FLAG_HAS_FEEDRATE, 1800, 0, 0, 0, 0, 0, 0);
+    for(size_t i = 0; i < moves.size(); i++) {
+        writer->moveto(FLAG_HAS_X | FLAG_HAS_Y | FLAG_HAS_E(0), 0,
+                       moves[i].x, moves[i].y, 0, moves[i].e, 0, 0);
+    }
+    writer->terminated();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+int main(int argc, char** argv) {
+    std::vector<Move> moves(5000000);
+    srand(1);
+    for(size_t i = 0; i < moves.size(); i++) {
+        moves[i].x = (rand() % 170000) / 1000.0f - 85;
+        moves[i].y = (rand() % 170000) / 1000.0f - 85;
+        moves[i].e = i * 0.0123f;
+    }
+
+    std::string head_type("EXTRUDER");
+    std::vector<std::pair<std::string, std::string> > metadata;
+    std::vector<std::string> previews;
+
+    FLUX::FCodeV1MemoryWriter memory_writer(&head_type, &metadata, &previews);
+    double sec = emit(&memory_writer, moves);
+    std::string output = memory_writer.get_buffer();
+    printf("memory %8.3f s  %8.1f Mmoves/s  %8.1f MB/s\n", sec,
+           moves.size() / sec / 1e6, output.size() / sec / 1e6);
+
+    if(argc > 1) {
+        std::vector<std::pair<std::string, std::string> > file_metadata;
+        FLUX::FCodeV1FileWriter file_writer(argv[1], &head_type, &file_metadata, &previews);
+        sec = emit(&file_writer, moves);
+        printf("file   %8.3f s  %8.1f Mmoves/s\n", sec, moves.size() / sec / 1e6);
+
+        std::ifstream f(argv[1], std::ios::binary);
+        std::stringstream content;
+        content << f.rdbuf();
+        if(content.str() != output) {
+            fprintf(stderr, "File output does not match memory output\n");
+            return 1;
+        }
+    }
+    return 0;
+}
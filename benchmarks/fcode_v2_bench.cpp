@@ -0,0 +1,132 @@
+// FCode V1 vs V2 output size, encode and decode throughput.
+//
+// Build & run:
+//   g++ -O2 -std=c++11 -DFLUX_HAVE_ZLIB -Isrc/toolpath benchmarks/fcode_v2_bench.cpp src/toolpath/fcode_v1_writer.cpp src/toolpath/fcode_v1_parser.cpp src/toolpath/fcode_v2_writer.cpp src/toolpath/fcode_v2_parser.cpp src/toolpath/crc32.cpp -lz -o fcode_v2_bench
+//   ./fcode_v2_bench
+//
+// 5M moves shaped like a sliced part (0.2 mm layers of short perimeter
+// segments with 3 decimal XY and 5 decimal E) are batched into each writer
+// and decoded back. V2 output is checked to be within resolution of the
+// input.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "fcode.h"
+
+
+class CheckProcessor : public FLUX::ToolpathProcessor {
+public:
+    const FLUX::MoveBatch* batches;
+    size_t index;
+    double max_error;
+
+    CheckProcessor(const FLUX::MoveBatch* source) : batches(source), index(0), max_error(0) {}
+    virtual void moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
+        const FLUX::MoveBatch& b = batches[index / MOVE_BATCH_CAPACITY];
+        size_t i = index++ % MOVE_BATCH_CAPACITY;
+        max_error = fmax(max_error, fabs(b.x[i] - x));
+        max_error = fmax(max_error, fabs(b.y[i] - y));
+        max_error = fmax(max_error, fabs(b.e0[i] - e0));
+    }
+    virtual void sleep(float seconds) {}
+    virtual void enable_motor(void) {}
+    virtual void disable_motor(void) {}
+    virtual void pause(bool to_standby_position) {}
+    virtual void home(void) {}
+    virtual void set_toolhead_heater_temperature(float temperature, bool wait) {}
+    virtual void set_toolhead_fan_speed(float strength) {}
+    virtual void set_toolhead_pwm(float strength) {}
+    virtual void append_anchor(uint32_t value) {}
+    virtual void append_comment(const char* message, size_t length) {}
+    virtual void on_error(bool critical, const char* message, size_t length) {}
+    virtual void terminated(void) {}
+};
+
+
+static std::vector<FLUX::MoveBatch> synthetic_moves(size_t count) {
+    std::vector<FLUX::MoveBatch> batches(count / MOVE_BATCH_CAPACITY);
+    double e = 0, angle = 0;
+    size_t n = 0;
+    srand(1);
+    for(auto it=batches.begin();it!=batches.end();++it) {
+        while(it->size < MOVE_BATCH_CAPACITY) {
+            // 2000 moves per layer, radius changes every 200 moves
+            int layer = n / 2000;
+            double r = 20 + (n / 200 % 10) * 2 + (rand() % 100) / 1000.0;
+            angle += 0.02;
+            float x = roundf((100 + r * cos(angle)) * 1000) / 1000;
+            float y = roundf((100 + r * sin(angle)) * 1000) / 1000;
+            e += 0.02 + (rand() % 100) / 100000.0;
+            it->append(FLAG_HAS_X | FLAG_HAS_Y | FLAG_HAS_E(0) | (n % 2000 ? 0 : FLAG_HAS_Z | FLAG_HAS_FEEDRATE),
+                       1800, x, y, layer * 0.2f + 0.2f, (float)(round(e * 100000) / 100000), 0, 0);
+            n++;
+        }
+    }
+    return batches;
+}
+
+template <typename W>
+static double encode(W* writer, const std::vector<FLUX::MoveBatch>& batches, std::vector<char>* output) {
+    auto begin = std::chrono::steady_clock::now();
+    for(auto it=batches.begin();it!=batches.end();++it) {
+        writer->moveto_batch(&(*it));
+    }
+    writer->terminated();
+    auto end = std::chrono::steady_clock::now();
+    writer->detach_buffer(output);
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+template <typename P>
+static double decode(const std::vector<char>& input, const std::vector<FLUX::MoveBatch>& batches, double* max_error) {
+    CheckProcessor check(batches.data());
+    P parser;
+    parser.set_processor(&check);
+    auto begin = std::chrono::steady_clock::now();
+    parser.parse_buffer(input.data(), input.size());
+    auto end = std::chrono::steady_clock::now();
+    *max_error = check.max_error;
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+static void report(const char* label, size_t moves, size_t size, double encode_sec, double decode_sec, double error) {
+    printf("%-10s %10zu bytes %6.2f B/move  encode %7.1f Mmoves/s  decode %7.1f Mmoves/s  max error %.2g\n",
+           label, size, (double)size / moves, moves / encode_sec / 1e6, moves / decode_sec / 1e6, error);
+}
+
+int main(int argc, char** argv) {
+    std::vector<FLUX::MoveBatch> batches = synthetic_moves(5000000);
+    size_t moves = batches.size() * MOVE_BATCH_CAPACITY;
+    std::string head_type("EXTRUDER");
+    std::vector<std::string> previews;
+    std::vector<char> output;
+    double error, encode_sec, decode_sec;
+
+    {
+        std::vector<std::pair<std::string, std::string> > metadata;
+        FLUX::FCodeV1MemoryWriter writer(&head_type, &metadata, &previews);
+        encode_sec = encode(&writer, batches, &output);
+        decode_sec = decode<FLUX::FCodeV1Parser>(output, batches, &error);
+        report("V1", moves, output.size(), encode_sec, decode_sec, error);
+    }
+
+    int levels[] = {0, 1, 6};
+    for(int i=0;i<3;i++) {
+        std::vector<std::pair<std::string, std::string> > metadata;
+        FLUX::FCodeV2MemoryWriter writer(&head_type, &metadata, &previews, 0.001, 0.00001, levels[i]);
+        encode_sec = encode(&writer, batches, &output);
+        decode_sec = decode<FLUX::FCodeV2Parser>(output, batches, &error);
+        char label[16];
+        snprintf(label, sizeof(label), "V2 zlib=%i", levels[i]);
+        report(label, moves, output.size(), encode_sec, decode_sec, error);
+        if(error > 0.0005) {
+            fprintf(stderr, "V2 error larger than resolution\n");
+            return 1;
+        }
+    }
+    return 0;
+}
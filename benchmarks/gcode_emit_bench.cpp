@@ -0,0 +1,78 @@
+// G-code text emission throughput for a moves-only toolpath.
+//
+// Build & run:
+//   g++ -O2 -std=c++11 -Isrc/toolpath benchmarks/gcode_emit_bench.cpp src/toolpath/gcode_writer.cpp -o gcode_emit_bench
+//   ./gcode_emit_bench [output.gcode]
+//
+// 5M XYE moves are sent with moveto() to a GCodeMemoryWriter and, if a
+// filename is given, to a GCodeFileWriter. Output is checked against the
+// same lines formatted with snprintf("%.4f").
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "gcode.h"
+
+
+struct Move {
+    float f, x, y, e;
+};
+
+template <typename W>
+static double emit(W* writer, const std::vector<Move>& moves) {
+    auto begin = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < moves.size(); i++) {
+        int flags = FLAG_HAS_X | FLAG_HAS_Y | FLAG_HAS_E(0);
+        if(moves[i].f > 0) flags |= FLAG_HAS_FEEDRATE;
+        writer->moveto(flags, moves[i].f, moves[i].x, moves[i].y, 0, moves[i].e, 0, 0);
+    }
+    writer->terminated();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+int main(int argc, char** argv) {
+    std::vector<Move> moves(5000000);
+    std::string expected;
+    char buf[256];
+    srand(1);
+    for(size_t i = 0; i < moves.size(); i++) {
+        moves[i].f = (i % 100 == 0) ? (float)(600 + rand() % 3000) : 0;
+        moves[i].x = (rand() % 1700000) / 10000.0f - 85;
+        moves[i].y = (rand() % 1700000) / 10000.0f - 85;
+        moves[i].e = i * 0.00123f;
+        int size = (moves[i].f > 0) ?
+            snprintf(buf, sizeof(buf), "G1 F%.4f X%.4f Y%.4f E%.4f\n", moves[i].f, moves[i].x, moves[i].y, moves[i].e) :
+            snprintf(buf, sizeof(buf), "G1 X%.4f Y%.4f E%.4f\n", moves[i].x, moves[i].y, moves[i].e);
+        expected.append(buf, size);
+    }
+
+    FLUX::GCodeMemoryWriter memory_writer;
+    double sec = emit(&memory_writer, moves);
+    std::string output = memory_writer.get_buffer();
+    printf("memory %8.3f s  %8.1f Mmoves/s  %8.1f MB/s\n", sec,
+           moves.size() / sec / 1e6, output.size() / sec / 1e6);
+    if(output != expected) {
+        fprintf(stderr, "Memory output does not match snprintf\n");
+        return 1;
+    }
+
+    if(argc > 1) {
+        FLUX::GCodeFileWriter file_writer(argv[1]);
+        sec = emit(&file_writer, moves);
+        printf("file   %8.3f s  %8.1f Mmoves/s\n", sec, moves.size() / sec / 1e6);
+
+        std::ifstream f(argv[1], std::ios::binary);
+        std::stringstream content;
+        content << f.rdbuf();
+        if(content.str() != expected) {
+            fprintf(stderr, "File output does not match snprintf\n");
+            return 1;
+        }
+    }
+    return 0;
+}
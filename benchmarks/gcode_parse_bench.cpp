@@ -0,0 +1,183 @@
+// GCodeParser serial vs parse_buffer_parallel scaling.
+//
+// Build & run:
+//   g++ -O2 -std=c++11 -pthread -Isrc/toolpath benchmarks/gcode_parse_bench.cpp src/toolpath/gcode_parser.cpp src/toolpath/gcode_writer.cpp -o gcode_parse_bench
+//   ./gcode_parse_bench [path/to/file.gcode]
+//
+// Without an argument 10M synthetic lines are used. Each thread count is
+// timed with a processor that only counts events, then the output of the
+// serial and the parallel parser are compared through GCodeMemoryWriter.
+//
+// Decoding and executing are also timed apart on one thread. Execute always
+// runs on the calling thread while workers decode, so a thread count can not
+// beat (decode + execute) / max(execute, decode / threads). This bound is
+// printed next to each timing, it is also meaningful on a host with fewer
+// cores than threads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gcode.h"
+#include "mapped_file.h"
+
+
+class CountingProcessor : public FLUX::ToolpathProcessor {
+public:
+    size_t events;
+    double checksum;
+    CountingProcessor(void) { events = 0; checksum = 0; }
+    virtual void moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
+        events++;
+        checksum += x + y + z + e0;
+    }
+    virtual void sleep(float seconds) { events++; }
+    virtual void enable_motor(void) { events++; }
+    virtual void disable_motor(void) { events++; }
+    virtual void pause(bool to_standby_position) { events++; }
+    virtual void home(void) { events++; }
+    virtual void set_toolhead_heater_temperature(float temperature, bool wait) { events++; }
+    virtual void set_toolhead_fan_speed(float strength) { events++; }
+    virtual void set_toolhead_pwm(float strength) { events++; }
+    virtual void append_anchor(uint32_t value) { events++; }
+    virtual void append_comment(const char* message, size_t length) { events++; }
+    virtual void on_error(bool critical, const char* message, size_t length) { events++; }
+    virtual void terminated(void) {}
+};
+
+
+static std::string synthetic_gcode(int lines) {
+    std::string out;
+    char buf[128];
+    srand(1);
+    out += "G21\nG90\nM104 S200\nG28\n";
+    for(int i = 0; i < lines; i++) {
+        int size;
+        switch(i % 500) {
+            case 0:
+                size = snprintf(buf, 128, ";LAYER:%i\nG1 F1800 Z%.2f\n", i / 500, i / 500 * 0.2 + 0.2);
+                break;
+            case 250:
+                size = snprintf(buf, 128, "G91\nG1 E-1.5 F2400\nG90\nG92 E0\n");
+                break;
+            case 251:
+                size = snprintf(buf, 128, "G91\nG1 E1.5\nG90 ;restore\n");
+                break;
+            default:
+                size = snprintf(buf, 128, "G1 X%.3f Y%.3f E%.5f\n",
+                                (rand() % 170000) / 1000.0 - 85,
+                                (rand() % 170000) / 1000.0 - 85,
+                                (i % 250) * 0.0123);
+        }
+        out.append(buf, size);
+    }
+    return out;
+}
+
+
+static double run(const char* buf, size_t size, int threads, size_t* events) {
+    CountingProcessor proc;
+    FLUX::GCodeParser parser;
+    parser.set_processor(&proc);
+    auto t0 = std::chrono::steady_clock::now();
+    parser.parse_buffer_parallel(buf, size, threads);
+    auto t1 = std::chrono::steady_clock::now();
+    *events = proc.events;
+    return std::chrono::duration<double>(t1 - t0).count();
+}
+
+
+// Decode then execute 1 MB chunks on the calling thread, timing both steps
+static void split_phases(const char* buf, size_t size, double* decode_sec, double* execute_sec) {
+    CountingProcessor proc;
+    FLUX::GCodeParser parser;
+    parser.set_processor(&proc);
+    std::vector<FLUX::GCodeLine> lines;
+    std::vector<FLUX::GCodeWord> words;
+    FLUX::GCodeLine line;
+    const char* end = buf + size;
+    *decode_sec = *execute_sec = 0;
+
+    while(buf < end) {
+        const char* chunk_end = end;
+        if((size_t)(end - buf) > 1048576) {
+            const char* eol = (const char*)memchr(buf + 1048576, '\n', end - buf - 1048576);
+            if(eol) chunk_end = eol + 1;
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        lines.clear();
+        words.clear();
+        while(buf < chunk_end) {
+            const char* eol = (const char*)memchr(buf, '\n', chunk_end - buf);
+            const char* line_end = eol ? eol : chunk_end;
+            FLUX::GCodeParser::decode_line(buf, line_end - buf, &line, &words);
+            lines.push_back(line);
+            buf = line_end + 1;
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < lines.size(); i++) {
+            parser.execute(&lines[i], words.data() + lines[i].word_offset);
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        *decode_sec += std::chrono::duration<double>(t1 - t0).count();
+        *execute_sec += std::chrono::duration<double>(t2 - t1).count();
+    }
+}
+
+
+static std::string render(const char* buf, size_t size, int threads) {
+    FLUX::GCodeMemoryWriter writer;
+    FLUX::GCodeParser parser;
+    parser.set_processor(&writer);
+    parser.parse_buffer_parallel(buf, size, threads);
+    return writer.get_buffer();
+}
+
+
+int main(int argc, char** argv) {
+    std::string swap;
+    const char* buf;
+    size_t size;
+    FLUX::MappedFile* mapped = NULL;
+
+    if(argc > 1) {
+        mapped = new FLUX::MappedFile(argv[1]);
+        buf = mapped->data();
+        size = mapped->size();
+    } else {
+        swap = synthetic_gcode(10000000);
+        buf = swap.data();
+        size = swap.size();
+    }
+
+    printf("input %.1f MB, %u hardware threads\n", size / 1048576.0,
+           std::thread::hardware_concurrency());
+
+    double decode_sec, execute_sec;
+    split_phases(buf, size, &decode_sec, &execute_sec);
+    printf("decode %.3f s, execute %.3f s on one thread\n", decode_sec, execute_sec);
+
+    size_t base_events, events;
+    double base = run(buf, size, 1, &base_events);
+    printf("threads  1  %7.3f s  %8.1f MB/s  1.00x\n", base, size / 1048576.0 / base);
+
+    int thread_counts[] = {2, 4, 8, 16};
+    for(int i = 0; i < 4; i++) {
+        double sec = run(buf, size, thread_counts[i], &events);
+        double bound = (decode_sec + execute_sec) /
+                       std::max(execute_sec, decode_sec / thread_counts[i]);
+        printf("threads %2i  %7.3f s  %8.1f MB/s  %.2fx (bound %.2fx)%s\n", thread_counts[i], sec,
+               size / 1048576.0 / sec, base / sec, bound,
+               events == base_events ? "" : "  EVENT COUNT MISMATCH");
+    }
+
+    bool identical = render(buf, size, 1) == render(buf, size, 16);
+    printf("serial/parallel output identical: %s\n", identical ? "yes" : "NO");
+
+    delete mapped;
+    return identical ? 0 : 1;
+}
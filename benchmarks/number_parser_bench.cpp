@@ -0,0 +1,125 @@
+// Number parsing throughput: FLUX::parse_decimal against strtof.
+//
+// Build & run:
+//   g++ -O2 -std=c++11 -Isrc/toolpath benchmarks/number_parser_bench.cpp -o number_parser_bench
+//   ./number_parser_bench path/to/slicer_output.gcode
+//
+// Without an argument a synthetic Cura style G-code body is used. Every
+// numeric G-code word is parsed by both functions, results are compared bit
+// by bit and throughput is reported in MB of number text per second.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "mapped_file.h"
+#include "number_parser.h"
+
+struct Token {
+    size_t offset;
+    size_t size;
+};
+
+
+static std::string synthetic_gcode(void) {
+    std::string out;
+    char buf[128];
+    srand(1);
+    for(int i = 0; i < 2000000; i++) {
+        int size = snprintf(buf, 128, "G1 X%.3f Y%.3f E%.5f\n",
+                            (rand() % 170000) / 1000.0 - 85,
+                            (rand() % 170000) / 1000.0 - 85,
+                            i * 0.0123);
+        out.append(buf, size);
+        if(i % 50 == 0) out += "G1 F1800 Z0.3\n";
+    }
+    return out;
+}
+
+
+static void collect_tokens(const char* buf, size_t size, std::vector<Token>* tokens) {
+    size_t i = 0;
+    while(i < size) {
+        char c = buf[i];
+        if(c == ';') {
+            while(i < size && buf[i] != '\n') i++;
+            continue;
+        }
+        if(c && strchr("XYZEFS", c)) {
+            size_t begin = ++i;
+            while(i < size && buf[i] && strchr("0123456789.-", buf[i])) i++;
+            if(i > begin) {
+                Token t = {begin, i - begin};
+                tokens->push_back(t);
+            }
+            continue;
+        }
+        i++;
+    }
+}
+
+
+int main(int argc, char** argv) {
+    std::string swap;
+    const char* buf;
+    size_t size;
+    FLUX::MappedFile* mapped = NULL;
+
+    if(argc > 1) {
+        mapped = new FLUX::MappedFile(argv[1]);
+        buf = mapped->data();
+        size = mapped->size();
+    } else {
+        swap = synthetic_gcode();
+        buf = swap.data();
+        size = swap.size();
+    }
+
+    std::vector<Token> tokens;
+    collect_tokens(buf, size, &tokens);
+
+    // strtof needs null terminated input, give both parsers the same copy.
+    std::string text;
+    std::vector<size_t> offsets;
+    size_t bytes = 0;
+    for(size_t i = 0; i < tokens.size(); i++) {
+        offsets.push_back(text.size());
+        text.append(buf + tokens[i].offset, tokens[i].size);
+        text.push_back(' ');
+        bytes += tokens[i].size;
+    }
+    const char* base = text.c_str();
+
+    std::vector<float> a(tokens.size()), b(tokens.size());
+
+    auto t0 = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < tokens.size(); i++) {
+        a[i] = strtof(base + offsets[i], NULL);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < tokens.size(); i++) {
+        const char* p = base + offsets[i];
+        FLUX::parse_decimal(p, p + tokens[i].size, &b[i]);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    size_t mismatch = 0;
+    for(size_t i = 0; i < tokens.size(); i++) {
+        if(memcmp(&a[i], &b[i], sizeof(float))) mismatch++;
+    }
+
+    double strtof_sec = std::chrono::duration<double>(t1 - t0).count();
+    double fast_sec = std::chrono::duration<double>(t2 - t1).count();
+    double mb = bytes / 1048576.0;
+
+    printf("numbers        %zu (%.2f MB)\n", tokens.size(), mb);
+    printf("strtof         %8.1f MB/s\n", mb / strtof_sec);
+    printf("parse_decimal  %8.1f MB/s\n", mb / fast_sec);
+    printf("speedup        %8.2fx\n", strtof_sec / fast_sec);
+    printf("mismatch       %zu\n", mismatch);
+
+    delete mapped;
+    return mismatch ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+// Preview path JSON throughput: path_to_js_cpp against the sprintf and
+// list<string> serializer it replaced.
+//
+// Build & run:
+//   g++ -O2 -std=c++11 -pthread -Isrc/utils benchmarks/path_to_js_bench.cpp src/utils/utils_module.cpp -o path_to_js_bench
+//   ./path_to_js_bench
+//
+// 5M points in 1000 layers shaped like a sliced part, with a few rounding
+// ties (x.xx5 exactly representable) and negative values, are serialized by
+// both. Outputs are checked to be identical.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <list>
+#include <string>
+#include "utils_module.h"
+
+
+static std::string legacy_path_to_js(PreviewPath* path) {
+    char buf[50];
+    std::list<std::string> parts;
+    size_t total = 0;
+    auto append = [&](const std::string& s) { parts.push_back(s); total += s.size(); };
+    append("[");
+    for(size_t layer=0;layer<path->layer_count();layer++) {
+        append("[");
+        size_t begin = path->layer_begin(layer), end = path->layer_end(layer);
+        PreviewPathReader reader(path, begin);
+        for(size_t i=begin;i<end;i++) {
+            PathVector p = reader.next();
+            sprintf(buf, "[%.2f,%.2f,%.2f,%d]", p.x, p.y, p.z, p.path_type - 1);
+            append(std::string(buf));
+            if(i != end - 1) append(",");
+        }
+        append("]");
+        if(layer != path->layer_count() - 1) append(",");
+    }
+    append("]");
+    std::string output;
+    output.reserve(total);
+    for(auto it=parts.begin();it!=parts.end();++it) output += *it;
+    return output;
+}
+
+int main(int argc, char** argv) {
+    PreviewPath path;
+    path.append(0, 0, 230, 4);
+    srand(1);
+    double angle = 0;
+    for(int layer=0;layer<1000;layer++) {
+        path.new_layer(4);
+        for(int i=0;i<5000;i++) {
+            angle += 0.01;
+            float r = 40 + (rand() % 1000) / 100.0f;
+            float x = (i % 97 == 0) ? 0.125f : (float)(r * cos(angle));
+            float y = (i % 89 == 0) ? -2.375f : (float)(r * sin(angle));
+            path.append(x, y, layer * 0.2f + 0.2f, 1 + rand() % 9);
+        }
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::string legacy = legacy_path_to_js(&path);
+    auto t1 = std::chrono::steady_clock::now();
+    std::string current = path_to_js_cpp(&path);
+    auto t2 = std::chrono::steady_clock::now();
+
+    if(legacy != current) {
+        fprintf(stderr, "Output not match\n");
+        return 1;
+    }
+    double legacy_sec = std::chrono::duration<double>(t1 - t0).count();
+    double current_sec = std::chrono::duration<double>(t2 - t1).count();
+    printf("%zu points, %zu bytes\n", path.size(), current.size());
+    printf("legacy         %7.3f s\n", legacy_sec);
+    printf("path_to_js_cpp %7.3f s  (%.1fx)\n", current_sec, legacy_sec / current_sec);
+    return 0;
+}
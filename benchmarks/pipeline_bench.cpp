@@ -0,0 +1,95 @@
+// Parse -> FCode throughput on one thread and with PipelineProcessor
+// running the writer on a second thread.
+//
+// Build & run:
+//   g++ -O2 -std=c++11 -pthread -Isrc/toolpath benchmarks/pipeline_bench.cpp src/toolpath/gcode_parser.cpp src/toolpath/fcode_v1_writer.cpp src/toolpath/crc32.cpp src/toolpath/pipeline_processor.cpp -o pipeline_bench
+//   ./pipeline_bench [path/to/file.gcode]
+//
+// Without an argument 5M synthetic move lines are used. The FCode output of
+// both modes is compared byte by byte.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include "fcode.h"
+#include "gcode.h"
+#include "mapped_file.h"
+#include "pipeline_processor.h"
+
+
+static std::string synthetic_gcode(int lines) {
+    std::string out;
+    char buf[128];
+    srand(1);
+    out += "G21\nG90\nM104 S200\nG28\n";
+    for(int i = 0; i < lines; i++) {
+        int size;
+        if(i % 500 == 0) {
+            size = snprintf(buf, 128, ";LAYER:%i\nG1 F1800 Z%.2f\n", i / 500, i / 500 * 0.2 + 0.2);
+        } else {
+            size = snprintf(buf, 128, "G1 X%.3f Y%.3f E%.5f\n",
+                            (rand() % 170000) / 1000.0 - 85,
+                            (rand() % 170000) / 1000.0 - 85,
+                            i * 0.0123);
+        }
+        out.append(buf, size);
+    }
+    return out;
+}
+
+
+static double run(const char* buf, size_t size, bool pipeline, std::string* output) {
+    std::string head_type("EXTRUDER");
+    std::vector<std::pair<std::string, std::string> > metadata;
+    std::vector<std::string> previews;
+
+    FLUX::FCodeV1MemoryWriter writer(&head_type, &metadata, &previews);
+    FLUX::GCodeParser parser;
+
+    auto t0 = std::chrono::steady_clock::now();
+    if(pipeline) {
+        FLUX::PipelineProcessor stage(&writer);
+        parser.set_processor(&stage);
+        parser.parse_buffer(buf, size);
+        stage.terminated();
+    } else {
+        parser.set_processor(&writer);
+        parser.parse_buffer(buf, size);
+        writer.terminated();
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    *output = writer.get_buffer();
+    return std::chrono::duration<double>(t1 - t0).count();
+}
+
+
+int main(int argc, char** argv) {
+    std::string swap;
+    const char* buf;
+    size_t size;
+    FLUX::MappedFile* mapped = NULL;
+
+    if(argc > 1) {
+        mapped = new FLUX::MappedFile(argv[1]);
+        buf = mapped->data();
+        size = mapped->size();
+    } else {
+        swap = synthetic_gcode(5000000);
+        buf = swap.data();
+        size = swap.size();
+    }
+
+    std::string serial_output, pipeline_output;
+    double serial = run(buf, size, false, &serial_output);
+    double pipeline = run(buf, size, true, &pipeline_output);
+    double mb = size / 1048576.0;
+
+    printf("input    %8.1f MB G-code, %.1f MB FCode\n", mb, serial_output.size() / 1048576.0);
+    printf("serial   %8.3f s  %8.1f MB/s\n", serial, mb / serial);
+    printf("pipeline %8.3f s  %8.1f MB/s  %.2fx\n", pipeline, mb / pipeline, serial / pipeline);
+    printf("output identical: %s\n", serial_output == pipeline_output ? "yes" : "NO");
+
+    delete mapped;
+    return serial_output == pipeline_output ? 0 : 1;
+}
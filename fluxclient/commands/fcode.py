@@ -65,22 +65,40 @@ def gcode_2_fcode(params=None, input=None, output=None):
     parser.add_argument('--fmd', dest='filament_detect', type=str,
                         default=None, choices=['Y', 'N'],
                         help='Set filament detect, only for extruder type')
+    parser.add_argument('--simplify', dest='simplify', type=float,
+                        default=None, metavar='TOLERANCE',
+                        help='Remove redundant commands and merge collinear '
+                             'moves within TOLERANCE mm')
 
     parser.add_argument(dest='output', type=str,
-                        help='Ouput fcode file')
+                        help='Ouput fcode file, "-" for stdout')
 
     options = parser.parse_args(params)
 
-    from fluxclient.toolpath import GCodeParser, FCodeV1FileWriter
+    from fluxclient.toolpath import (GCodeParser, FCodeV1FileWriter,
+                                     FCodeV1StreamWriter, SimplifyProcessor)
 
     md, previews = create_fcode_metadata(options)
 
     parser = GCodeParser()
-    processor = FCodeV1FileWriter(
-        options.output, options.head_type, md, previews)
-    parser.set_processor(processor)
-    parser.parse_from_file(options.input)
-    processor.terminated()
+    if options.output == "-":
+        processor = FCodeV1StreamWriter(
+            sys.stdout.buffer, options.head_type, md, previews)
+    else:
+        processor = FCodeV1FileWriter(
+            options.output, options.head_type, md, previews)
+    if options.simplify is not None:
+        simplifier = SimplifyProcessor(processor, options.simplify)
+        parser.set_processor(simplifier)
+        parser.parse_from_file(options.input)
+        simplifier.terminated()
+        sys.stderr.write("Simplify: %i commands (%i bytes) removed\n" % (
+            simplifier.get_removed_commands(),
+            simplifier.get_removed_bytes()))
+    else:
+        parser.set_processor(processor)
+        parser.parse_from_file(options.input)
+        processor.terminated()
 
     errors = processor.errors()
     if errors:
@@ -362,23 +362,22 @@ class StlSlicer(object):
                 tmp -= 16
             ext_metadata['HEAD_ERROR_LEVEL'] = str(tmp)
 
-            with open(tmp_gcode_file, 'r') as f:
-                status_list.append('{"slice_status": "computing", "message": "Analyzing Metadata++", "percentage": 0.99}')
-                m_GcodeToFcode = GcodeToFcodeCpp(ext_metadata=ext_metadata)
-                m_GcodeToFcode.config = config
-                m_GcodeToFcode.image = image
-                m_GcodeToFcode.process(f, fcode_output)
-                path = m_GcodeToFcode.trim_ends(m_GcodeToFcode.path)
-                metadata = m_GcodeToFcode.md
-                metadata = [float(metadata['TIME_COST']), float(metadata['FILAMENT_USED'].split(',')[0])]
-                if slic3r_error or len(m_GcodeToFcode.empty_layer) > 0:
-                    status_list.append('{"slice_status": "warning", "message" : "%s"}' % ("{} empty layers, might be error when slicing {}".format(len(m_GcodeToFcode.empty_layer), repr(m_GcodeToFcode.empty_layer))))
-
-                if float(m_GcodeToFcode.md['MAX_R']) >= HW_PROFILE['model-1']['radius']:
-                    fail_flag = True
-                    slic3r_out = [6, "Gcode area was too big"]  # errorcode 6
-
-                del m_GcodeToFcode
+            status_list.append('{"slice_status": "computing", "message": "Analyzing Metadata++", "percentage": 0.99}')
+            m_GcodeToFcode = GcodeToFcodeCpp(ext_metadata=ext_metadata)
+            m_GcodeToFcode.config = config
+            m_GcodeToFcode.image = image
+            m_GcodeToFcode.convert_file(tmp_gcode_file, fcode_output)
+            path = m_GcodeToFcode.trim_ends(m_GcodeToFcode.path)
+            metadata = m_GcodeToFcode.md
+            metadata = [float(metadata['TIME_COST']), float(metadata['FILAMENT_USED'].split(',')[0])]
+            if slic3r_error or len(m_GcodeToFcode.empty_layer) > 0:
+                status_list.append('{"slice_status": "warning", "message" : "%s"}' % ("{} empty layers, might be error when slicing {}".format(len(m_GcodeToFcode.empty_layer), repr(m_GcodeToFcode.empty_layer))))
+
+            if float(m_GcodeToFcode.md['MAX_R']) >= HW_PROFILE['model-1']['radius']:
+                fail_flag = True
+                slic3r_out = [6, "Gcode area was too big"]  # errorcode 6
+
+            del m_GcodeToFcode
 
             if output_type == '-g':
                 with open(tmp_gcode_file, 'rb') as f:
@@ -938,25 +937,24 @@ class StlSlicerCura(StlSlicer):
                 tmp -= 16
             ext_metadata['HEAD_ERROR_LEVEL'] = str(tmp)
 
-            with open(tmp_gcode_file, 'r') as f:
-                m_GcodeToFcode = GcodeToFcodeCpp(ext_metadata=ext_metadata)
-                m_GcodeToFcode.engine = 'cura'
-                # m_GcodeToFcode.process_path = self.process_path
-                m_GcodeToFcode.config = config
-                m_GcodeToFcode.image = image
-                m_GcodeToFcode.process(f, fcode_output)
-                path = m_GcodeToFcode.trim_ends(m_GcodeToFcode.path)
-                metadata = m_GcodeToFcode.md
-                metadata = [float(metadata['TIME_COST']), float(metadata['FILAMENT_USED'].split(',')[0])]
-                if slicer_error or len(m_GcodeToFcode.empty_layer) > 0:
-                    status_list.append('{"slice_status": "warning", "message" : "%s"}' % ("{} empty layers, might be error when slicing {}".format(len(m_GcodeToFcode.empty_layer), repr(m_GcodeToFcode.empty_layer))))
-
-                if float(m_GcodeToFcode.md['MAX_R']) >= HW_PROFILE['model-1']['radius']:
-                    logger.info("CuraEngine: gcode out of range")
-                    fail_flag = True
-                    slicer_out = [6, "Gcode area too big MAX_R=%s" % str(m_GcodeToFcode.md['MAX_R'])]  # errorcode 6
-
-                del m_GcodeToFcode
+            m_GcodeToFcode = GcodeToFcodeCpp(ext_metadata=ext_metadata)
+            m_GcodeToFcode.engine = 'cura'
+            # m_GcodeToFcode.process_path = self.process_path
+            m_GcodeToFcode.config = config
+            m_GcodeToFcode.image = image
+            m_GcodeToFcode.convert_file(tmp_gcode_file, fcode_output)
+            path = m_GcodeToFcode.trim_ends(m_GcodeToFcode.path)
+            metadata = m_GcodeToFcode.md
+            metadata = [float(metadata['TIME_COST']), float(metadata['FILAMENT_USED'].split(',')[0])]
+            if slicer_error or len(m_GcodeToFcode.empty_layer) > 0:
+                status_list.append('{"slice_status": "warning", "message" : "%s"}' % ("{} empty layers, might be error when slicing {}".format(len(m_GcodeToFcode.empty_layer), repr(m_GcodeToFcode.empty_layer))))
+
+            if float(m_GcodeToFcode.md['MAX_R']) >= HW_PROFILE['model-1']['radius']:
+                logger.info("CuraEngine: gcode out of range")
+                fail_flag = True
+                slicer_out = [6, "Gcode area too big MAX_R=%s" % str(m_GcodeToFcode.md['MAX_R'])]  # errorcode 6
+
+            del m_GcodeToFcode
 
             if output_type == '-g':
                 with open(tmp_gcode_file, 'rb') as f:
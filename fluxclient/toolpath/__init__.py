@@ -2,19 +2,41 @@
 from fluxclient.toolpath._toolpath import (ToolpathProcessor,
                         PyToolpathProcessor,
                         GCodeMemoryWriter,
+                        ToolpathBuffer,
                         GCodeFileWriter,
                         FCodeV1FileWriter,
                         FCodeV1MemoryWriter,
+                        FCodeV1StreamWriter,
+                        FCodeV2FileWriter,
+                        FCodeV2MemoryWriter,
                         GCodeParser,
-                        DitheringProcessor)
+                        FCodeV1Parser,
+                        FCodeV2Parser,
+                        SimplifyProcessor,
+                        TeeProcessor,
+                        PipelineProcessor,
+                        PathRecorderProcessor,
+                        DitheringProcessor,
+                        fcode_concat)
 from ._fcode_parser import FCodeParser
 
 __all__ = ["ToolpathProcessor",
            "PyToolpathProcessor",
            "GCodeMemoryWriter",
+           "ToolpathBuffer",
            "GCodeFileWriter",
            "FCodeV1FileWriter",
            "FCodeV1MemoryWriter",
+           "FCodeV1StreamWriter",
+           "FCodeV2FileWriter",
+           "FCodeV2MemoryWriter",
            "FCodeParser",
            "GCodeParser",
-           "DitheringProcessor"]
+           "FCodeV1Parser",
+           "FCodeV2Parser",
+           "SimplifyProcessor",
+           "TeeProcessor",
+           "PipelineProcessor",
+           "PathRecorderProcessor",
+           "DitheringProcessor",
+           "fcode_concat"]
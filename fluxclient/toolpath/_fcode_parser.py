@@ -2,6 +2,8 @@
 from zipfile import crc32
 import struct
 
+from ._toolpath import ToolpathProcessor, FCodeV1Parser
+
 
 def to_uint8(buf):
     return struct.unpack("<B", buf)[0]
@@ -69,11 +71,21 @@ class _ReadHelper(object):
 class FCodeParser(object):
     @classmethod
     def from_file(cls, filename, toolpath_processor):
+        if isinstance(toolpath_processor, ToolpathProcessor):
+            parser = FCodeV1Parser()
+            parser.set_processor(toolpath_processor)
+            return parser.parse_from_file(filename)
+
         with open(filename, "rb") as f:
             return cls.from_stream(f, toolpath_processor)
 
     @classmethod
     def from_stream(cls, stream, toolpath_processor):
+        if isinstance(toolpath_processor, ToolpathProcessor):
+            parser = FCodeV1Parser()
+            parser.set_processor(toolpath_processor)
+            return parser.parse_buffer(stream.read())
+
         tp = toolpath_processor
         magic_number = stream.read(8)
 
@@ -117,9 +129,9 @@ class FCodeParser(object):
             elif cmd & 16:
                 block = True if cmd & 8 else False
                 tp.set_toolhead_heater_temperature(reader.float(), block)
-            elif cmd == 6:
-                tp.pause(True)
             elif cmd == 5:
+                tp.pause(True)
+            elif cmd == 6:
                 tp.pause(False)
             elif cmd & 4:
                 tp.sleep(reader.float() / 1000.0)
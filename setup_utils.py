@@ -118,6 +118,28 @@ def get_default_extra_compile_args():
         return []
 
 
+def get_default_extra_link_args():
+    if is_windows():
+        return []
+    else:
+        return ["-pthread"]
+
+
+def get_toolpath_libraries():
+    # zlib for compressed FCode V2, not bundled with windows toolchain
+    if is_windows():
+        return []
+    else:
+        return ["z"]
+
+
+def get_toolpath_define_macros():
+    if is_windows():
+        return []
+    else:
+        return [("FLUX_HAVE_ZLIB", "1")]
+
+
 def create_utils_extentions():
     return [
         Extension(
@@ -126,16 +148,29 @@ def create_utils_extentions():
                 "src/toolpath/gcode_parser.cpp",
                 "src/toolpath/gcode_writer.cpp",
                 "src/toolpath/fcode_v1_writer.cpp",
+                "src/toolpath/fcode_v1_parser.cpp",
+                "src/toolpath/fcode_v1_concat.cpp",
+                "src/toolpath/fcode_v2_writer.cpp",
+                "src/toolpath/fcode_v2_parser.cpp",
+                "src/toolpath/crc32.cpp",
                 "src/toolpath/py_processor.cpp",
+                "src/toolpath/simplify_processor.cpp",
+                "src/toolpath/tee_processor.cpp",
+                "src/toolpath/pipeline_processor.cpp",
+                "src/toolpath/path_recorder_processor.cpp",
                 "src/toolpath/_toolpath.pyx"
             ],
             language="c++",
             extra_compile_args=get_default_extra_compile_args(),
+            extra_link_args=get_default_extra_link_args(),
+            libraries=get_toolpath_libraries(),
+            define_macros=get_toolpath_define_macros(),
             include_dirs=[numpy.get_include()]),
         Extension(
             'fluxclient.utils._utils',
             sources=[
                 "src/utils/utils_module.cpp",
+                "src/toolpath/crc32.cpp",
                 "src/utils/utils.pyx"],
             language="c++",
             extra_compile_args=get_default_extra_compile_args())
@@ -272,9 +307,12 @@ def create_pcl_extentions():
         sources=[
             "src/utils/g2f_module.cpp",
             "src/utils/utils_module.cpp",
+            "src/utils/preview_lod.cpp",
+            "src/toolpath/crc32.cpp",
             "src/utils/utils.pyx"],
         language="c++",
         extra_compile_args=extra_compile_args,
+        extra_link_args=get_default_extra_link_args(),
         libraries=libraries,
         library_dirs=library_dirs,
         extra_objects=[],
@@ -10,9 +10,24 @@ from _toolpathlib cimport (ToolpathProcessor as _ToolpathProcessor,
                            GCodeFileWriter as _GCodeFileWriter,
                            FCodeV1MemoryWriter as _FCodeV1MemoryWriter,
                            FCodeV1FileWriter as _FCodeV1FileWriter,
-                           PythonToolpathProcessor)
+                           FCodeV1StreamWriter as _FCodeV1StreamWriter,
+                           FCodeV1Parser as _FCodeV1Parser,
+                           fcode_v1_concat as _fcode_v1_concat,
+                           FCodeV2MemoryWriter as _FCodeV2MemoryWriter,
+                           FCodeV2FileWriter as _FCodeV2FileWriter,
+                           FCodeV2Parser as _FCodeV2Parser,
+                           SimplifyProcessor as _SimplifyProcessor,
+                           TeeProcessor as _TeeProcessor,
+                           PipelineProcessor as _PipelineProcessor,
+                           PathRecorderProcessor as _PathRecorderProcessor,
+                           PythonToolpathProcessor, PythonOutputStream)
 
 from libc.math cimport floor, ceil, round
+from libc.string cimport memcpy
+from cpython.buffer cimport PyBuffer_FillInfo
+from cpython.bytes cimport PyBytes_FromStringAndSize
+
+from functools import partial
 
 import numpy as np
 cimport numpy as np
@@ -22,6 +37,8 @@ ctypedef np.uint8_t NP_CHAR
 
 cdef class ToolpathProcessor:
     cdef _ToolpathProcessor *_proc
+    # True if the processor calls back into python and needs the GIL
+    cdef bint require_gil
 
     def __dealloc__(self):
         if self._proc:
@@ -84,24 +101,206 @@ cdef class ToolpathProcessor:
         self._proc.terminated()
 
 
+# Record layout of buffered PyToolpathProcessor events. Moves use all
+# columns, other events keep their float argument in `x` and their bool
+# argument (wait, to_standby_position) in `flags`.
+EVENT_DTYPE = np.dtype([('opcode', 'u1'), ('flags', 'u1'), ('reserved', '<u2'),
+                        ('feedrate', '<f4'), ('x', '<f4'), ('y', '<f4'),
+                        ('z', '<f4'), ('e0', '<f4'), ('e1', '<f4'),
+                        ('e2', '<f4')])
+EVENT_MOVETO = 1
+EVENT_SLEEP = 2
+EVENT_ENABLE_MOTOR = 3
+EVENT_DISABLE_MOTOR = 4
+EVENT_PAUSE = 5
+EVENT_HOME = 6
+EVENT_HEATER_TEMPERATURE = 7
+EVENT_FAN_SPEED = 8
+EVENT_PWM = 9
+
+
+def _deliver_events(callback, buf):
+    callback("events", events=np.frombuffer(buf, dtype=EVENT_DTYPE))
+
+
 cdef class PyToolpathProcessor(ToolpathProcessor):
+    """Forward toolpath events to callback(name, **kwargs).
+
+    With chunk_size > 0, numeric events are buffered natively and delivered
+    as callback("events", events=<numpy array of EVENT_DTYPE>) once every
+    chunk_size events, and when terminated() or flush() is called. Comments,
+    anchors and errors are still delivered one by one, in order."""
     cdef object pvgc
+    cdef object chunk_cb
 
-    def __init__(self, callback):
+    def __init__(self, callback, size_t chunk_size=0):
         self.pvgc = callback
-        self._proc = <_ToolpathProcessor*>new PythonToolpathProcessor(self.pvgc)
+        self.require_gil = True
+        if chunk_size:
+            self.chunk_cb = partial(_deliver_events, callback)
+            self._proc = <_ToolpathProcessor*>new PythonToolpathProcessor(
+                self.pvgc, self.chunk_cb, chunk_size)
+        else:
+            self._proc = <_ToolpathProcessor*>new PythonToolpathProcessor(self.pvgc)
+
+    def flush(self):
+        (<PythonToolpathProcessor*>self._proc).flush()
+
+
+cdef class SimplifyProcessor(ToolpathProcessor):
+    """Pass events to target with redundant commands removed: zero length
+    and feedrate only moves, repeated F/axis words, repeated fan and pwm
+    values, and runs of collinear moves (merged while every point stays
+    within tolerance mm of the merged segment)."""
+    cdef ToolpathProcessor target
+
+    def __init__(self, ToolpathProcessor target, float tolerance=0.01):
+        self.target = target
+        self.require_gil = target.require_gil
+        self._proc = <_ToolpathProcessor*>new _SimplifyProcessor(target._proc, tolerance)
+
+    def get_removed_commands(self):
+        return (<_SimplifyProcessor*>self._proc).removed_commands
+
+    def get_removed_bytes(self):
+        """Size of removed commands in FCode V1 encoding"""
+        return (<_SimplifyProcessor*>self._proc).removed_bytes
+
+
+cdef class TeeProcessor(ToolpathProcessor):
+    """Forward every event to each of targets, in order, so a single parse
+    can feed several writers and collectors."""
+    cdef tuple targets
+
+    def __init__(self, *targets):
+        cdef ToolpathProcessor target
+        self.targets = targets
+        self._proc = <_ToolpathProcessor*>new _TeeProcessor()
+        for target in targets:
+            self.require_gil = self.require_gil or target.require_gil
+            (<_TeeProcessor*>self._proc).add_target(target._proc)
+
+    def get_targets(self):
+        return self.targets
+
+
+cdef class PipelineProcessor(ToolpathProcessor):
+    """Run target on its own thread behind a bounded event queue of
+    capacity events, so parsing and encoding overlap. Errors raised by
+    target are raised again from terminated(). Target must not call back
+    into python."""
+    cdef ToolpathProcessor target
+
+    def __init__(self, ToolpathProcessor target, size_t capacity=4096):
+        if target.require_gil:
+            raise ValueError("Pipeline target can not require GIL")
+        self.target = target
+        self._proc = <_ToolpathProcessor*>new _PipelineProcessor(target._proc, capacity)
+
+    cpdef terminated(self):
+        with nogil:
+            (<_PipelineProcessor*>self._proc).terminated()
+
+    def __dealloc__(self):
+        # Stop the consumer thread before target is released
+        if self._proc:
+            del self._proc
+            self._proc = NULL
+
+
+cdef class PathRecorderProcessor(ToolpathProcessor):
+    """Record the layered preview path in a single pass. Point types use
+    the PathType values of the legacy g2f converter, perimeter points in
+    highlight_layer are recorded as highlight."""
+    def __init__(self, int highlight_layer=-1, float max_height=230):
+        self._proc = <_ToolpathProcessor*>new _PathRecorderProcessor(max_height)
+        (<_PathRecorderProcessor*>self._proc).highlight_layer = highlight_layer
+
+    def get_layer_count(self):
+        return (<_PathRecorderProcessor*>self._proc).layer_count()
+
+    def get_path(self):
+        """Return (points, types, layer_offsets) numpy arrays: float32 of
+        shape (n, 3), uint8 of shape (n, ) and uint32 start point index of
+        each layer."""
+        cdef _PathRecorderProcessor* recorder = <_PathRecorderProcessor*>self._proc
+        cdef size_t count = recorder.point_count()
+        cdef np.ndarray points = np.empty((count, 3), dtype=np.float32)
+        cdef np.ndarray types = np.empty(count, dtype=np.uint8)
+        cdef np.ndarray offsets = np.empty(recorder.layer_count(), dtype=np.uint32)
+        if count:
+            memcpy(np.PyArray_DATA(points), recorder.points.data(), count * 3 * sizeof(float))
+            memcpy(np.PyArray_DATA(types), recorder.types.data(), count)
+        if recorder.layer_count():
+            memcpy(np.PyArray_DATA(offsets), recorder.layer_offsets.data(),
+                   recorder.layer_count() * sizeof(unsigned int))
+        return points, types, offsets
+
+    def get_path_js(self):
+        """Same JSON string as GcodeToFcodeCpp.get_path()"""
+        cdef string output
+        with nogil:
+            (<_PathRecorderProcessor*>self._proc).to_js(&output)
+        return output.decode()
+
+
+cdef char* EMPTY_BUFFER = ""
+
+
+cdef fill_buffer(Py_buffer *buffer, object owner, vector[char]& data, int flags):
+    cdef char* ptr = data.data() if data.size() else EMPTY_BUFFER
+    PyBuffer_FillInfo(buffer, owner, ptr, data.size(), 1, flags)
+
+
+cdef class ToolpathBuffer:
+    """Output detached from a memory writer. memoryview(), numpy.frombuffer()
+    or file.write() read it in place; bytes() makes one copy."""
+    cdef vector[char] data
+
+    def __len__(self):
+        return self.data.size()
+
+    def __getbuffer__(self, Py_buffer *buffer, int flags):
+        fill_buffer(buffer, self, self.data, flags)
+
+    def __releasebuffer__(self, Py_buffer *buffer):
+        pass
+
+    def __bytes__(self):
+        return PyBytes_FromStringAndSize(self.data.data(), self.data.size())
 
 
 cdef class GCodeMemoryWriter(ToolpathProcessor):
+    """Write G-code to memory. Once terminated, the writer itself can be read
+    in place through the buffer protocol (memoryview(writer))."""
+    cdef int exports
+
     def __init__(self):
         self._proc = <_ToolpathProcessor*>new _GCodeMemoryWriter()
 
+    def __getbuffer__(self, Py_buffer *buffer, int flags):
+        cdef _GCodeMemoryWriter* writer = <_GCodeMemoryWriter*>self._proc
+        if not writer.is_terminated():
+            raise BufferError("Writer is not terminated")
+        fill_buffer(buffer, self, writer.buffer, flags)
+        self.exports += 1
+
+    def __releasebuffer__(self, Py_buffer *buffer):
+        self.exports -= 1
+
     def get_buffer(self):
-        # TODO
-        # cdef const string& swap = (<_GCodeMemoryWriter*>self._proc).get_buffer()
-        # return swap.c_str()[:swap.size()]
-        cdef string swap = (<_GCodeMemoryWriter*>self._proc).get_buffer()
-        return swap.c_str()[:swap.size()]
+        cdef _GCodeMemoryWriter* writer = <_GCodeMemoryWriter*>self._proc
+        writer.flush()
+        return PyBytes_FromStringAndSize(writer.buffer.data(), writer.buffer.size())
+
+    def detach(self):
+        """Move output into a ToolpathBuffer without copying, leaving this
+        writer empty"""
+        if self.exports:
+            raise BufferError("Writer buffer is exported")
+        cdef ToolpathBuffer result = ToolpathBuffer()
+        (<_GCodeMemoryWriter*>self._proc).detach_buffer(&result.data)
+        return result
 
 
 cdef class GCodeFileWriter(ToolpathProcessor):
@@ -110,9 +309,12 @@ cdef class GCodeFileWriter(ToolpathProcessor):
 
 
 cdef class FCodeV1MemoryWriter(ToolpathProcessor):
+    """Write FCode to memory. Once terminated, the writer itself can be read
+    in place through the buffer protocol (memoryview(writer))."""
     cdef string headtype
     cdef vector[pair[string, string]] metadata
     cdef vector[string] previews
+    cdef int exports
 
     def __init__(self, head_type, metadata, previews):
         self.headtype = head_type.encode()
@@ -121,12 +323,34 @@ cdef class FCodeV1MemoryWriter(ToolpathProcessor):
         self._proc = <_ToolpathProcessor*>new _FCodeV1MemoryWriter(&self.headtype,
             &self.metadata, &self.previews)
 
+    def __dealloc__(self):
+        # Writer may still refer metadata/previews owned by this object
+        if self._proc:
+            del self._proc
+            self._proc = NULL
+
+    def __getbuffer__(self, Py_buffer *buffer, int flags):
+        cdef _FCodeV1MemoryWriter* writer = <_FCodeV1MemoryWriter*>self._proc
+        if not writer.is_terminated():
+            raise BufferError("Writer is not terminated")
+        fill_buffer(buffer, self, writer.buffer, flags)
+        self.exports += 1
+
+    def __releasebuffer__(self, Py_buffer *buffer):
+        self.exports -= 1
+
     def get_buffer(self):
-        # TODO
-        # cdef const string& swap = (<_FCodeV1MemoryWriter*>self._proc).get_buffer()
-        # return swap.c_str()[:swap.size()]
-        cdef string swap = (<_FCodeV1MemoryWriter*>self._proc).get_buffer()
-        return swap.c_str()[:swap.size()]
+        cdef _FCodeV1MemoryWriter* writer = <_FCodeV1MemoryWriter*>self._proc
+        return PyBytes_FromStringAndSize(writer.buffer.data(), writer.buffer.size())
+
+    def detach(self):
+        """Move output into a ToolpathBuffer without copying, leaving this
+        writer empty"""
+        if self.exports:
+            raise BufferError("Writer buffer is exported")
+        cdef ToolpathBuffer result = ToolpathBuffer()
+        (<_FCodeV1MemoryWriter*>self._proc).detach_buffer(&result.data)
+        return result
 
     def set_metadata(self, metadata):
         self.metadata = ((k.encode(), v.encode()) for k, v in metadata.items())
@@ -162,6 +386,12 @@ cdef class FCodeV1FileWriter(ToolpathProcessor):
         self._proc = <_ToolpathProcessor*>new _FCodeV1FileWriter(self.filename.c_str(), &self.headtype,
             &self.metadata, &self.previews)
 
+    def __dealloc__(self):
+        # Writer may still refer metadata/previews owned by this object
+        if self._proc:
+            del self._proc
+            self._proc = NULL
+
     def set_metadata(self, metadata):
         self.metadata = ((k.encode(), v.encode()) for k, v in metadata.items())
         (<_FCodeV1FileWriter*>self._proc).metadata = &self.metadata
@@ -177,8 +407,187 @@ cdef class FCodeV1FileWriter(ToolpathProcessor):
         return (<_FCodeV1FileWriter*>self._proc).errors
 
 
+cdef class FCodeV1StreamWriter(ToolpathProcessor):
+    """Write FCode to a sequential file like object (pipe, socket, upload
+    stream) which only needs write(). Script is kept in memory, or in a
+    temporary file once larger than spill_threshold bytes, and the whole
+    file is written to stream when terminated() is called."""
+    cdef PythonOutputStream *output
+    cdef string headtype
+    cdef vector[pair[string, string]] metadata
+    cdef vector[string] previews
+
+    def __init__(self, stream, head_type, metadata, previews,
+                 size_t spill_threshold=64 << 20):
+        self.output = new PythonOutputStream(stream)
+        # stream.write() is called from the writer
+        self.require_gil = True
+        self.headtype = head_type.encode()
+        self.metadata = ((k.encode(), v.encode()) for k, v in metadata.items())
+        self.previews = previews
+        self._proc = <_ToolpathProcessor*>new _FCodeV1StreamWriter(self.output, &self.headtype,
+            &self.metadata, &self.previews, spill_threshold)
+
+    def __dealloc__(self):
+        if self._proc:
+            del self._proc
+            self._proc = NULL
+        if self.output:
+            del self.output
+            self.output = NULL
+
+    cpdef terminated(self):
+        (<_FCodeV1StreamWriter*>self._proc).terminated()
+
+    def set_metadata(self, metadata):
+        self.metadata = ((k.encode(), v.encode()) for k, v in metadata.items())
+        (<_FCodeV1StreamWriter*>self._proc).metadata = &self.metadata
+
+    def set_previews(self, previews):
+        self.previews = previews
+        (<_FCodeV1StreamWriter*>self._proc).previews = &self.previews
+
+    def get_metadata(self):
+        return dict(self.metadata)
+
+    def errors(self):
+        return (<_FCodeV1StreamWriter*>self._proc).errors
+
+
+def fcode_concat(inputs, output, separator=b""):
+    """Join FCode V1 files `inputs` into `output` (a filename or a file like
+    object with write()), with `separator` G-code converted and placed
+    between every two jobs. Scripts are not decoded; E of extruder jobs is
+    shifted to continue from the previous job. Return merged metadata."""
+    if isinstance(output, str):
+        with open(output, "wb") as f:
+            return fcode_concat(inputs, f, separator)
+
+    cdef vector[string] filenames = [fn.encode() for fn in inputs]
+    cdef string c_separator = separator
+    cdef vector[pair[string, string]] metadata
+    cdef PythonOutputStream *stream = new PythonOutputStream(output)
+    try:
+        _fcode_v1_concat(filenames, c_separator, stream, &metadata)
+    except RuntimeError as e:
+        raise ValueError(*e.args)
+    finally:
+        del stream
+    return {k.decode("utf8"): v.decode("utf8") for k, v in metadata}
+
+
+cdef class FCodeV2MemoryWriter(ToolpathProcessor):
+    """Write compact FCode V2 to memory. Coordinates are rounded to
+    resolution (E to e_resolution) mm, compress_level 1-9 deflates the
+    script with zlib."""
+    cdef string headtype
+    cdef vector[pair[string, string]] metadata
+    cdef vector[string] previews
+    cdef int exports
+
+    def __init__(self, head_type, metadata, previews, double resolution=0.001,
+                 double e_resolution=0.00001, int compress_level=0):
+        self.headtype = head_type.encode()
+        self.metadata = ((k.encode(), v.encode()) for k, v in metadata.items())
+        self.previews = previews
+        try:
+            self._proc = <_ToolpathProcessor*>new _FCodeV2MemoryWriter(&self.headtype,
+                &self.metadata, &self.previews, resolution, e_resolution, compress_level)
+        except RuntimeError as e:
+            raise ValueError(*e.args)
+
+    def __dealloc__(self):
+        # Writer may still refer metadata/previews owned by this object
+        if self._proc:
+            del self._proc
+            self._proc = NULL
+
+    def __getbuffer__(self, Py_buffer *buffer, int flags):
+        cdef _FCodeV2MemoryWriter* writer = <_FCodeV2MemoryWriter*>self._proc
+        if not writer.is_terminated():
+            raise BufferError("Writer is not terminated")
+        fill_buffer(buffer, self, writer.buffer, flags)
+        self.exports += 1
+
+    def __releasebuffer__(self, Py_buffer *buffer):
+        self.exports -= 1
+
+    def get_buffer(self):
+        cdef _FCodeV2MemoryWriter* writer = <_FCodeV2MemoryWriter*>self._proc
+        return PyBytes_FromStringAndSize(writer.buffer.data(), writer.buffer.size())
+
+    def detach(self):
+        """Move output into a ToolpathBuffer without copying, leaving this
+        writer empty"""
+        if self.exports:
+            raise BufferError("Writer buffer is exported")
+        cdef ToolpathBuffer result = ToolpathBuffer()
+        (<_FCodeV2MemoryWriter*>self._proc).detach_buffer(&result.data)
+        return result
+
+    def set_metadata(self, metadata):
+        self.metadata = ((k.encode(), v.encode()) for k, v in metadata.items())
+        (<_FCodeV2MemoryWriter*>self._proc).metadata = &self.metadata
+
+    def set_previews(self, previews):
+        self.previews = previews
+        (<_FCodeV2MemoryWriter*>self._proc).previews = &self.previews
+
+    def get_metadata(self):
+        return dict(self.metadata)
+
+    def get_travled(self):
+        return (<_FCodeV2MemoryWriter*>self._proc).travled
+
+    def get_time_cost(self):
+        return (<_FCodeV2MemoryWriter*>self._proc).time_cost
+
+    def errors(self):
+        return (<_FCodeV2MemoryWriter*>self._proc).errors
+
+
+cdef class FCodeV2FileWriter(ToolpathProcessor):
+    cdef string filename, headtype
+    cdef vector[pair[string, string]] metadata
+    cdef vector[string] previews
+
+    def __init__(self, filename, head_type, metadata, previews,
+                 double resolution=0.001, double e_resolution=0.00001,
+                 int compress_level=0):
+        self.filename = filename.encode()
+        self.headtype = head_type.encode()
+        self.metadata = ((k.encode(), v.encode()) for k, v in metadata.items())
+        self.previews = previews
+        try:
+            self._proc = <_ToolpathProcessor*>new _FCodeV2FileWriter(self.filename.c_str(), &self.headtype,
+                &self.metadata, &self.previews, resolution, e_resolution, compress_level)
+        except RuntimeError as e:
+            raise ValueError(*e.args)
+
+    def __dealloc__(self):
+        # Writer may still refer metadata/previews owned by this object
+        if self._proc:
+            del self._proc
+            self._proc = NULL
+
+    def set_metadata(self, metadata):
+        self.metadata = ((k.encode(), v.encode()) for k, v in metadata.items())
+        (<_FCodeV2FileWriter*>self._proc).metadata = &self.metadata
+
+    def set_previews(self, previews):
+        self.previews = previews
+        (<_FCodeV2FileWriter*>self._proc).previews = &self.previews
+
+    def get_metadata(self):
+        return dict(self.metadata)
+
+    def errors(self):
+        return (<_FCodeV2FileWriter*>self._proc).errors
+
+
 cdef class GCodeParser:
     cdef _GCodeParser *_parser
+    cdef ToolpathProcessor py_proc
 
     def __cinit__(self):
         self._parser = new _GCodeParser()
@@ -190,13 +599,140 @@ cdef class GCodeParser:
         self._parser.set_processor(proc)
 
     cpdef set_processor(self, ToolpathProcessor py_proc):
+        self.py_proc = py_proc
         self.set_c_processor(py_proc._proc)
 
     cpdef parse_command(self, bytes command):
         self._parser.parse_command(command, len(command))
 
+    def set_arc_tolerance(self, float tolerance):
+        """Largest distance (mm) between a G2/G3 arc and its segments"""
+        self._parser.arc_tolerance = tolerance
+
+    cpdef parse_from_file(self, filename, int threads=1):
+        """Parse a G-code file. With threads > 1, lines are decoded by worker
+        threads while events are still delivered in order on this thread."""
+        cdef string c_filename = filename.encode()
+        if self.py_proc is not None and self.py_proc.require_gil:
+            self._parser.parse_from_file(c_filename.c_str(), threads)
+        else:
+            with nogil:
+                self._parser.parse_from_file(c_filename.c_str(), threads)
+
+    cpdef parse_buffer(self, buffer, int threads=1):
+        """Parse G-code from any object support buffer protocol (bytes,
+        bytearray, mmap, memoryview) without copying it."""
+        cdef const unsigned char[::1] view = buffer
+        cdef const char* buf
+        cdef size_t size = view.shape[0]
+        if size == 0:
+            return
+        buf = <const char*>&view[0]
+
+        if self.py_proc is not None and self.py_proc.require_gil:
+            self._parser.parse_buffer_parallel(buf, size, threads)
+        else:
+            with nogil:
+                self._parser.parse_buffer_parallel(buf, size, threads)
+
+cdef class FCodeV1Parser:
+    """Native FCode V1 reader. Both parse functions return a tuple
+    (metadata, previews) and raise ValueError on malformed contents."""
+    cdef _FCodeV1Parser *_parser
+    cdef ToolpathProcessor py_proc
+
+    def __cinit__(self):
+        self._parser = new _FCodeV1Parser()
+
+    def __dealloc__(self):
+        del self._parser
+
+    cpdef set_processor(self, ToolpathProcessor py_proc):
+        self.py_proc = py_proc
+        self._parser.set_processor(py_proc._proc)
+
     cpdef parse_from_file(self, filename):
-        self._parser.parse_from_file(filename.encode())
+        cdef string c_filename = filename.encode()
+        try:
+            if self.py_proc is not None and self.py_proc.require_gil:
+                self._parser.parse_from_file(c_filename.c_str())
+            else:
+                with nogil:
+                    self._parser.parse_from_file(c_filename.c_str())
+        except RuntimeError as e:
+            raise ValueError(*e.args)
+        return self._result()
+
+    cpdef parse_buffer(self, buffer):
+        cdef const unsigned char[::1] view = buffer
+        cdef const char* buf = NULL
+        cdef size_t size = view.shape[0]
+        if size:
+            buf = <const char*>&view[0]
+
+        try:
+            if self.py_proc is not None and self.py_proc.require_gil:
+                self._parser.parse_buffer(buf, size)
+            else:
+                with nogil:
+                    self._parser.parse_buffer(buf, size)
+        except RuntimeError as e:
+            raise ValueError(*e.args)
+        return self._result()
+
+    cpdef resume_from_file(self, filename, size_t entry):
+        """Restore the state recorded at get_index()[entry] and decode the
+        script from there."""
+        cdef string c_filename = filename.encode()
+        try:
+            if self.py_proc is not None and self.py_proc.require_gil:
+                self._parser.resume_from_file(c_filename.c_str(), entry)
+            else:
+                with nogil:
+                    self._parser.resume_from_file(c_filename.c_str(), entry)
+        except RuntimeError as e:
+            raise ValueError(*e.args)
+        return self._result()
+
+    cpdef resume_buffer(self, buffer, size_t entry):
+        cdef const unsigned char[::1] view = buffer
+        cdef const char* buf = NULL
+        cdef size_t size = view.shape[0]
+        if size:
+            buf = <const char*>&view[0]
+
+        try:
+            if self.py_proc is not None and self.py_proc.require_gil:
+                self._parser.resume_buffer(buf, size, entry)
+            else:
+                with nogil:
+                    self._parser.resume_buffer(buf, size, entry)
+        except RuntimeError as e:
+            raise ValueError(*e.args)
+        return self._result()
+
+    def get_index(self):
+        """Anchors ("anchor") and layers ("layer") of the last parsed file"""
+        return [{"type": "anchor" if e.kind == b'A' else "layer",
+                 "value": e.value, "offset": e.offset,
+                 "feedrate": e.feedrate, "x": e.x, "y": e.y, "z": e.z,
+                 "e": (e.e[0], e.e[1], e.e[2]),
+                 "temperature": e.temperature, "fan_speed": e.fan_speed,
+                 "pwm": e.pwm, "absolute": e.absolute} for e in self._parser.index]
+
+    cdef _result(self):
+        metadata = {k.decode("utf8"): v.decode("utf8")
+                    for k, v in self._parser.metadata}
+        previews = tuple(self._parser.previews)
+        return metadata, previews
+
+
+cdef class FCodeV2Parser(FCodeV1Parser):
+    """Native FCode V2 reader, same interface as FCodeV1Parser"""
+    def __cinit__(self):
+        del self._parser
+        self._parser = new _FCodeV2Parser()
+
 
 cdef class DitheringProcessor:
     cdef dither_c(self, np.ndarray[NP_CHAR, ndim=3] data):
@@ -4,6 +4,10 @@ from libcpp.vector cimport vector
 from libcpp.pair cimport pair
 from libcpp cimport bool
 
+cdef extern from "<ostream>" namespace "std":
+    cdef cppclass ostream:
+        pass
+
 cdef extern from "toolpath.h" namespace "FLUX":
     cdef cppclass ToolpathProcessor:
         void moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) nogil
@@ -24,7 +28,9 @@ cdef extern from "gcode.h" namespace "FLUX":
     cdef cppclass GCodeParser:
         GCodeParser() nogil except +
         void set_processor(ToolpathProcessor*) nogil
-        void parse_from_file(const char*) nogil except +
+        void parse_from_file(const char*, int) nogil except +
+        void parse_buffer(const char*, size_t) nogil except +
+        void parse_buffer_parallel(const char*, size_t, int) nogil except +
         void parse_command(const char*, size_t) nogil except +
 
         float feedrate
@@ -35,32 +41,127 @@ cdef extern from "gcode.h" namespace "FLUX":
         int T
         bool from_inch
         bool absolute
+        int arc_plane
+        float arc_tolerance
 
     cdef cppclass GCodeMemoryWriter:
         GCodeMemoryWriter() nogil
         string get_buffer() nogil
+        void flush() nogil
+        void detach_buffer(vector[char]*) nogil
+        bool is_terminated() nogil
+        vector[char] buffer
 
     cdef cppclass GCodeFileWriter:
         GCodeFileWriter(const char* filename) nogil except +
 
 
 cdef extern from "fcode.h" namespace "FLUX":
+    cdef struct FCodeIndexEntry:
+        char kind
+        unsigned int value
+        unsigned int offset
+        float feedrate, x, y, z
+        float e[3]
+        float temperature, fan_speed, pwm
+        bool absolute
+
     cdef cppclass FCodeV1MemoryWriter:
         FCodeV1MemoryWriter(string*, vector[pair[string, string]]*, vector[string]*) nogil
         string get_buffer() nogil
+        void detach_buffer(vector[char]*) nogil
+        bool is_terminated() nogil
+        vector[char] buffer
         vector[pair[string, string]] *metadata
         vector[string] *previews
         vector[string] errors
         double travled
         double time_cost
 
+    cdef cppclass FCodeV1StreamWriter:
+        FCodeV1StreamWriter(ostream*, string*, vector[pair[string, string]]*, vector[string]*, size_t) nogil
+        vector[pair[string, string]] *metadata
+        vector[string] *previews
+        vector[string] errors
+        void terminated() except +
+
+    cdef cppclass FCodeV1Parser:
+        FCodeV1Parser() nogil
+        void set_processor(ToolpathProcessor*) nogil
+        void parse_from_file(const char*) nogil except +
+        void parse_buffer(const char*, size_t) nogil except +
+        void resume_from_file(const char*, size_t) nogil except +
+        void resume_buffer(const char*, size_t, size_t) nogil except +
+        vector[pair[string, string]] metadata
+        vector[string] previews
+        vector[FCodeIndexEntry] index
+
+    void fcode_v1_concat(vector[string]&, string&, ostream*, vector[pair[string, string]]*) except +
+
     cdef cppclass FCodeV1FileWriter:
         FCodeV1FileWriter(const char*, string*, vector[pair[string, string]]*, vector[string]*) nogil
         vector[pair[string, string]] *metadata
         vector[string] *previews
         vector[string] errors
 
+    cdef cppclass FCodeV2MemoryWriter:
+        FCodeV2MemoryWriter(string*, vector[pair[string, string]]*, vector[string]*, double, double, int) nogil except +
+        void detach_buffer(vector[char]*) nogil
+        bool is_terminated() nogil
+        vector[char] buffer
+        vector[pair[string, string]] *metadata
+        vector[string] *previews
+        vector[string] errors
+        double travled
+        double time_cost
+
+    cdef cppclass FCodeV2FileWriter:
+        FCodeV2FileWriter(const char*, string*, vector[pair[string, string]]*, vector[string]*, double, double, int) nogil except +
+        vector[pair[string, string]] *metadata
+        vector[string] *previews
+        vector[string] errors
+
+    cdef cppclass FCodeV2Parser(FCodeV1Parser):
+        FCodeV2Parser() nogil
+
+
+cdef extern from "simplify_processor.h" namespace "FLUX":
+    cdef cppclass SimplifyProcessor:
+        SimplifyProcessor(ToolpathProcessor*, float) nogil
+        float chord_tolerance
+        size_t removed_commands
+        size_t removed_bytes
+
+
+cdef extern from "tee_processor.h" namespace "FLUX":
+    cdef cppclass TeeProcessor:
+        TeeProcessor() nogil
+        void add_target(ToolpathProcessor*) nogil
+
+
+cdef extern from "pipeline_processor.h" namespace "FLUX":
+    cdef cppclass PipelineProcessor:
+        PipelineProcessor(ToolpathProcessor*, size_t) nogil
+        void terminated() nogil except +
+
+
+cdef extern from "path_recorder_processor.h" namespace "FLUX":
+    cdef cppclass PathRecorderProcessor:
+        PathRecorderProcessor(float) nogil
+        size_t point_count() nogil
+        size_t layer_count() nogil
+        void to_js(string*) nogil
+        vector[float] points
+        vector[unsigned char] types
+        vector[unsigned int] layer_offsets
+        int highlight_layer
+
 
 cdef extern from "py_processor.h" namespace "FLUX":
     cdef cppclass PythonToolpathProcessor:
         PythonToolpathProcessor(object) nogil
+        PythonToolpathProcessor(object, object, size_t) nogil
+        void flush() except +
+
+    cdef cppclass PythonOutputStream(ostream):
+        PythonOutputStream(object) except +
@@ -0,0 +1,358 @@
+/*-
+ *  COPYRIGHT (C) 1986 Gary S. Brown.  You may use this program, or
+ *  code or tables extracted from it, as desired without restriction.
+ *
+ *  First, the polynomial itself and its table of feedback terms.  The
+ *  polynomial is
+ *  X^32+X^26+X^23+X^22+X^16+X^12+X^11+X^10+X^8+X^7+X^5+X^4+X^2+X^1+X^0
+ *
+ *  Note that we take it "backwards" and put the highest-order term in
+ *  the lowest-order bit.  The X^32 term is "implied"; the LSB is the
+ *  X^31 term, etc.  The X^0 term (usually shown as "+1") results in
+ *  the MSB being 1
+ *
+ *  Note that the usual hardware shift register implementation, which
+ *  is what we're using (we're merely optimizing it by doing eight-bit
+ *  chunks at a time) shifts bits into the lowest-order term.  In our
+ *  implementation, that means shifting towards the right.  Why do we
+ *  do it this way?  Because the calculated CRC must be transmitted in
+ *  order from highest-order term to lowest-order term.  UARTs transmit
+ *  characters in order from LSB to MSB.  By storing the CRC this way
+ *  we hand it to the UART in the order low-byte to high-byte; the UART
+ *  sends each low-bit to hight-bit; and the result is transmission bit
+ *  by bit from highest- to lowest-order term without requiring any bit
+ *  shuffling on our part.  Reception works similarly
+ *
+ *  The feedback terms table consists of 256, 32-bit entries.  Notes
+ *
+ *      The table can be generated at runtime if desired; code to do so
+ *      is shown later.  It might not be obvious, but the feedback
+ *      terms simply represent the results of eight shift/xor opera
+ *      tions for all combinations of data and CRC register values
+ *
+ *      The values must be right-shifted by eight bits by the "updcrc
+ *      logic; the shift must be unsigned (bring in zeroes).  On some
+ *      hardware you could probably optimize the shift in assembler by
+ *      using byte-swap instructions
+ *      polynomial $edb88320
+ *
+ *
+ * CRC32 code derived from work by Gary S. Brown.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "crc32.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32_X86_CLMUL 1
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && (defined(__linux__) || defined(__APPLE__))
+#define CRC32_ARM_CRC 1
+#include <arm_acle.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#ifdef __clang__
+#define CRC32_ARM_TARGET "crc"
+#else
+#define CRC32_ARM_TARGET "+crc"
+#endif
+#endif
+
+static const uint32_t crc32_tab[] = {
+  0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
+  0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
+  0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
+  0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+  0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
+  0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
+  0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
+  0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+  0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
+  0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
+  0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
+  0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+  0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
+  0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
+  0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
+  0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+  0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
+  0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
+  0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
+  0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+  0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
+  0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
+  0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
+  0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+  0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
+  0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
+  0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
+  0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+  0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
+  0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
+  0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
+  0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+  0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
+  0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
+  0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
+  0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+  0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
+  0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
+  0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
+  0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+  0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
+  0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
+  0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+};
+
+// Table based implementation for short buffers and the unaligned head/tail
+// of the accelerated ones. Operates on the inverted crc register.
+static inline uint32_t crc32_bytes(uint32_t crc, const uint8_t *p, size_t size) {
+    while(size--) {
+        crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+
+namespace {
+    struct Crc32Tables {
+        // slice[0] is crc32_tab, slice[k][n] is the crc of byte n followed
+        // by k zero bytes.
+        uint32_t slice[8][256];
+        // x2n[k] = x^(2^k) mod P, used by crc32_combine
+        uint32_t x2n[32];
+        uint32_t (*impl)(uint32_t, const uint8_t*, size_t);
+
+        Crc32Tables(void);
+    };
+
+    // Multiply a and b modulo the crc polynomial (reflected)
+    uint32_t multmodp(uint32_t a, uint32_t b) {
+        uint32_t m = (uint32_t)1 << 31, p = 0;
+        while(true) {
+            if(a & m) {
+                p ^= b;
+                if((a & (m - 1)) == 0) break;
+            }
+            m >>= 1;
+            b = (b & 1) ? (b >> 1) ^ 0xedb88320 : b >> 1;
+        }
+        return p;
+    }
+
+    const Crc32Tables& tables(void);
+
+    uint32_t crc32_slicing8(uint32_t crc, const uint8_t *p, size_t size) {
+        const uint32_t (*t)[256] = tables().slice;
+
+        while(size && ((uintptr_t)p & 7)) {
+            crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+            size--;
+        }
+        while(size >= 8) {
+            uint32_t lo, hi;
+            memcpy(&lo, p, 4);
+            memcpy(&hi, p + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            lo = __builtin_bswap32(lo);
+            hi = __builtin_bswap32(hi);
+#endif
+            lo ^= crc;
+            crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^
+                  t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+                  t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^
+                  t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+            p += 8;
+            size -= 8;
+        }
+        return crc32_bytes(crc, p, size);
+    }
+
+#ifdef CRC32_X86_CLMUL
+    // Carry-less multiplication folding, see Intel "Fast CRC Computation
+    // for Generic Polynomials Using PCLMULQDQ Instruction". Folds 4x128
+    // bits per iteration, then reduces with Barrett.
+    __attribute__((target("pclmul,sse4.1")))
+    uint32_t crc32_clmul(uint32_t crc, const uint8_t *p, size_t size) {
+        if(size < 64) {
+            return crc32_slicing8(crc, p, size);
+        }
+
+        const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+        const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+        const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+        const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+        const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+        __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+        x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+        x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+        x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+        x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+        p += 64;
+        size -= 64;
+
+        while(size >= 64) {
+            x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+            x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+            x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+            x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+            x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+            x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+            x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(p + 0x00)));
+            x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(p + 0x10)));
+            x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(p + 0x20)));
+            x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(p + 0x30)));
+            p += 64;
+            size -= 64;
+        }
+
+        // Fold 4x128 into 128 bits
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+        while(size >= 16) {
+            x2 = _mm_loadu_si128((const __m128i *)p);
+            x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+            p += 16;
+            size -= 16;
+        }
+
+        // Fold 128 to 64 bits
+        x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+        x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+        x2 = _mm_srli_si128(x1, 4);
+        x1 = _mm_and_si128(x1, mask32);
+        x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        // Barrett reduce to 32 bits
+        x2 = _mm_and_si128(x1, mask32);
+        x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+        x2 = _mm_and_si128(x2, mask32);
+        x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+        crc = (uint32_t)_mm_extract_epi32(x1, 1);
+
+        return crc32_slicing8(crc, p, size);
+    }
+
+    bool has_clmul(void) {
+        unsigned int eax, ebx, ecx, edx;
+        if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+        return (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+    }
+#endif
+
+#ifdef CRC32_ARM_CRC
+    __attribute__((target(CRC32_ARM_TARGET)))
+    uint32_t crc32_armv8(uint32_t crc, const uint8_t *p, size_t size) {
+        while(size && ((uintptr_t)p & 7)) {
+            crc = __crc32b(crc, *p++);
+            size--;
+        }
+        while(size >= 32) {
+            uint64_t v[4];
+            memcpy(v, p, 32);
+            crc = __crc32d(crc, v[0]);
+            crc = __crc32d(crc, v[1]);
+            crc = __crc32d(crc, v[2]);
+            crc = __crc32d(crc, v[3]);
+            p += 32;
+            size -= 32;
+        }
+        while(size >= 8) {
+            uint64_t v;
+            memcpy(&v, p, 8);
+            crc = __crc32d(crc, v);
+            p += 8;
+            size -= 8;
+        }
+        while(size--) {
+            crc = __crc32b(crc, *p++);
+        }
+        return crc;
+    }
+
+    bool has_armv8_crc(void) {
+#ifdef __APPLE__
+        return true;
+#else
+        return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+    }
+#endif
+
+    Crc32Tables::Crc32Tables(void) {
+        memcpy(slice[0], crc32_tab, sizeof(crc32_tab));
+        for(int n=0;n<256;n++) {
+            uint32_t c = slice[0][n];
+            for(int k=1;k<8;k++) {
+                c = crc32_tab[c & 0xFF] ^ (c >> 8);
+                slice[k][n] = c;
+            }
+        }
+
+        uint32_t p = (uint32_t)1 << 30;  // x^1
+        x2n[0] = p;
+        for(int n=1;n<32;n++) {
+            x2n[n] = p = multmodp(p, p);
+        }
+
+        impl = crc32_slicing8;
+#ifdef CRC32_X86_CLMUL
+        if(has_clmul()) impl = crc32_clmul;
+#endif
+#ifdef CRC32_ARM_CRC
+        if(has_armv8_crc()) impl = crc32_armv8;
+#endif
+    }
+
+    const Crc32Tables& tables(void) {
+        static const Crc32Tables instance;
+        return instance;
+    }
+}
+
+
+uint32_t FLUX::crc32(uint32_t crc, const void *buf, size_t size) {
+    const uint8_t *p = (const uint8_t *)buf;
+    crc = crc ^ ~0U;
+    // Single commands are a few bytes, skip the dispatch for them
+    if(size < 16) {
+        crc = crc32_bytes(crc, p, size);
+    } else {
+        crc = tables().impl(crc, p, size);
+    }
+    return crc ^ ~0U;
+}
+
+uint32_t FLUX::crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2) {
+    // crc1 * x^(8 * len2) mod P, then add crc2
+    const uint32_t *x2n = tables().x2n;
+    uint32_t p = (uint32_t)1 << 31;  // x^0
+    unsigned k = 3;
+    while(len2) {
+        if(len2 & 1) p = multmodp(x2n[k & 31], p);
+        len2 >>= 1;
+        k++;
+    }
+    return multmodp(p, crc1) ^ crc2;
+}
@@ -0,0 +1,18 @@
+
+#ifndef _CRC32_H
+#define _CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace FLUX {
+    // CRC-32 (IEEE 802.3, same as zlib). Uses PCLMULQDQ on x86 or the
+    // ARMv8 CRC instructions when the running CPU has them, slicing-by-8
+    // tables otherwise. Start from crc = 0.
+    uint32_t crc32(uint32_t crc, const void *buf, size_t size);
+
+    // CRC of A+B from crc(A), crc(B) and length of B
+    uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+}
+
+#endif
@@ -1,23 +1,82 @@
 
+#include <stdio.h>
+#include <string.h>
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 #include "toolpath.h"
 
+// Size of script staging buffer, must hold a full MoveBatch (29 bytes/move)
+#define FCODE_STAGING_CAPACITY 65536
+
+// V2 move: 1 command byte + feedrate + 6 varints
+#define FCODE_V2_MAX_MOVE_SIZE 65
+// V2 header flags
+#define FCODE_V2_ZLIB 1
+
+// Kind of FCodeIndexEntry
+#define FCODE_INDEX_ANCHOR 'A'
+#define FCODE_INDEX_LAYER 'L'
+
 
 namespace FLUX {
+    // Script offset and machine state at an anchor or at the start of a
+    // layer (";LAYER..." comment). Stored in the INDEX metadata entry so a
+    // reader can resume from it without decoding the script before.
+    struct FCodeIndexEntry {
+        char kind;
+        // Anchor value or layer number (from 0)
+        uint32_t value;
+        // Offset from the first byte of script
+        uint32_t offset;
+        float feedrate, x, y, z;
+        float e[3];
+        float temperature, fan_speed, pwm;
+        // Moves after offset are absolute (command 2) or relative (command 3)
+        bool absolute;
+    };
+
+    // Value of INDEX metadata
+    std::string format_fcode_index(const std::vector<FCodeIndexEntry>& index);
+    // Comment starting a layer: Cura ";LAYER:n", Slic3r/PrusaSlicer
+    // ";LAYER_CHANGE". Headers such as ";LAYER_COUNT:n" do not match.
+    bool is_layer_comment(const char* message, size_t length);
+
     class FCodeV1Base : public FLUX::ToolpathProcessor {
     protected:
         std::ostream *stream;
         unsigned long script_crc32;
+        // Script commands are encoded into the staging buffer. It is sent to
+        // write_script() and added to script_crc32 when full or by
+        // flush_script().
+        char *staging;
+        size_t staging_size;
+        // Script bytes already passed to write()
+        size_t script_written;
+        inline char* reserve(size_t size) {
+            if(staging_size + size > FCODE_STAGING_CAPACITY) flush_script();
+            return staging + staging_size;
+        }
+        inline void stage(const void* buf, size_t size) {
+            memcpy(reserve(size), buf, size);
+            staging_size += size;
+        }
+        inline void stage(float value) { stage(&value, 4); }
+        inline void stage_command(unsigned char cmd) { stage(&cmd, 1); }
+        void flush_script(void);
+        inline size_t script_position(void) { return script_written + staging_size; }
+
         virtual void write(const char* buf, size_t size, unsigned long *crc32);
-        void write(float value, unsigned long *crc32);
         void write(uint32_t value, unsigned long *crc32);
-        void write_command(unsigned char cmd, unsigned long *crc32);
+        // Store encoded script, write() by default
+        virtual void write_script(const char* buf, size_t size);
     public:
         std::vector<std::string> errors;
+        FCodeV1Base(void);
+        virtual ~FCodeV1Base(void);
         virtual void moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2);
+        virtual void moveto_batch(const FLUX::MoveBatch* batch);
         virtual void sleep(float seconds);
         virtual void enable_motor(void);
         virtual void disable_motor(void);
@@ -36,10 +95,20 @@ namespace FLUX {
 
     class FCodeV1 : public FLUX::FCodeV1Base {
     protected:
-        int script_offset;
+        long script_offset;
+        // Value of VERSION metadata
+        const char* version;
         // Return metadata crc32
         unsigned long write_metadata(void);
+        // Metadata block and previews, following the script block
+        void write_trailer(void);
         void begin(void);
+        // Output position and rewriting a length field, using stream by default
+        virtual long tell(void);
+        virtual void patch(long offset, uint32_t value);
+        // Update position, travel distance, time cost and bounding values
+        void update_statistics(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2);
+        void append_index(char kind, uint32_t value);
     public:
         std::string *head_type;
         double travled;
@@ -47,6 +116,9 @@ namespace FLUX {
         float home_x, home_y, home_z;
         float current_feedrate, current_x, current_y, current_z;
         float max_x, max_y, max_z, max_r, filament[3];
+        float current_temperature, current_fan_speed, current_pwm;
+        uint32_t layer_count;
+        std::vector<FCodeIndexEntry> index;
 
         std::vector<std::pair<std::string, std::string> > *metadata;
         std::vector<std::string> *previews;
@@ -55,24 +127,121 @@ namespace FLUX {
             std::vector<std::string> *image_previews);
 
         virtual void moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2);
+        virtual void moveto_batch(const FLUX::MoveBatch* batch);
         virtual void sleep(float seconds);
         virtual void home(void);
+        virtual void set_toolhead_heater_temperature(float temperature, bool wait);
+        virtual void set_toolhead_fan_speed(float strength);
+        virtual void set_toolhead_pwm(float strength);
+        virtual void append_anchor(uint32_t value);
+        virtual void append_comment(const char* message, size_t length);
         virtual void terminated(void);
     };
 
     class FCodeV1MemoryWriter : public FLUX::FCodeV1 {
     protected:
         bool opened;
+        virtual long tell(void);
+        virtual void patch(long offset, uint32_t value);
     public:
+        // Written output, complete once terminated
+        std::vector<char> buffer;
+
         FCodeV1MemoryWriter(
             std::string *type, std::vector<std::pair<std::string, std::string> > *file_metadata,
             std::vector<std::string> *image_previews);
         ~FCodeV1MemoryWriter(void);
         std::string get_buffer(void);
+        // Move output into target, leaving this writer empty
+        void detach_buffer(std::vector<char>* target);
+        bool is_terminated(void) { return !opened; }
+        virtual void write(const char* buf, size_t size, unsigned long *crc32);
+        virtual void terminated(void);
+    };
+
+    // Write FCode to a sequential sink (pipe, socket, upload stream) without
+    // seeking. Script is kept as a list of chunks, moved to a temporary file
+    // once larger than spill_threshold bytes. The whole file is written to
+    // output by terminated().
+    class FCodeV1StreamWriter : public FLUX::FCodeV1 {
+    protected:
+        enum { STREAM_SCRIPT, STREAM_METADATA, STREAM_OUTPUT, STREAM_CLOSED } state;
+        std::ostream *output;
+        std::vector<std::string> script_chunks;
+        std::string metadata_buffer;
+        size_t script_size;
+        size_t spill_threshold;
+        FILE* spill_file;
+        bool spill_error;
+
+        void spill(const char* buf, size_t size);
+        void write_script_body(void);
+        using FCodeV1Base::write;
+    public:
+        FCodeV1StreamWriter(std::ostream *output_stream,
+            std::string *type, std::vector<std::pair<std::string, std::string> > *file_metadata,
+            std::vector<std::string> *image_previews, size_t spill_threshold_size = 64 << 20);
+        ~FCodeV1StreamWriter(void);
         virtual void write(const char* buf, size_t size, unsigned long *crc32);
         virtual void terminated(void);
     };
 
+    // Decode a FCode V1 file into a ToolpathProcessor. Script and metadata
+    // CRC are verified before any event is sent, errors are raised as
+    // std::runtime_error. Metadata entries are also sent to processor as
+    // "KEY=VALUE" comments after the script.
+    class FCodeV1Parser {
+    protected:
+        FLUX::ToolpathProcessor* handler;
+        const char* script;
+        size_t script_size;
+
+        // Verify and split a file, fill metadata, previews and index
+        virtual void load(const char* buf, size_t size);
+        // Metadata block and previews, fill metadata, previews and index
+        void load_trailer(const char* ptr, const char* end);
+        void parse_metadata(const char* buf, size_t size);
+        void parse_index(const std::string& value);
+        // Decode buf from the script start, or from resume->offset with E
+        // values sent relative to resume->e
+        virtual void parse_script(const char* buf, size_t size, const FCodeIndexEntry* resume);
+        // Handle a command other than move, return pointer after its
+        // parameters
+        const char* parse_command(unsigned char cmd, const char* ptr, const char* end, bool* absolute);
+        void send_metadata_comments(void);
+    public:
+        std::vector<std::pair<std::string, std::string> > metadata;
+        std::vector<std::string> previews;
+        // Anchors and layers from the INDEX metadata entry
+        std::vector<FCodeIndexEntry> index;
+
+        FCodeV1Parser(void);
+        virtual ~FCodeV1Parser(void) {}
+        void set_processor(FLUX::ToolpathProcessor* handler);
+        void parse_from_file(const char* filename);
+        void parse_buffer(const char* buf, size_t size);
+        // Verify a file and fill metadata, previews and index without
+        // decoding the script. Processor is not required.
+        void open_buffer(const char* buf, size_t size) { load(buf, size); }
+        // Decoded script of the last loaded file, inside its buffer for V1
+        const char* script_data(void) { return script; }
+        size_t script_length(void) { return script_size; }
+        // Restore the state recorded in index[entry] (temperature, fan, pwm,
+        // home and a travel to the recorded position without extruding) and
+        // decode the script from there. E restarts from 0 at the entry.
+        void resume_from_file(const char* filename, size_t entry);
+        void resume_buffer(const char* buf, size_t size, size_t entry);
+    };
+
+    // Join FCode V1 files into output, with the script converted from
+    // `separator` G-code between two jobs. Scripts are copied as they are and
+    // their CRC joined with crc32_combine; only extruder jobs after the first
+    // are rewritten to continue E from the previous job. Merged metadata
+    // (sum of TIME_COST, TRAVEL_DIST and FILAMENT_USED, max of MAX_*, INDEX
+    // of all jobs) is stored to `metadata`, previews are from the first job.
+    void fcode_v1_concat(const std::vector<std::string>& filenames, const std::string& separator,
+                         std::ostream* output, std::vector<std::pair<std::string, std::string> >* metadata);
+
     class FCodeV1FileWriter : public FLUX::FCodeV1 {
     public:
         FCodeV1FileWriter(const char* filename,
@@ -82,4 +251,89 @@ namespace FLUX {
         virtual void write(const char* buf, size_t size, unsigned long *crc32);
         virtual void terminated(void);
     };
+
+    // FCode V2 keeps V1 commands, metadata, index and previews but stores
+    // moves compactly: command byte, feedrate as float, then for each axis
+    // flag a zigzag varint of the delta of the quantized position
+    // (round(value / resolution), E use e_resolution). Decoded values are
+    // exact multiples of resolution, errors never accumulate.
+    //
+    // File layout:
+    //   "FCx0002\n" | u32 flags | f64 resolution | f64 e_resolution |
+    //   u32 script size | u32 stored size | stored script | u32 script crc32 |
+    //   metadata and previews as V1
+    // When flags has FCODE_V2_ZLIB, the stored script is a zlib stream.
+    // Script crc32 and index offsets always refer to the decoded script.
+    class FCodeV2 : public FLUX::FCodeV1 {
+    protected:
+        double resolution, e_resolution;
+        int compress_level;
+        // Quantized X, Y, Z, E0, E1, E2 of the last move
+        int64_t quantized[6];
+        // z_stream while compressing
+        void* deflater;
+        long stored_offset;
+        char* encode_move(char* ptr, int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2);
+        // Index entries let a reader restart from their position, so the
+        // quantized position must match it (it does not after home())
+        void sync_position(void);
+        void begin(void);
+        void deflate_script(int flush);
+        // Write the script block end, before write_trailer()
+        void finish_script(void);
+        virtual void write_script(const char* buf, size_t size);
+    public:
+        // compress_level 0 stores script as is, 1-9 are zlib levels
+        FCodeV2(std::string *type, std::vector<std::pair<std::string, std::string> > *file_metadata,
+            std::vector<std::string> *image_previews, double resolution, double e_resolution,
+            int compress_level);
+        virtual ~FCodeV2(void);
+        virtual void moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2);
+        virtual void moveto_batch(const FLUX::MoveBatch* batch);
+        virtual void append_anchor(uint32_t value);
+        virtual void append_comment(const char* message, size_t length);
+        virtual void terminated(void);
+    };
+
+    class FCodeV2MemoryWriter : public FLUX::FCodeV2 {
+    protected:
+        bool opened;
+        virtual long tell(void);
+        virtual void patch(long offset, uint32_t value);
+    public:
+        std::vector<char> buffer;
+
+        FCodeV2MemoryWriter(
+            std::string *type, std::vector<std::pair<std::string, std::string> > *file_metadata,
+            std::vector<std::string> *image_previews, double resolution, double e_resolution,
+            int compress_level);
+        ~FCodeV2MemoryWriter(void);
+        void detach_buffer(std::vector<char>* target);
+        bool is_terminated(void) { return !opened; }
+        virtual void write(const char* buf, size_t size, unsigned long *crc32);
+        virtual void terminated(void);
+    };
+
+    class FCodeV2FileWriter : public FLUX::FCodeV2 {
+    public:
+        FCodeV2FileWriter(const char* filename,
+            std::string *type, std::vector<std::pair<std::string, std::string> > *file_metadata,
+            std::vector<std::string> *image_previews, double resolution, double e_resolution,
+            int compress_level);
+        ~FCodeV2FileWriter(void);
+        virtual void write(const char* buf, size_t size, unsigned long *crc32);
+        virtual void terminated(void);
+    };
+
+    // Decode a FCode V2 file, same interface as FCodeV1Parser
+    class FCodeV2Parser : public FLUX::FCodeV1Parser {
+    protected:
+        double resolution, e_resolution;
+        // Decompressed script
+        std::vector<char> inflated;
+        virtual void load(const char* buf, size_t size);
+        virtual void parse_script(const char* buf, size_t size, const FCodeIndexEntry* resume);
+    public:
+        FCodeV2Parser(void);
+    };
 }
@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <stdexcept>
+#include "fcode.h"
+#include "gcode.h"
+#include "mapped_file.h"
+#include "crc32.h"
+
+
+namespace {
+    struct ConcatPart {
+        FLUX::FCodeV1Parser* source;
+        uint32_t script_crc32;
+        // Added to absolute E values of this part
+        float e_offset[3];
+    };
+}
+
+static inline uint32_t read_uint32(const char* ptr) {
+    uint32_t value;
+    memcpy(&value, ptr, 4);
+    return value;
+}
+
+static inline void write_uint32(std::ostream* output, uint32_t value) {
+    output->write((const char*)&value, 4);
+}
+
+static inline size_t count_flags(unsigned int flags) {
+    size_t count = 0;
+    for(;flags;flags&=flags-1) count++;
+    return count;
+}
+
+// Parameter bytes following a command byte, same rules as FCodeV1Parser
+static inline size_t parameters_size(unsigned char cmd) {
+    if(cmd & 128) return 4 * count_flags(cmd & 127);
+    if(cmd & 64) return 4 * count_flags(cmd & 63);
+    if((cmd & 48) || cmd == 4 || cmd == 7) return 4;
+    return 0;
+}
+
+// Offset of the E0 parameter of a move command, after F, X, Y, Z
+static inline size_t e_parameter_offset(unsigned char cmd) {
+    return 1 + 4 * count_flags(cmd & 120);
+}
+
+// Update e with the E values of script from `start` to the end, `absolute`
+// is the positioning mode at `start`
+static void scan_extruders(const char* script, size_t size, size_t start, bool absolute, float* e) {
+    const char* ptr = script + start;
+    const char* end = script + size;
+    while(ptr < end) {
+        unsigned char cmd = (unsigned char)*ptr;
+        size_t command_size = 1 + parameters_size(cmd);
+        if((size_t)(end - ptr) < command_size) {
+            throw std::runtime_error("CONTENTS TERMINATED UNEXPECTEDLY");
+        }
+        if(cmd & 128) {
+            const char* param = ptr + e_parameter_offset(cmd);
+            for(int i=0;i<3;i++) {
+                if(cmd & (4 >> i)) {
+                    float value;
+                    memcpy(&value, param, 4);
+                    e[i] = absolute ? value : e[i] + value;
+                    param += 4;
+                }
+            }
+        } else if(cmd == 2) {
+            absolute = true;
+        } else if(cmd == 3) {
+            absolute = false;
+        }
+        ptr += command_size;
+    }
+}
+
+// Write script with e_offset added to absolute E values, return its crc32
+static uint32_t write_rebased_script(const char* script, size_t size, const float* e_offset, std::ostream* output) {
+    char block[FCODE_STAGING_CAPACITY];
+    size_t used = 0;
+    uint32_t crc = 0;
+    const char* ptr = script;
+    const char* end = script + size;
+    bool absolute = true;
+
+    while(ptr < end) {
+        unsigned char cmd = (unsigned char)*ptr;
+        size_t command_size = 1 + parameters_size(cmd);
+        if((size_t)(end - ptr) < command_size) {
+            throw std::runtime_error("CONTENTS TERMINATED UNEXPECTEDLY");
+        }
+        if(used + command_size > sizeof(block)) {
+            crc = FLUX::crc32(crc, block, used);
+            output->write(block, used);
+            used = 0;
+        }
+        char* command = block + used;
+        memcpy(command, ptr, command_size);
+        if(cmd & 128) {
+            if(absolute) {
+                char* param = command + e_parameter_offset(cmd);
+                for(int i=0;i<3;i++) {
+                    if(cmd & (4 >> i)) {
+                        float value;
+                        memcpy(&value, param, 4);
+                        value += e_offset[i];
+                        memcpy(param, &value, 4);
+                        param += 4;
+                    }
+                }
+            }
+        } else if(cmd == 2) {
+            absolute = true;
+        } else if(cmd == 3) {
+            absolute = false;
+        }
+        used += command_size;
+        ptr += command_size;
+    }
+    crc = FLUX::crc32(crc, block, used);
+    output->write(block, used);
+    return crc;
+}
+
+static const std::string* find_metadata(FLUX::FCodeV1Parser* source, const char* key) {
+    for(auto it=source->metadata.begin();it!=source->metadata.end();++it) {
+        if(it->first == key) return &it->second;
+    }
+    return NULL;
+}
+
+static std::string format_value(double value) {
+    char buf[64];
+    int size = snprintf(buf, sizeof(buf), "%.2f", value);
+    return std::string(buf, size);
+}
+
+static void merge_metadata(const std::vector<ConcatPart>& parts,
+                           std::vector<std::pair<std::string, std::string> >* metadata) {
+    static const char* max_keys[4] = {"MAX_X", "MAX_Y", "MAX_Z", "MAX_R"};
+    double time_cost = 0, travel = 0;
+    double max_values[4] = {0, 0, 0, 0};
+    double filament[3] = {0, 0, 0};
+    std::vector<std::pair<std::string, std::string> > others;
+    std::vector<FLUX::FCodeIndexEntry> index;
+    uint32_t layer_base = 0;
+    size_t script_base = 0;
+
+    const std::string* head_type = find_metadata(parts[0].source, "HEAD_TYPE");
+    for(auto part=parts.begin();part!=parts.end();++part) {
+        FLUX::FCodeV1Parser* source = part->source;
+        for(auto it=source->metadata.begin();it!=source->metadata.end();++it) {
+            const std::string& key = it->first;
+            const char* value = it->second.c_str();
+            if(key == "TIME_COST") {
+                time_cost += strtod(value, NULL);
+            } else if(key == "TRAVEL_DIST") {
+                travel += strtod(value, NULL);
+            } else if(key == "FILAMENT_USED") {
+                char* next = (char*)value;
+                for(int i=0;i<3 && *next;i++) {
+                    filament[i] += strtod(next, &next);
+                    if(*next == ',') next++;
+                }
+            } else if(key == "HEAD_TYPE") {
+                if(!head_type || it->second != *head_type) {
+                    throw std::runtime_error("HEAD_TYPE NOT MATCH");
+                }
+            } else if(key == "VERSION" || key == "INDEX") {
+                continue;
+            } else {
+                bool is_max = false;
+                for(int i=0;i<4;i++) {
+                    if(key == max_keys[i]) {
+                        double v = strtod(value, NULL);
+                        if(v > max_values[i]) max_values[i] = v;
+                        is_max = true;
+                    }
+                }
+                if(is_max) continue;
+                bool exists = false;
+                for(auto o=others.begin();o!=others.end();++o) {
+                    if(o->first == key) { exists = true; break; }
+                }
+                if(!exists) others.push_back(*it);
+            }
+        }
+
+        uint32_t layers = 0;
+        for(auto it=source->index.begin();it!=source->index.end();++it) {
+            FLUX::FCodeIndexEntry entry = *it;
+            entry.offset += script_base;
+            for(int i=0;i<3;i++) entry.e[i] += part->e_offset[i];
+            if(entry.kind == FCODE_INDEX_LAYER) {
+                entry.value += layer_base;
+                layers++;
+            }
+            index.push_back(entry);
+        }
+        layer_base += layers;
+        script_base += source->script_length();
+    }
+
+    metadata->clear();
+    metadata->push_back(std::pair<std::string, std::string>("VERSION", "1"));
+    if(head_type) {
+        metadata->push_back(std::pair<std::string, std::string>("HEAD_TYPE", *head_type));
+    }
+    metadata->push_back(std::pair<std::string, std::string>("TIME_COST", format_value(time_cost)));
+    metadata->push_back(std::pair<std::string, std::string>("TRAVEL_DIST", format_value(travel)));
+    for(int i=0;i<4;i++) {
+        metadata->push_back(std::pair<std::string, std::string>(max_keys[i], format_value(max_values[i])));
+    }
+    std::string filament_used = format_value(filament[0]);
+    if(filament[1] || filament[2]) filament_used += "," + format_value(filament[1]);
+    if(filament[2]) filament_used += "," + format_value(filament[2]);
+    metadata->push_back(std::pair<std::string, std::string>("FILAMENT_USED", filament_used));
+    metadata->insert(metadata->end(), others.begin(), others.end());
+    if(index.size()) {
+        metadata->push_back(std::pair<std::string, std::string>("INDEX", FLUX::format_fcode_index(index)));
+    }
+}
+
+void FLUX::fcode_v1_concat(const std::vector<std::string>& filenames, const std::string& separator,
+                           std::ostream* output, std::vector<std::pair<std::string, std::string> >* metadata) {
+    if(filenames.empty()) {
+        throw std::runtime_error("NO INPUT");
+    }
+
+    std::vector<std::unique_ptr<FLUX::MappedFile> > files;
+    std::vector<std::unique_ptr<FLUX::FCodeV1Parser> > jobs;
+    for(auto it=filenames.begin();it!=filenames.end();++it) {
+        files.push_back(std::unique_ptr<FLUX::MappedFile>(new FLUX::MappedFile(it->c_str())));
+        jobs.push_back(std::unique_ptr<FLUX::FCodeV1Parser>(new FLUX::FCodeV1Parser()));
+        jobs.back()->open_buffer(files.back()->data(), files.back()->size());
+    }
+
+    const std::string* head_type_value = find_metadata(jobs[0].get(), "HEAD_TYPE");
+    std::string head_type = head_type_value ? *head_type_value : std::string("EXTRUDER");
+    bool has_extruder = head_type == "EXTRUDER";
+
+    // Separator is converted once and placed between every two jobs
+    std::vector<std::pair<std::string, std::string> > separator_metadata;
+    std::vector<std::string> separator_previews;
+    FLUX::FCodeV1MemoryWriter separator_writer(&head_type, &separator_metadata, &separator_previews);
+    FLUX::FCodeV1Parser separator_source;
+    if(separator.size()) {
+        FLUX::GCodeParser gcode_parser;
+        gcode_parser.set_processor(&separator_writer);
+        gcode_parser.parse_buffer(separator.data(), separator.size());
+        separator_writer.terminated();
+        separator_source.open_buffer(separator_writer.buffer.data(), separator_writer.buffer.size());
+    }
+
+    std::vector<ConcatPart> parts;
+    size_t script_size = 0;
+    float e_offset[3] = {0, 0, 0};
+    for(size_t i=0;i<jobs.size();i++) {
+        for(int s=0;s<2;s++) {
+            FLUX::FCodeV1Parser* source = s ? &separator_source : jobs[i].get();
+            if(s && (separator.empty() || i + 1 == jobs.size())) break;
+
+            ConcatPart part;
+            part.source = source;
+            part.script_crc32 = read_uint32(source->script_data() + source->script_length());
+            memcpy(part.e_offset, e_offset, sizeof(e_offset));
+            parts.push_back(part);
+            script_size += source->script_length();
+
+            if(has_extruder && (s || i + 1 < jobs.size())) {
+                // E at the end of this part, continue from the last index
+                // entry when there is one
+                float e[3] = {0, 0, 0};
+                size_t start = 0;
+                bool absolute = true;
+                if(source->index.size()) {
+                    const FLUX::FCodeIndexEntry& entry = source->index.back();
+                    memcpy(e, entry.e, sizeof(e));
+                    start = entry.offset;
+                    absolute = entry.absolute;
+                }
+                scan_extruders(source->script_data(), source->script_length(), start, absolute, e);
+                for(int k=0;k<3;k++) e_offset[k] += e[k];
+            }
+        }
+    }
+    if(script_size > 0xffffffffUL) {
+        throw std::runtime_error("SCRIPT TOO LARGE");
+    }
+
+    merge_metadata(parts, metadata);
+
+    output->write("FCx0001\n", 8);
+    write_uint32(output, (uint32_t)script_size);
+    uint32_t script_crc32 = 0;
+    for(auto part=parts.begin();part!=parts.end();++part) {
+        const char* script = part->source->script_data();
+        size_t size = part->source->script_length();
+        uint32_t crc;
+        if(part->e_offset[0] || part->e_offset[1] || part->e_offset[2]) {
+            crc = write_rebased_script(script, size, part->e_offset, output);
+        } else {
+            output->write(script, size);
+            crc = part->script_crc32;
+        }
+        script_crc32 = FLUX::crc32_combine(script_crc32, crc, size);
+    }
+    write_uint32(output, script_crc32);
+
+    std::string metadata_buffer;
+    for(auto it=metadata->begin();it!=metadata->end();++it) {
+        metadata_buffer += it->first;
+        metadata_buffer += "=";
+        metadata_buffer += it->second;
+        metadata_buffer.push_back(0);
+    }
+    write_uint32(output, metadata_buffer.size());
+    output->write(metadata_buffer.data(), metadata_buffer.size());
+    write_uint32(output, FLUX::crc32(0, metadata_buffer.data(), metadata_buffer.size()));
+
+    const std::vector<std::string>& previews = jobs[0]->previews;
+    for(auto p=previews.begin();p!=previews.end();++p) {
+        write_uint32(output, p->size());
+        output->write(p->data(), p->size());
+    }
+    write_uint32(output, 0);
+    output->flush();
+    if(output->fail()) {
+        throw std::runtime_error("WRITE STREAM ERROR");
+    }
+}
@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <stdexcept>
+#include "fcode.h"
+#include "mapped_file.h"
+#include "crc32.h"
+
+
+static inline uint32_t read_uint32(const char* ptr) {
+    uint32_t value;
+    memcpy(&value, ptr, 4);
+    return value;
+}
+
+static inline float read_float(const char* ptr) {
+    float value;
+    memcpy(&value, ptr, 4);
+    return value;
+}
+
+
+FLUX::FCodeV1Parser::FCodeV1Parser(void) {
+    handler = NULL;
+    script = NULL;
+    script_size = 0;
+}
+
+void FLUX::FCodeV1Parser::set_processor(FLUX::ToolpathProcessor* _handler) {
+    handler = _handler;
+}
+
+void FLUX::FCodeV1Parser::parse_from_file(const char* filename) {
+    FLUX::MappedFile infile(filename);
+    parse_buffer(infile.data(), infile.size());
+}
+
+void FLUX::FCodeV1Parser::resume_from_file(const char* filename, size_t entry) {
+    FLUX::MappedFile infile(filename);
+    resume_buffer(infile.data(), infile.size(), entry);
+}
+
+void FLUX::FCodeV1Parser::parse_buffer(const char* buf, size_t size) {
+    if(!handler) {
+        throw std::runtime_error("PROCESSOR NOT SET");
+    }
+    load(buf, size);
+    parse_script(script, script_size, NULL);
+    send_metadata_comments();
+}
+
+void FLUX::FCodeV1Parser::resume_buffer(const char* buf, size_t size, size_t entry) {
+    if(!handler) {
+        throw std::runtime_error("PROCESSOR NOT SET");
+    }
+    load(buf, size);
+    if(entry >= index.size()) {
+        throw std::runtime_error("INDEX OUT OF RANGE");
+    }
+    const FCodeIndexEntry& item = index[entry];
+    if(item.offset > script_size) {
+        throw std::runtime_error("BAD INDEX");
+    }
+
+    if(item.temperature > 0) {
+        handler->set_toolhead_heater_temperature(item.temperature, true);
+    }
+    if(item.fan_speed > 0) {
+        handler->set_toolhead_fan_speed(item.fan_speed);
+    }
+    if(item.pwm > 0) {
+        handler->set_toolhead_pwm(item.pwm);
+    }
+    // Head position is unknown before resuming, travel from home without
+    // extruding. Replayed E is relative to the entry, see parse_script.
+    handler->home();
+    int flags = FLAG_HAS_X | FLAG_HAS_Y | FLAG_HAS_Z;
+    if(item.feedrate > 0) {
+        flags |= FLAG_HAS_FEEDRATE;
+    }
+    handler->moveto(flags, item.feedrate, item.x, item.y, item.z, 0, 0, 0);
+
+    parse_script(script + item.offset, script_size - item.offset, &item);
+    send_metadata_comments();
+}
+
+void FLUX::FCodeV1Parser::send_metadata_comments(void) {
+    for(auto it=metadata.begin();it!=metadata.end();++it) {
+        // Index is only meaningful for this encoding
+        if(it->first == "INDEX") continue;
+        std::string comment = it->first + "=" + it->second;
+        handler->append_comment(comment.data(), comment.size());
+    }
+}
+
+void FLUX::FCodeV1Parser::load(const char* buf, size_t size) {
+    metadata.clear();
+    previews.clear();
+    index.clear();
+
+    if(size < 12 || memcmp(buf, "FCx0001\n", 8)) {
+        throw std::runtime_error("BAD FILE HEADER");
+    }
+
+    const char* ptr = buf + 8;
+    const char* end = buf + size;
+
+    // Script block
+    script_size = read_uint32(ptr);
+    ptr += 4;
+    if((size_t)(end - ptr) < script_size + 4) {
+        throw std::runtime_error("CONTENTS TERMINATED UNEXPECTEDLY");
+    }
+    script = ptr;
+    ptr += script_size;
+    if(FLUX::crc32(0, script, script_size) != read_uint32(ptr)) {
+        throw std::runtime_error("SCRIPT CRC32 NOT MATCH");
+    }
+    ptr += 4;
+
+    load_trailer(ptr, end);
+}
+
+void FLUX::FCodeV1Parser::load_trailer(const char* ptr, const char* end) {
+    // Metadata block
+    if(end - ptr < 4) {
+        throw std::runtime_error("CONTENTS TERMINATED UNEXPECTEDLY");
+    }
+    uint32_t metadata_size = read_uint32(ptr);
+    ptr += 4;
+    if((size_t)(end - ptr) < (size_t)metadata_size + 4) {
+        throw std::runtime_error("CONTENTS TERMINATED UNEXPECTEDLY");
+    }
+    const char* metadata_buf = ptr;
+    ptr += metadata_size;
+    if(FLUX::crc32(0, metadata_buf, metadata_size) != read_uint32(ptr)) {
+        throw std::runtime_error("METADATA CRC32 NOT MATCH");
+    }
+    ptr += 4;
+
+    // Previews, terminated by a zero length
+    while(true) {
+        if(end - ptr < 4) {
+            throw std::runtime_error("CONTENTS TERMINATED UNEXPECTEDLY");
+        }
+        uint32_t preview_size = read_uint32(ptr);
+        ptr += 4;
+        if(preview_size == 0) { break; }
+        if((size_t)(end - ptr) < preview_size) {
+            throw std::runtime_error("CONTENTS TERMINATED UNEXPECTEDLY");
+        }
+        previews.push_back(std::string(ptr, preview_size));
+        ptr += preview_size;
+    }
+
+    parse_metadata(metadata_buf, metadata_size);
+    for(auto it=metadata.begin();it!=metadata.end();++it) {
+        if(it->first == "INDEX") parse_index(it->second);
+    }
+}
+
+void FLUX::FCodeV1Parser::parse_index(const std::string& value) {
+    const char* ptr = value.c_str();
+    while(*ptr) {
+        FCodeIndexEntry entry;
+        int used = 0;
+        if(sscanf(ptr, "%c%u,%u,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f%n", &entry.kind, &entry.value, &entry.offset,
+                  &entry.feedrate, &entry.x, &entry.y, &entry.z, &entry.e[0], &entry.e[1], &entry.e[2],
+                  &entry.temperature, &entry.fan_speed, &entry.pwm, &used) != 13) {
+            throw std::runtime_error("BAD INDEX");
+        }
+        ptr += used;
+        // Positioning mode is missing from older files, which are absolute
+        int absolute = 1;
+        if(*ptr == ',') {
+            used = 0;
+            if(sscanf(ptr, ",%i%n", &absolute, &used) != 1) {
+                throw std::runtime_error("BAD INDEX");
+            }
+            ptr += used;
+        }
+        entry.absolute = absolute != 0;
+        index.push_back(entry);
+        if(*ptr == ';') ptr++;
+    }
+}
+
+void FLUX::FCodeV1Parser::parse_metadata(const char* buf, size_t size) {
+    const char* end = buf + size;
+    while(buf < end) {
+        const char* item_end = (const char*)memchr(buf, 0, end - buf);
+        if(!item_end) { item_end = end; }
+        if(item_end > buf) {
+            const char* sep = (const char*)memchr(buf, '=', item_end - buf);
+            if(sep) {
+                metadata.push_back(std::pair<std::string, std::string>(
+                    std::string(buf, sep - buf), std::string(sep + 1, item_end - sep - 1)));
+            } else {
+                metadata.push_back(std::pair<std::string, std::string>(
+                    std::string(buf, item_end - buf), std::string()));
+            }
+        }
+        buf = item_end + 1;
+    }
+}
+
+void FLUX::FCodeV1Parser::parse_script(const char* buf, size_t size, const FCodeIndexEntry* resume) {
+    const char* ptr = buf;
+    const char* end = buf + size;
+    // F, X, Y, Z, E0, E1, E2, E is relative to e_base
+    float current[7] = {0, 0, 0, 0, 0, 0, 0};
+    float e_base[3] = {0, 0, 0};
+    bool absolute = true;
+    if(resume) {
+        current[0] = resume->feedrate;
+        current[1] = resume->x; current[2] = resume->y; current[3] = resume->z;
+        memcpy(e_base, resume->e, sizeof(e_base));
+        absolute = resume->absolute;
+    }
+    FLUX::MoveBatch batch;
+
+    while(ptr < end) {
+        unsigned char cmd = (unsigned char)*(ptr++);
+
+        if(cmd & 128) {
+            int flags = cmd & 127;
+            for(int i=0;i<7;i++) {
+                if(flags & (64 >> i)) {
+                    if(end - ptr < 4) {
+                        throw std::runtime_error("CONTENTS TERMINATED UNEXPECTEDLY");
+                    }
+                    float value = read_float(ptr);
+                    ptr += 4;
+                    // Legacy g2f writes relative values after command 3 (G91)
+                    if(absolute && i >= 4) {
+                        current[i] = value - e_base[i - 4];
+                    } else {
+                        current[i] = (absolute || i == 0) ? value : current[i] + value;
+                    }
+                }
+            }
+            if(batch.append(flags, current[0], current[1], current[2], current[3],
+                            current[4], current[5], current[6])) {
+                handler->moveto_batch(&batch);
+                batch.size = 0;
+            }
+            continue;
+        }
+
+        if(batch.size) {
+            handler->moveto_batch(&batch);
+            batch.size = 0;
+        }
+
+        ptr = parse_command(cmd, ptr, end, &absolute);
+    }
+
+    if(batch.size) {
+        handler->moveto_batch(&batch);
+    }
+}
+
+const char* FLUX::FCodeV1Parser::parse_command(unsigned char cmd, const char* ptr, const char* end, bool* absolute) {
+    if(cmd & 64) {
+        // Unused command, skip its parameters
+        size_t size = 0;
+        for(int flag=32;flag;flag>>=1) {
+            if(cmd & flag) { size += 4; }
+        }
+        if((size_t)(end - ptr) < size) {
+            throw std::runtime_error("CONTENTS TERMINATED UNEXPECTEDLY");
+        }
+        return ptr + size;
+    }
+
+    float value = 0;
+    if((cmd & 48) || cmd == 4 || cmd == 7) {
+        if(end - ptr < 4) {
+            throw std::runtime_error("CONTENTS TERMINATED UNEXPECTEDLY");
+        }
+        value = read_float(ptr);
+        ptr += 4;
+    }
+
+    if((cmd & 48) == 48) {
+        handler->set_toolhead_fan_speed(value);
+    } else if(cmd & 32) {
+        handler->set_toolhead_pwm(value);
+    } else if(cmd & 16) {
+        handler->set_toolhead_heater_temperature(value, (cmd & 8) != 0);
+    } else if(cmd == 5) {
+        handler->pause(true);
+    } else if(cmd == 6) {
+        handler->pause(false);
+    } else if(cmd == 4 || cmd == 7) {
+        handler->sleep(value / 1000.0);
+    } else if(cmd == 1) {
+        handler->home();
+    } else if(cmd == 2) {
+        *absolute = true;
+    } else if(cmd == 3) {
+        *absolute = false;
+    } else {
+        char message[64];
+        int message_size = snprintf(message, sizeof(message), "Can not handle command id: %i", cmd);
+        handler->on_error(true, message, message_size);
+    }
+    return ptr;
+}
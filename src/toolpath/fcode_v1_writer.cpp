@@ -1,47 +1,87 @@
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 #include <stdexcept>
-#include <sstream>
-#include "crc32.c"
+#include "crc32.h"
 #include "fcode.h"
 
+FLUX::FCodeV1Base::FCodeV1Base(void) {
+    stream = NULL;
+    script_crc32 = 0;
+    staging = new char[FCODE_STAGING_CAPACITY];
+    staging_size = 0;
+    script_written = 0;
+}
+
+FLUX::FCodeV1Base::~FCodeV1Base(void) {
+    delete[] staging;
+}
+
+void FLUX::FCodeV1Base::flush_script(void) {
+    if(staging_size) {
+        script_crc32 = FLUX::crc32(script_crc32, staging, staging_size);
+        write_script(staging, staging_size);
+        script_written += staging_size;
+        staging_size = 0;
+    }
+}
+
 void FLUX::FCodeV1Base::write(const char* buf, size_t size, unsigned long *crc32_ptr) {
     stream->write(buf, size);
     if(crc32_ptr) {
-        *crc32_ptr = crc32(*crc32_ptr, (const void *)buf, size);
-        // *crc32_ptr = crc32(*crc32_ptr, (const Bytef*)buf, size);
+        *crc32_ptr = FLUX::crc32(*crc32_ptr, (const void *)buf, size);
     }
 }
 
-void FLUX::FCodeV1Base::write(float value, unsigned long *crc32) {
-    write((const char *)&value, 4, crc32);
-}
-
 void FLUX::FCodeV1Base::write(uint32_t value, unsigned long *crc32) {
     write((const char *)&value, sizeof(uint32_t), crc32);
 }
 
-
-void FLUX::FCodeV1Base::write_command(unsigned char cmd, unsigned long *crc32) {
-    write((const char *)&cmd, 1, crc32);
+void FLUX::FCodeV1Base::write_script(const char* buf, size_t size) {
+    write(buf, size, NULL);
 }
 
 
 void FLUX::FCodeV1Base::moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
-    write_command(flags | 128, &script_crc32);
+    // Feedrate is only written when valid, the flag must agree with payload
+    if(!(feedrate > 0)) flags &= ~FLAG_HAS_FEEDRATE;
+
+    // Up to 1 command byte + 7 floats
+    char* ptr = reserve(29);
+    char* begin = ptr;
+    *(ptr++) = (char)(flags | 128);
+    if(flags & FLAG_HAS_FEEDRATE) { memcpy(ptr, &feedrate, 4); ptr += 4; }
+    if(flags & FLAG_HAS_X) { memcpy(ptr, &x, 4); ptr += 4; }
+    if(flags & FLAG_HAS_Y) { memcpy(ptr, &y, 4); ptr += 4; }
+    if(flags & FLAG_HAS_Z) { memcpy(ptr, &z, 4); ptr += 4; }
+    if(flags & FLAG_HAS_E(0)) { memcpy(ptr, &e0, 4); ptr += 4; }
+    if(flags & FLAG_HAS_E(1)) { memcpy(ptr, &e1, 4); ptr += 4; }
+    if(flags & FLAG_HAS_E(2)) { memcpy(ptr, &e2, 4); ptr += 4; }
+    staging_size += ptr - begin;
+}
 
-    if(flags & FLAG_HAS_FEEDRATE && feedrate > 0) write(feedrate, &script_crc32);
-    if(flags & FLAG_HAS_X) write(x, &script_crc32);
-    if(flags & FLAG_HAS_Y) write(y, &script_crc32);
-    if(flags & FLAG_HAS_Z) write(z, &script_crc32);
-    if(flags & FLAG_HAS_E(0)) write(e0, &script_crc32);
-    if(flags & FLAG_HAS_E(1)) write(e1, &script_crc32);
-    if(flags & FLAG_HAS_E(2)) write(e2, &script_crc32);
+void FLUX::FCodeV1Base::moveto_batch(const FLUX::MoveBatch* batch) {
+    char* ptr = reserve(MOVE_BATCH_CAPACITY * 29);
+    char* begin = ptr;
+
+    for(size_t i=0;i<batch->size;i++) {
+        int flags = batch->flags[i];
+        if(!(batch->feedrate[i] > 0)) flags &= ~FLAG_HAS_FEEDRATE;
+        *(ptr++) = (char)(flags | 128);
+        if(flags & FLAG_HAS_FEEDRATE) { memcpy(ptr, &batch->feedrate[i], 4); ptr += 4; }
+        if(flags & FLAG_HAS_X) { memcpy(ptr, &batch->x[i], 4); ptr += 4; }
+        if(flags & FLAG_HAS_Y) { memcpy(ptr, &batch->y[i], 4); ptr += 4; }
+        if(flags & FLAG_HAS_Z) { memcpy(ptr, &batch->z[i], 4); ptr += 4; }
+        if(flags & FLAG_HAS_E(0)) { memcpy(ptr, &batch->e0[i], 4); ptr += 4; }
+        if(flags & FLAG_HAS_E(1)) { memcpy(ptr, &batch->e1[i], 4); ptr += 4; }
+        if(flags & FLAG_HAS_E(2)) { memcpy(ptr, &batch->e2[i], 4); ptr += 4; }
+    }
+    staging_size += ptr - begin;
 }
 
 void FLUX::FCodeV1Base::sleep(float seconds) {
-    write_command(4, &script_crc32);
-    write(seconds * 1000, &script_crc32);
+    stage_command(4);
+    stage(seconds * 1000);
 }
 
 void FLUX::FCodeV1Base::enable_motor(void) { errors.push_back(std::string("NOT_SUPPORT ENABLE_MOTOR")); }
@@ -49,23 +89,23 @@ void FLUX::FCodeV1Base::enable_motor(void) { errors.push_back(std::string("NOT_S
 void FLUX::FCodeV1Base::disable_motor(void) { errors.push_back(std::string("NOT_SUPPORT DISABLE_MOTOR")); }
 
 void FLUX::FCodeV1Base::pause(bool to_standby_position) {
-    write_command((to_standby_position ? 5 : 6), &script_crc32);
+    stage_command(to_standby_position ? 5 : 6);
 }
 
 void FLUX::FCodeV1Base::home(void) {
-    write_command(1, &script_crc32);
+    stage_command(1);
 }
 void FLUX::FCodeV1Base::set_toolhead_heater_temperature(float temperature, bool wait) {
-    write_command(wait ? 24 : 16, &script_crc32);
-    write(temperature, &script_crc32);
+    stage_command(wait ? 24 : 16);
+    stage(temperature);
 }
 void FLUX::FCodeV1Base::set_toolhead_fan_speed(float strength) {
-    write_command(48, &script_crc32);
-    write(strength, &script_crc32);
+    stage_command(48);
+    stage(strength);
 }
 void FLUX::FCodeV1Base::set_toolhead_pwm(float strength) {
-    write_command(32, &script_crc32);
-    write(strength, &script_crc32);
+    stage_command(32);
+    stage(strength);
 }
 
 void FLUX::FCodeV1Base::append_anchor(uint32_t value) {}
@@ -85,23 +125,36 @@ FLUX::FCodeV1::FCodeV1(std::string *type, std::vector<std::pair<std::string, std
     current_x = 0; current_y = 0; current_z = 0;
     travled = time_cost = 0;
     max_x = max_y = max_z = max_r = filament[0] = filament[1] = filament[2] = 0;
+    current_temperature = current_fan_speed = current_pwm = 0;
+    layer_count = 0;
+    version = "1";
 
     head_type = type;
     metadata = file_metadata;
     previews = image_previews;
-    script_crc32 = 0;
 }
 
 void FLUX::FCodeV1::begin(void) {
     write("FCx0001\n", 8, NULL);
-    script_offset = stream->tellp();
+    script_offset = tell();
     if(script_offset < 0) {
         throw std::runtime_error("NOT_SUPPORT STREAM");
     }
     write("\x00\x00\x00\x00", 4, NULL);
 }
 
-void FLUX::FCodeV1::moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
+long FLUX::FCodeV1::tell(void) {
+    return stream->tellp();
+}
+
+void FLUX::FCodeV1::patch(long offset, uint32_t value) {
+    long current = stream->tellp();
+    stream->seekp(offset, stream->beg);
+    write(value, NULL);
+    stream->seekp(current, stream->beg);
+}
+
+void FLUX::FCodeV1::update_statistics(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
     if(flags & FLAG_HAS_FEEDRATE && feedrate > 0) {
         current_feedrate = feedrate;
     }
@@ -152,8 +205,21 @@ void FLUX::FCodeV1::moveto(int flags, float feedrate, float x, float y, float z,
         float tc = (fmax(fmax(fm[0], fm[1]), fm[2]) / feedrate) * 60.0;
         if(!isnan(tc)) time_cost += tc;
     }
+}
+
+void FLUX::FCodeV1::moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
+    update_statistics(flags, feedrate, x, y, z, e0, e1, e2);
     FCodeV1Base::moveto(flags, feedrate, x, y, z, e0, e1, e2);
 }
+
+void FLUX::FCodeV1::moveto_batch(const FLUX::MoveBatch* batch) {
+    for(size_t i=0;i<batch->size;i++) {
+        update_statistics(batch->flags[i], batch->feedrate[i], batch->x[i], batch->y[i], batch->z[i],
+                          batch->e0[i], batch->e1[i], batch->e2[i]);
+    }
+    FCodeV1Base::moveto_batch(batch);
+}
+
 void FLUX::FCodeV1::sleep(float seconds) {
     if(!isnan(seconds)) time_cost += seconds;
     FCodeV1Base::sleep(seconds);
@@ -163,11 +229,77 @@ void FLUX::FCodeV1::home(void) {
     FCodeV1Base::home();
 }
 
+void FLUX::FCodeV1::set_toolhead_heater_temperature(float temperature, bool wait) {
+    current_temperature = temperature;
+    FCodeV1Base::set_toolhead_heater_temperature(temperature, wait);
+}
+
+void FLUX::FCodeV1::set_toolhead_fan_speed(float strength) {
+    current_fan_speed = strength;
+    FCodeV1Base::set_toolhead_fan_speed(strength);
+}
+
+void FLUX::FCodeV1::set_toolhead_pwm(float strength) {
+    current_pwm = strength;
+    FCodeV1Base::set_toolhead_pwm(strength);
+}
+
+void FLUX::FCodeV1::append_index(char kind, uint32_t value) {
+    FCodeIndexEntry entry;
+    entry.kind = kind;
+    entry.value = value;
+    entry.offset = script_position();
+    entry.feedrate = current_feedrate;
+    entry.x = current_x; entry.y = current_y; entry.z = current_z;
+    entry.e[0] = filament[0]; entry.e[1] = filament[1]; entry.e[2] = filament[2];
+    entry.temperature = current_temperature;
+    entry.fan_speed = current_fan_speed;
+    entry.pwm = current_pwm;
+    // Writer never emits relative moves
+    entry.absolute = true;
+    index.push_back(entry);
+}
+
+void FLUX::FCodeV1::append_anchor(uint32_t value) {
+    append_index(FCODE_INDEX_ANCHOR, value);
+}
+
+bool FLUX::is_layer_comment(const char* message, size_t length) {
+    return (length >= 6 && memcmp(message, "LAYER:", 6) == 0) ||
+           (length >= 12 && memcmp(message, "LAYER_CHANGE", 12) == 0);
+}
+
+void FLUX::FCodeV1::append_comment(const char* message, size_t length) {
+    if(FLUX::is_layer_comment(message, length)) {
+        append_index(FCODE_INDEX_LAYER, layer_count++);
+    }
+}
+
+// INDEX metadata value, entries are separated by ';':
+// <kind><value>,<offset>,<feedrate>,<x>,<y>,<z>,<e0>,<e1>,<e2>,<temperature>,<fan>,<pwm>,<absolute>
+// Entries without <absolute> are read as absolute.
+std::string FLUX::format_fcode_index(const std::vector<FLUX::FCodeIndexEntry>& index) {
+    std::string output;
+    char buf[256];
+    for(auto it=index.begin();it!=index.end();++it) {
+        int size = snprintf(buf, sizeof(buf), "%s%c%u,%u,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%i",
+                            it == index.begin() ? "" : ";", it->kind, it->value, it->offset,
+                            it->feedrate, it->x, it->y, it->z, it->e[0], it->e[1], it->e[2],
+                            it->temperature, it->fan_speed, it->pwm, it->absolute ? 1 : 0);
+        output.append(buf, size);
+    }
+    return output;
+}
+
 unsigned long FLUX::FCodeV1::write_metadata(void) {
     char metabuf[128];
     int metasize;
     unsigned long metadata_crc32 = 0;
 
+    if(index.size()) {
+        metadata->push_back(std::pair<std::string, std::string>("INDEX", format_fcode_index(index)));
+    }
+
     if(filament[2]) {
         metasize = snprintf(metabuf, 128, "%.2f,%.2f,%.2f", filament[0], filament[1], filament[2]);
     } else if(filament[1]) {
@@ -205,7 +337,7 @@ unsigned long FLUX::FCodeV1::write_metadata(void) {
     metadata->insert(metadata->begin(),
         std::pair<std::string, std::string>("HEAD_TYPE", *head_type));
     metadata->insert(metadata->begin(),
-        std::pair<std::string, std::string>("VERSION", "1"));
+        std::pair<std::string, std::string>("VERSION", version));
 
     for(auto it=metadata->begin();it!=metadata->end();++it) {
     // for(auto it : *metadata) {
@@ -218,26 +350,23 @@ unsigned long FLUX::FCodeV1::write_metadata(void) {
 }
 
 void FLUX::FCodeV1::terminated(void) {
-    uint32_t u32value;
+    flush_script();
 
-    int script_end_offset = stream->tellp();
-    stream->seekp(script_offset, stream->beg);
-    u32value = script_end_offset - script_offset - 4;
-    write(u32value, NULL);
-    stream->seekp(script_end_offset, stream->beg);
+    long script_end_offset = tell();
+    patch(script_offset, script_end_offset - script_offset - 4);
     write((uint32_t)script_crc32, NULL);
+    write_trailer();
+}
 
-    int metadata_offset = stream->tellp();
-    int metadata_end_offset;
+void FLUX::FCodeV1::write_trailer(void) {
+    long metadata_offset = tell();
     write("\x00\x00\x00\x00", 4, NULL);
     unsigned long metadata_crc32 = write_metadata();
-    metadata_end_offset = stream->tellp();
-    stream->seekp(metadata_offset, stream->beg);
-    u32value = metadata_end_offset - metadata_offset - 4;
-    write(u32value, NULL);
-    stream->seekp(metadata_end_offset, stream->beg);
+    long metadata_end_offset = tell();
+    patch(metadata_offset, metadata_end_offset - metadata_offset - 4);
     write((uint32_t)metadata_crc32, NULL);
 
+    uint32_t u32value;
     for(auto p=previews->begin();p<previews->end();++p) {
         u32value = p->size();
         write(u32value, NULL);
@@ -250,7 +379,6 @@ void FLUX::FCodeV1::terminated(void) {
 FLUX::FCodeV1MemoryWriter::FCodeV1MemoryWriter(
         std::string *type, std::vector<std::pair<std::string, std::string> > *file_metadata,
         std::vector<std::string> *image_previews) : FCodeV1(type, file_metadata, image_previews) {
-    stream = new std::stringstream();
     opened = true;
     begin();
 }
@@ -259,19 +387,34 @@ FLUX::FCodeV1MemoryWriter::~FCodeV1MemoryWriter(void) {
     if(opened) {
         terminated();
     }
-    delete stream;
 }
 
 std::string FLUX::FCodeV1MemoryWriter::get_buffer(void) {
-    return ((std::stringstream*)stream)->str();
+    return std::string(buffer.data(), buffer.size());
+}
+
+void FLUX::FCodeV1MemoryWriter::detach_buffer(std::vector<char>* target) {
+    target->swap(buffer);
+    std::vector<char>().swap(buffer);
 }
 
-void FLUX::FCodeV1MemoryWriter::write(const char* buf, size_t size, unsigned long *crc32) {
+void FLUX::FCodeV1MemoryWriter::write(const char* buf, size_t size, unsigned long *crc32_ptr) {
     if(opened) {
-        FLUX::FCodeV1Base::write(buf, size, crc32);
+        buffer.insert(buffer.end(), buf, buf + size);
+        if(crc32_ptr) {
+            *crc32_ptr = FLUX::crc32(*crc32_ptr, (const void *)buf, size);
+        }
     }
 }
 
+long FLUX::FCodeV1MemoryWriter::tell(void) {
+    return buffer.size();
+}
+
+void FLUX::FCodeV1MemoryWriter::patch(long offset, uint32_t value) {
+    memcpy(buffer.data() + offset, &value, 4);
+}
+
 void FLUX::FCodeV1MemoryWriter::terminated(void) {
     if(opened) {
         FLUX::FCodeV1::terminated();
@@ -292,6 +435,7 @@ FLUX::FCodeV1FileWriter::FCodeV1FileWriter(const char* filename,
 
 
 FLUX::FCodeV1FileWriter::~FCodeV1FileWriter(void) {
+    flush_script();
     delete stream;
 }
 
@@ -305,3 +449,121 @@ void FLUX::FCodeV1FileWriter::terminated(void) {
     FLUX::FCodeV1::terminated();
     if(((std::ofstream*)stream)->is_open()) { ((std::ofstream*)stream)->close(); }
 }
+
+
+FLUX::FCodeV1StreamWriter::FCodeV1StreamWriter(std::ostream *output_stream,
+        std::string *type, std::vector<std::pair<std::string, std::string> > *file_metadata,
+        std::vector<std::string> *image_previews, size_t spill_threshold_size) : FCodeV1(type, file_metadata, image_previews) {
+    state = STREAM_SCRIPT;
+    output = output_stream;
+    script_size = 0;
+    spill_threshold = spill_threshold_size;
+    spill_file = NULL;
+    spill_error = false;
+}
+
+FLUX::FCodeV1StreamWriter::~FCodeV1StreamWriter(void) {
+    if(spill_file) {
+        fclose(spill_file);
+    }
+}
+
+void FLUX::FCodeV1StreamWriter::spill(const char* buf, size_t size) {
+    // Reported by terminated(), script commands do not raise
+    if(fwrite(buf, 1, size, spill_file) != size) {
+        spill_error = true;
+    }
+}
+
+void FLUX::FCodeV1StreamWriter::write(const char* buf, size_t size, unsigned long *crc32_ptr) {
+    if(crc32_ptr) {
+        *crc32_ptr = FLUX::crc32(*crc32_ptr, (const void *)buf, size);
+    }
+
+    switch(state) {
+        case STREAM_SCRIPT:
+            script_size += size;
+            if(spill_file) {
+                spill(buf, size);
+            } else if(script_size > spill_threshold && (spill_file = tmpfile())) {
+                for(auto it=script_chunks.begin();it!=script_chunks.end();++it) {
+                    spill(it->data(), it->size());
+                }
+                std::vector<std::string>().swap(script_chunks);
+                spill(buf, size);
+            } else {
+                script_chunks.push_back(std::string(buf, size));
+            }
+            break;
+        case STREAM_METADATA:
+            metadata_buffer.append(buf, size);
+            break;
+        case STREAM_OUTPUT:
+            output->write(buf, size);
+            break;
+        case STREAM_CLOSED:
+            break;
+    }
+}
+
+void FLUX::FCodeV1StreamWriter::write_script_body(void) {
+    if(spill_file) {
+        char buf[FCODE_STAGING_CAPACITY];
+        size_t size;
+        fflush(spill_file);
+        rewind(spill_file);
+        while((size = fread(buf, 1, sizeof(buf), spill_file)) > 0) {
+            write(buf, size, NULL);
+        }
+        if(ferror(spill_file)) {
+            throw std::runtime_error("READ TEMP FILE ERROR");
+        }
+    } else {
+        for(auto it=script_chunks.begin();it!=script_chunks.end();++it) {
+            write(it->data(), it->size(), NULL);
+        }
+    }
+}
+
+void FLUX::FCodeV1StreamWriter::terminated(void) {
+    if(state != STREAM_SCRIPT) {
+        return;
+    }
+    flush_script();
+    if(spill_error) {
+        throw std::runtime_error("WRITE TEMP FILE ERROR");
+    }
+
+    state = STREAM_METADATA;
+    unsigned long metadata_crc32 = write_metadata();
+
+    state = STREAM_OUTPUT;
+    write("FCx0001\n", 8, NULL);
+    write((uint32_t)script_size, NULL);
+    write_script_body();
+    write((uint32_t)script_crc32, NULL);
+
+    write((uint32_t)metadata_buffer.size(), NULL);
+    write(metadata_buffer.data(), metadata_buffer.size(), NULL);
+    write((uint32_t)metadata_crc32, NULL);
+
+    uint32_t u32value;
+    for(auto p=previews->begin();p<previews->end();++p) {
+        u32value = p->size();
+        write(u32value, NULL);
+        write(p->data(), u32value, NULL);
+    }
+    write("\x00\x00\x00\x00", 4, NULL);
+    output->flush();
+
+    state = STREAM_CLOSED;
+    std::vector<std::string>().swap(script_chunks);
+    std::string().swap(metadata_buffer);
+    if(spill_file) {
+        fclose(spill_file);
+        spill_file = NULL;
+    }
+    if(output->fail()) {
+        throw std::runtime_error("WRITE STREAM ERROR");
+    }
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <stdexcept>
+#ifdef FLUX_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include "fcode.h"
+#include "crc32.h"
+
+
+static inline uint32_t read_uint32(const char* ptr) {
+    uint32_t value;
+    memcpy(&value, ptr, 4);
+    return value;
+}
+
+static inline const char* read_varint(const char* ptr, const char* end, int64_t* value) {
+    uint64_t v = 0;
+    for(int shift=0;shift<64;shift+=7) {
+        if(ptr >= end) {
+            throw std::runtime_error("CONTENTS TERMINATED UNEXPECTEDLY");
+        }
+        unsigned char c = (unsigned char)*(ptr++);
+        v |= (uint64_t)(c & 127) << shift;
+        if(!(c & 128)) {
+            *value = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+            return ptr;
+        }
+    }
+    throw std::runtime_error("BAD VARINT");
+}
+
+
+FLUX::FCodeV2Parser::FCodeV2Parser(void) : FCodeV1Parser() {
+    resolution = e_resolution = 0;
+}
+
+void FLUX::FCodeV2Parser::load(const char* buf, size_t size) {
+    metadata.clear();
+    previews.clear();
+    index.clear();
+
+    if(size < 36 || memcmp(buf, "FCx0002\n", 8)) {
+        throw std::runtime_error("BAD FILE HEADER");
+    }
+    uint32_t flags = read_uint32(buf + 8);
+    memcpy(&resolution, buf + 12, 8);
+    memcpy(&e_resolution, buf + 20, 8);
+    script_size = read_uint32(buf + 28);
+    uint32_t stored_size = read_uint32(buf + 32);
+    if((flags & ~FCODE_V2_ZLIB) || !(resolution > 0) || !(e_resolution > 0)) {
+        throw std::runtime_error("BAD FILE HEADER");
+    }
+
+    const char* ptr = buf + 36;
+    const char* end = buf + size;
+
+    // Script block
+    if((size_t)(end - ptr) < (size_t)stored_size + 4) {
+        throw std::runtime_error("CONTENTS TERMINATED UNEXPECTEDLY");
+    }
+    if(flags & FCODE_V2_ZLIB) {
+#ifdef FLUX_HAVE_ZLIB
+        // One extra byte, zlib wants a valid pointer for an empty script
+        inflated.resize(script_size + 1);
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if(inflateInit(&zs) != Z_OK) {
+            throw std::runtime_error("ZLIB INIT ERROR");
+        }
+        zs.next_in = (Bytef*)ptr;
+        zs.avail_in = stored_size;
+        zs.next_out = (Bytef*)inflated.data();
+        zs.avail_out = script_size;
+        int ret = inflate(&zs, Z_FINISH);
+        size_t output_size = zs.total_out;
+        inflateEnd(&zs);
+        if(ret != Z_STREAM_END || output_size != script_size) {
+            throw std::runtime_error("SCRIPT DECOMPRESS ERROR");
+        }
+        script = inflated.data();
+#else
+        throw std::runtime_error("NOT_SUPPORT ZLIB");
+#endif
+    } else {
+        if(stored_size != script_size) {
+            throw std::runtime_error("BAD FILE HEADER");
+        }
+        script = ptr;
+    }
+    ptr += stored_size;
+    if(FLUX::crc32(0, script, script_size) != read_uint32(ptr)) {
+        throw std::runtime_error("SCRIPT CRC32 NOT MATCH");
+    }
+    ptr += 4;
+
+    load_trailer(ptr, end);
+}
+
+void FLUX::FCodeV2Parser::parse_script(const char* buf, size_t size, const FCodeIndexEntry* resume) {
+    const char* ptr = buf;
+    const char* end = buf + size;
+    // F, X, Y, Z, E0, E1, E2, E is sent relative to the start of buf
+    float current[7] = {0, 0, 0, 0, 0, 0, 0};
+    // Quantized X, Y, Z, E0, E1, E2, same as writer at the start of buf
+    int64_t quantized[6] = {0, 0, 0, 0, 0, 0};
+    double step[6] = {resolution, resolution, resolution, e_resolution, e_resolution, e_resolution};
+    bool absolute = true;
+    if(resume) {
+        float position[6] = {resume->x, resume->y, resume->z, resume->e[0], resume->e[1], resume->e[2]};
+        for(int i=0;i<6;i++) {
+            quantized[i] = llround(position[i] / step[i]);
+        }
+        current[0] = resume->feedrate;
+        memcpy(current + 1, position, 3 * sizeof(float));
+        absolute = resume->absolute;
+    }
+    int64_t e_base[3] = {quantized[3], quantized[4], quantized[5]};
+    FLUX::MoveBatch batch;
+
+    while(ptr < end) {
+        unsigned char cmd = (unsigned char)*(ptr++);
+
+        if(cmd & 128) {
+            int flags = cmd & 127;
+            if(flags & FLAG_HAS_FEEDRATE) {
+                if(end - ptr < 4) {
+                    throw std::runtime_error("CONTENTS TERMINATED UNEXPECTEDLY");
+                }
+                memcpy(current, ptr, 4);
+                ptr += 4;
+            }
+            for(int i=0;i<6;i++) {
+                if(flags & (32 >> i)) {
+                    int64_t delta;
+                    ptr = read_varint(ptr, end, &delta);
+                    quantized[i] += delta;
+                    current[i + 1] = (float)((quantized[i] - (i >= 3 ? e_base[i - 3] : 0)) * step[i]);
+                }
+            }
+            if(batch.append(flags, current[0], current[1], current[2], current[3],
+                            current[4], current[5], current[6])) {
+                handler->moveto_batch(&batch);
+                batch.size = 0;
+            }
+            continue;
+        }
+
+        if(batch.size) {
+            handler->moveto_batch(&batch);
+            batch.size = 0;
+        }
+
+        // V2 writer never uses relative moves (command 3)
+        ptr = parse_command(cmd, ptr, end, &absolute);
+    }
+
+    if(batch.size) {
+        handler->moveto_batch(&batch);
+    }
+}
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <stdexcept>
+#ifdef FLUX_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include "crc32.h"
+#include "fcode.h"
+
+static inline char* write_varint(char* ptr, int64_t value) {
+    // Zigzag, small negative deltas stay small
+    uint64_t v = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    while(v >= 128) {
+        *(ptr++) = (char)(v | 128);
+        v >>= 7;
+    }
+    *(ptr++) = (char)v;
+    return ptr;
+}
+
+static inline bool quantize(float value, double resolution, int64_t* output) {
+    double v = value / resolution;
+    // Also false for nan
+    if(!(fabs(v) < 4e18)) return false;
+    *output = llround(v);
+    return true;
+}
+
+
+FLUX::FCodeV2::FCodeV2(std::string *type, std::vector<std::pair<std::string, std::string> > *file_metadata,
+        std::vector<std::string> *image_previews, double xyz_resolution, double extrude_resolution,
+        int level) : FCodeV1(type, file_metadata, image_previews) {
+    if(!(xyz_resolution > 0) || !(extrude_resolution > 0)) {
+        throw std::runtime_error("BAD RESOLUTION");
+    }
+    version = "2";
+    resolution = xyz_resolution;
+    e_resolution = extrude_resolution;
+    compress_level = level;
+    memset(quantized, 0, sizeof(quantized));
+    deflater = NULL;
+
+    if(compress_level > 0) {
+#ifdef FLUX_HAVE_ZLIB
+        z_stream* zs = new z_stream;
+        memset(zs, 0, sizeof(z_stream));
+        if(deflateInit(zs, compress_level > 9 ? 9 : compress_level) != Z_OK) {
+            delete zs;
+            throw std::runtime_error("ZLIB INIT ERROR");
+        }
+        deflater = zs;
+#else
+        throw std::runtime_error("NOT_SUPPORT ZLIB");
+#endif
+    }
+}
+
+FLUX::FCodeV2::~FCodeV2(void) {
+#ifdef FLUX_HAVE_ZLIB
+    if(deflater) {
+        deflateEnd((z_stream*)deflater);
+        delete (z_stream*)deflater;
+    }
+#endif
+}
+
+void FLUX::FCodeV2::begin(void) {
+    write("FCx0002\n", 8, NULL);
+    write((uint32_t)(deflater ? FCODE_V2_ZLIB : 0), NULL);
+    write((const char*)&resolution, 8, NULL);
+    write((const char*)&e_resolution, 8, NULL);
+    script_offset = tell();
+    if(script_offset < 0) {
+        throw std::runtime_error("NOT_SUPPORT STREAM");
+    }
+    // Script size and stored size
+    write("\x00\x00\x00\x00\x00\x00\x00\x00", 8, NULL);
+}
+
+void FLUX::FCodeV2::deflate_script(int flush) {
+#ifdef FLUX_HAVE_ZLIB
+    z_stream* zs = (z_stream*)deflater;
+    char output[16384];
+    int ret;
+    do {
+        zs->next_out = (Bytef*)output;
+        zs->avail_out = sizeof(output);
+        ret = deflate(zs, flush);
+        if(ret == Z_STREAM_ERROR) {
+            throw std::runtime_error("ZLIB ERROR");
+        }
+        write(output, sizeof(output) - zs->avail_out, NULL);
+    } while(zs->avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+#endif
+}
+
+void FLUX::FCodeV2::write_script(const char* buf, size_t size) {
+#ifdef FLUX_HAVE_ZLIB
+    if(deflater) {
+        z_stream* zs = (z_stream*)deflater;
+        zs->next_in = (Bytef*)buf;
+        zs->avail_in = size;
+        deflate_script(Z_NO_FLUSH);
+        return;
+    }
+#endif
+    write(buf, size, NULL);
+}
+
+void FLUX::FCodeV2::finish_script(void) {
+    flush_script();
+#ifdef FLUX_HAVE_ZLIB
+    if(deflater) {
+        deflate_script(Z_FINISH);
+    }
+#endif
+    long script_end_offset = tell();
+    patch(script_offset, script_written);
+    patch(script_offset + 4, script_end_offset - script_offset - 8);
+    write((uint32_t)script_crc32, NULL);
+}
+
+char* FLUX::FCodeV2::encode_move(char* ptr, int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
+    if(!(feedrate > 0)) flags &= ~FLAG_HAS_FEEDRATE;
+
+    float values[6] = {x, y, z, e0, e1, e2};
+    int64_t q[6];
+    for(int i=0;i<6;i++) {
+        if(flags & (32 >> i)) {
+            if(!quantize(values[i], i < 3 ? resolution : e_resolution, q + i)) {
+                flags &= ~(32 >> i);
+                on_error(false, "BAD_COORDINATE", 14);
+            }
+        }
+    }
+
+    *(ptr++) = (char)(flags | 128);
+    if(flags & FLAG_HAS_FEEDRATE) { memcpy(ptr, &feedrate, 4); ptr += 4; }
+    for(int i=0;i<6;i++) {
+        if(flags & (32 >> i)) {
+            ptr = write_varint(ptr, q[i] - quantized[i]);
+            quantized[i] = q[i];
+        }
+    }
+    return ptr;
+}
+
+void FLUX::FCodeV2::moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
+    update_statistics(flags, feedrate, x, y, z, e0, e1, e2);
+    char* ptr = reserve(FCODE_V2_MAX_MOVE_SIZE);
+    staging_size += encode_move(ptr, flags, feedrate, x, y, z, e0, e1, e2) - ptr;
+}
+
+void FLUX::FCodeV2::moveto_batch(const FLUX::MoveBatch* batch) {
+    char* ptr = reserve(MOVE_BATCH_CAPACITY * FCODE_V2_MAX_MOVE_SIZE);
+    char* begin = ptr;
+    for(size_t i=0;i<batch->size;i++) {
+        update_statistics(batch->flags[i], batch->feedrate[i], batch->x[i], batch->y[i], batch->z[i],
+                          batch->e0[i], batch->e1[i], batch->e2[i]);
+        ptr = encode_move(ptr, batch->flags[i], batch->feedrate[i], batch->x[i], batch->y[i], batch->z[i],
+                          batch->e0[i], batch->e1[i], batch->e2[i]);
+    }
+    staging_size += ptr - begin;
+}
+
+void FLUX::FCodeV2::sync_position(void) {
+    float current[3] = {current_x, current_y, current_z};
+    int flags = 0;
+    int64_t q;
+    for(int i=0;i<3;i++) {
+        if(quantize(current[i], resolution, &q) && q != quantized[i]) {
+            flags |= 32 >> i;
+        }
+    }
+    if(flags) {
+        // A move to where the head already is
+        char* ptr = reserve(FCODE_V2_MAX_MOVE_SIZE);
+        staging_size += encode_move(ptr, flags, 0, current_x, current_y, current_z, 0, 0, 0) - ptr;
+    }
+}
+
+void FLUX::FCodeV2::append_anchor(uint32_t value) {
+    sync_position();
+    FCodeV1::append_anchor(value);
+}
+
+void FLUX::FCodeV2::append_comment(const char* message, size_t length) {
+    if(FLUX::is_layer_comment(message, length)) {
+        sync_position();
+    }
+    FCodeV1::append_comment(message, length);
+}
+
+void FLUX::FCodeV2::terminated(void) {
+    finish_script();
+    write_trailer();
+}
+
+
+FLUX::FCodeV2MemoryWriter::FCodeV2MemoryWriter(
+        std::string *type, std::vector<std::pair<std::string, std::string> > *file_metadata,
+        std::vector<std::string> *image_previews, double resolution, double e_resolution,
+        int compress_level) : FCodeV2(type, file_metadata, image_previews, resolution, e_resolution, compress_level) {
+    opened = true;
+    begin();
+}
+
+FLUX::FCodeV2MemoryWriter::~FCodeV2MemoryWriter(void) {
+    if(opened) {
+        terminated();
+    }
+}
+
+void FLUX::FCodeV2MemoryWriter::detach_buffer(std::vector<char>* target) {
+    target->swap(buffer);
+    std::vector<char>().swap(buffer);
+}
+
+void FLUX::FCodeV2MemoryWriter::write(const char* buf, size_t size, unsigned long *crc32_ptr) {
+    if(opened) {
+        buffer.insert(buffer.end(), buf, buf + size);
+        if(crc32_ptr) {
+            *crc32_ptr = FLUX::crc32(*crc32_ptr, (const void *)buf, size);
+        }
+    }
+}
+
+long FLUX::FCodeV2MemoryWriter::tell(void) {
+    return buffer.size();
+}
+
+void FLUX::FCodeV2MemoryWriter::patch(long offset, uint32_t value) {
+    memcpy(buffer.data() + offset, &value, 4);
+}
+
+void FLUX::FCodeV2MemoryWriter::terminated(void) {
+    if(opened) {
+        FLUX::FCodeV2::terminated();
+        opened = false;
+    }
+}
+
+
+FLUX::FCodeV2FileWriter::FCodeV2FileWriter(const char* filename,
+        std::string *type, std::vector<std::pair<std::string, std::string> > *file_metadata,
+        std::vector<std::string> *image_previews, double resolution, double e_resolution,
+        int compress_level) : FCodeV2(type, file_metadata, image_previews, resolution, e_resolution, compress_level) {
+    stream = new std::ofstream(filename);
+    if(stream->fail()) {
+        delete stream;
+        stream = NULL;
+        throw std::runtime_error("OPEN FILE ERROR");
+    }
+    begin();
+}
+
+FLUX::FCodeV2FileWriter::~FCodeV2FileWriter(void) {
+    if(stream) {
+        flush_script();
+        delete stream;
+    }
+}
+
+void FLUX::FCodeV2FileWriter::write(const char* buf, size_t size, unsigned long *crc32) {
+    if(((std::ofstream*)stream)->is_open()) {
+        FLUX::FCodeV1Base::write(buf, size, crc32);
+    }
+}
+
+void FLUX::FCodeV2FileWriter::terminated(void) {
+    if(((std::ofstream*)stream)->is_open()) {
+        FLUX::FCodeV2::terminated();
+        ((std::ofstream*)stream)->close();
+    }
+}
@@ -5,10 +5,38 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <vector>
 #include "toolpath.h"
 
+// Longest line GCodeWriterBase::format_moveto may produce:
+// "Tn\n", "G1", 5 fields of at most 63 chars and "\n"
+#define GCODE_MOVETO_LINE_MAX 328
+#define GCODE_STAGING_CAPACITY 65536
+
 
 namespace FLUX {
+    // One `<letter><number>` parameter of a G-code line.
+    struct GCodeWord {
+        char letter;
+        float value;
+    };
+
+    // A G-code line tokenized without looking at any modal state, so it can
+    // be decoded on any thread and executed later. Words are stored outside
+    // of the struct, starting at `word_offset`.
+    struct GCodeLine {
+        const char* linep;
+        uint32_t size;
+        // 'G', 'M', 'T', 'X', ';' (comment only), 0 (empty line) or any
+        // other unknown prefix
+        char prefix;
+        int id;
+        uint32_t word_offset;
+        uint32_t word_count;
+        // Offset of the comment text (after ';') in linep, -1 if no comment
+        int32_t comment_offset;
+    };
+
     class GCodeParser {
     public:
         float feedrate;
@@ -27,40 +55,100 @@ namespace FLUX {
         bool from_inch;
         // true if G0/G1 command unit is absolute
         bool absolute;
+        // true (default) to deliver consecutive G0/G1 moves with
+        // moveto_batch instead of one moveto call for each
+        bool batch_moveto;
+
+        // Arc plane selected by G17 (XY, default), G18 (ZX) or G19 (YZ)
+        int arc_plane;
+        // G2/G3 are split into segments whose chord deviates from the arc
+        // by at most arc_tolerance mm
+        float arc_tolerance;
 
         GCodeParser(void);
         void set_processor(FLUX::ToolpathProcessor* handler);
-        void parse_from_file(const char* filepth);
+        // threads > 1 parses the file with parse_buffer_parallel
+        void parse_from_file(const char* filepth, int threads = 1);
+        // Parse a whole G-code text buffer, lines are passed to parse_command
+        // without the trailing newline and without being copied.
+        void parse_buffer(const char* buf, size_t size);
+        // Same as parse_buffer, but lines are decoded by `threads` worker
+        // threads in chunks of about `chunk_size` bytes. Modal state is only
+        // applied while executing the decoded chunks in order on the calling
+        // thread, so processor receives exactly the same events.
+        void parse_buffer_parallel(const char* buf, size_t size, int threads,
+                                   size_t chunk_size = 1 << 20);
         void parse_command(const char* linep, size_t size);
 
+        static void decode_line(const char* linep, size_t size, GCodeLine* line,
+                                std::vector<GCodeWord>* words);
+        void execute(const GCodeLine* line, const GCodeWord* words);
+
     protected:
         FLUX::ToolpathProcessor* handler;
-
-        void parse_comment(const char* linep, size_t offset, size_t size);
-
-        int handle_g0g1(const char* linep, int offset, int size);
-        int handle_g4(const char* linep, int offset, int size);
-        int handle_g28(const char* linep, int offset, int size);
-        int handle_g92(const char* linep, int offset, int size);
-        int handle_m17(const char* linep, int offset, int size);
-        int handle_m18m84(const char* linep, int offset, int size);
-        int handle_m24m25m226(const char* linep, int offset, int size);
-        int handle_m104m109(const char* linep, int offset, int size, bool wait);
-        int handle_m106(const char* linep, int offset, int size);
-        int handle_m107(const char* linep, int offset, int size);
-        int handle_x2(const char* linep, int offset, int size);
+        std::vector<GCodeWord> line_words;
+        FLUX::MoveBatch move_batch;
+
+        void parse_line(const char* linep, size_t size);
+        // Must be called before sending any event other than moveto
+        inline void flush_moves(void) {
+            if(move_batch.size) {
+                handler->moveto_batch(&move_batch);
+                move_batch.size = 0;
+            }
+        }
+
+        inline void push_move(int flags) {
+            if(batch_moveto) {
+                if(move_batch.append(flags, feedrate,
+                                     position[0], position[1], position[2],
+                                     filaments[0], filaments[1], filaments[2])) {
+                    flush_moves();
+                }
+            } else {
+                handler->moveto(flags, feedrate,
+                                position[0], position[1], position[2],
+                                filaments[0], filaments[1], filaments[2]);
+            }
+        }
+
+        void handle_g0g1(const GCodeLine* line, const GCodeWord* words);
+        void handle_g2g3(const GCodeLine* line, const GCodeWord* words, bool clockwise);
+        void handle_g4(const GCodeLine* line, const GCodeWord* words);
+        void handle_g28(const GCodeLine* line);
+        void handle_g92(const GCodeLine* line, const GCodeWord* words);
+        void handle_m24m25m226(const GCodeLine* line, const GCodeWord* words);
+        void handle_m104m109(const GCodeLine* line, const GCodeWord* words, bool wait);
+        void handle_m106(const GCodeLine* line, const GCodeWord* words);
+        void handle_x2(const GCodeLine* line, const GCodeWord* words);
+        void bad_command(const GCodeLine* line, bool critical, const char* label);
     };
 
     class GCodeWriterBase : public FLUX::ToolpathProcessor {
+    protected:
+        // Lines are composed in the staging buffer and passed to write() in
+        // blocks, flush() must be called before output is used
+        char *staging;
+        size_t staging_size;
+        inline char* reserve(size_t size) {
+            if(staging_size + size > GCODE_STAGING_CAPACITY) flush();
+            return staging + staging_size;
+        }
+        void emit(const char* buf, size_t size);
+        size_t format_moveto(char* out, int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2);
+        // snprintf space of single commands
+        char scratch[32];
     public:
         int t;
-        char buffer[32];
 
         GCodeWriterBase();
+        virtual ~GCodeWriterBase();
+        void flush(void);
         virtual void write(const char* buf, size_t size) = 0;
         virtual void terminated(void) = 0;
 
         virtual void moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2);
+        virtual void moveto_batch(const FLUX::MoveBatch* batch);
         virtual void sleep(float seconds);
         virtual void enable_motor(void);
         virtual void disable_motor(void);
@@ -80,11 +168,15 @@ namespace FLUX {
     class GCodeMemoryWriter : public GCodeWriterBase {
     protected:
         bool opened;
-        std::stringstream *stream;
     public:
+        // Written output, complete once terminated
+        std::vector<char> buffer;
+
         GCodeMemoryWriter(void);
-        ~GCodeMemoryWriter(void);
         std::string get_buffer(void);
+        // Move output into target, leaving this writer empty
+        void detach_buffer(std::vector<char>* target);
+        bool is_terminated(void) { return !opened; }
         virtual void write(const char* buf, size_t size);
         virtual void terminated(void);
     };
@@ -1,8 +1,13 @@
 
+#include <math.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include <string.h>
+#include <future>
 #include "gcode.h"
+#include "mapped_file.h"
+#include "number_parser.h"
 
 
 static inline bool move_to_next_char(const char* linep, int offset, int size, int* next_offset) {
@@ -19,33 +24,30 @@ static inline bool move_to_next_char(const char* linep, int offset, int size, in
 
 
 static inline int parse_command_int(const char* linep, int offset, int size, int* val) {
-    char* endptr;
     if(offset + 1 >= size) {
         *val = 0;
         return size;
     }
-    *val = (int)strtol(linep + offset + 1, &endptr, 10);
-    return endptr - linep;
+    return FLUX::parse_integer(linep + offset + 1, linep + size, val) - linep;
 }
 
 
 static inline int parse_command_float(const char* linep, int offset, int size, float* val) {
-    char* endptr;
-    if(offset + 1 == size) {
+    if(offset + 1 >= size) {
         *val = 0;
         return size;
     }
-    *val = strtof(linep + offset + 1, &endptr);
-    return endptr - linep;
-
+    return FLUX::parse_decimal(linep + offset + 1, linep + size, val) - linep;
 }
 
 
 static inline void on_error(FLUX::ToolpathProcessor *handler, bool critical, const char* fmt, ...) {
+    char buf[1024];
     va_list argptr;
     va_start(argptr, fmt);
-    char* buf = (char*)malloc(1024);
-    int size = vsnprintf(buf, 1024, fmt, argptr);
+    int size = vsnprintf(buf, sizeof(buf), fmt, argptr);
+    va_end(argptr);
+    if(size >= (int)sizeof(buf)) { size = sizeof(buf) - 1; }
     handler->on_error(critical, buf, size);
 }
 
@@ -57,6 +59,9 @@ FLUX::GCodeParser::GCodeParser(void) {
     filaments_offset[0] = filaments_offset[1] = filaments_offset[2] = 0;
     from_inch = false;
     absolute = true;
+    batch_moveto = true;
+    arc_plane = 17;
+    arc_tolerance = 0.01;
     T = 0;
 }
 
@@ -66,33 +71,207 @@ void FLUX::GCodeParser::set_processor(FLUX::ToolpathProcessor* _handler) {
 }
 
 
-void FLUX::GCodeParser::parse_from_file(const char* filepth) {
-    std::ifstream infile(filepth);
-    std::string linep;
+void FLUX::GCodeParser::parse_from_file(const char* filepth, int threads) {
+    FLUX::MappedFile infile(filepth);
+    if(threads > 1) {
+        parse_buffer_parallel(infile.data(), infile.size(), threads);
+    } else {
+        parse_buffer(infile.data(), infile.size());
+    }
+}
+
+
+void FLUX::GCodeParser::parse_buffer(const char* buf, size_t size) {
+    const char* end = buf + size;
 
-    while (std::getline(infile, linep)) {
-        parse_command(linep.c_str(), linep.size());
+    while(buf < end) {
+        const char* eol = (const char*)memchr(buf, '\n', end - buf);
+        if(eol) {
+            parse_line(buf, eol - buf);
+            buf = eol + 1;
+        } else {
+            parse_line(buf, end - buf);
+            break;
+        }
     }
+    flush_moves();
+}
+
+
+namespace {
+    struct DecodedChunk {
+        std::vector<FLUX::GCodeLine> lines;
+        std::vector<FLUX::GCodeWord> words;
+    };
+
+    void decode_chunk(const char* buf, const char* end, DecodedChunk* chunk) {
+        FLUX::GCodeLine line;
+        chunk->lines.clear();
+        chunk->words.clear();
+
+        while(buf < end) {
+            const char* eol = (const char*)memchr(buf, '\n', end - buf);
+            const char* line_end = eol ? eol : end;
+            FLUX::GCodeParser::decode_line(buf, line_end - buf, &line, &chunk->words);
+            chunk->lines.push_back(line);
+            buf = line_end + 1;
+        }
+    }
+
+    // Chunks always end right after a newline (or at the end of buffer)
+    const char* next_chunk_end(const char* buf, const char* end, size_t chunk_size) {
+        if((size_t)(end - buf) <= chunk_size) { return end; }
+        const char* eol = (const char*)memchr(buf + chunk_size, '\n', end - buf - chunk_size);
+        return eol ? eol + 1 : end;
+    }
+}
+
+
+void FLUX::GCodeParser::parse_buffer_parallel(const char* buf, size_t size, int threads, size_t chunk_size) {
+    if(threads <= 1 || size <= chunk_size) {
+        parse_buffer(buf, size);
+        return;
+    }
+
+    // Up to `threads` chunks are decoded while the calling thread executes
+    // the oldest one. Declared before futures: pending decoders must finish
+    // (futures destroyed) before their chunk storage goes away.
+    size_t slots = threads + 1;
+    std::vector<DecodedChunk> chunks(slots);
+    std::vector<std::future<void> > futures(slots);
+
+    const char* cursor = buf;
+    const char* end = buf + size;
+    size_t submitted = 0, executed = 0;
+
+    while(true) {
+        while(cursor < end && submitted - executed < slots) {
+            const char* chunk_end = next_chunk_end(cursor, end, chunk_size);
+            size_t slot = submitted % slots;
+            futures[slot] = std::async(std::launch::async, decode_chunk, cursor, chunk_end, &chunks[slot]);
+            cursor = chunk_end;
+            submitted++;
+        }
+        if(executed == submitted) { break; }
+
+        size_t slot = executed % slots;
+        futures[slot].get();
+        DecodedChunk& chunk = chunks[slot];
+        const FLUX::GCodeWord* words = chunk.words.data();
+        for(auto it=chunk.lines.begin();it!=chunk.lines.end();++it) {
+            execute(&(*it), words + it->word_offset);
+        }
+        executed++;
+    }
+    flush_moves();
 }
 
 
 void FLUX::GCodeParser::parse_command(const char* linep, size_t size) {
-    int cmd_offset = 0;
-    if(!move_to_next_char(linep, 0, size, &cmd_offset)) { return; }
+    parse_line(linep, size);
+    flush_moves();
+}
+
+
+void FLUX::GCodeParser::parse_line(const char* linep, size_t size) {
+    GCodeLine line;
+    line_words.clear();
+    decode_line(linep, size, &line, &line_words);
+    execute(&line, line_words.data());
+}
 
-    char cmdprefix = linep[cmd_offset];
-    int cmdid;
-    cmd_offset = parse_command_int(linep, cmd_offset, size, &cmdid);
 
-    switch(cmdprefix) {
+void FLUX::GCodeParser::decode_line(const char* linep, size_t size, GCodeLine* line,
+                                    std::vector<GCodeWord>* words) {
+    int offset = 0;
+    line->linep = linep;
+    line->size = size;
+    line->prefix = 0;
+    line->id = 0;
+    line->word_offset = words->size();
+    line->word_count = 0;
+    line->comment_offset = -1;
+
+    if(!move_to_next_char(linep, 0, size, &offset)) { return; }
+
+    char prefix = linep[offset];
+    switch(prefix) {
+        case ';':
+            line->prefix = ';';
+            line->comment_offset = offset + 1;
+            return;
+        case '\n':
+            return;
+    }
+
+    line->prefix = prefix;
+    offset = parse_command_int(linep, offset, size, &line->id);
+
+    GCodeWord word;
+    while(offset < (int)size) {
+        char c = linep[offset];
+        switch(c) {
+            case ' ':
+            case '\t':
+            case '\r':
+                offset++;
+                continue;
+            case ';':
+                line->comment_offset = offset + 1;
+                return;
+            case '\n':
+                return;
+        }
+        word.letter = c;
+        offset = parse_command_float(linep, offset, size, &word.value);
+        words->push_back(word);
+        line->word_count++;
+    }
+}
+
+
+void FLUX::GCodeParser::execute(const GCodeLine* line, const GCodeWord* words) {
+    switch(line->prefix) {
+        case 0:
+            return;
+        case ';':
+            break;
         case 'G':
-            switch(cmdid) {
+            switch(line->id) {
                 case 0:
                 case 1:
-                    cmd_offset = handle_g0g1(linep, cmd_offset, size);
+                case 2:
+                case 3:
+                case 17:
+                case 18:
+                case 19:
+                case 20:
+                case 21:
+                case 90:
+                case 91:
+                case 92:
+                    // Do not break a batch of moves, these commands only
+                    // touch parser state
+                    break;
+                default:
+                    flush_moves();
+            }
+            switch(line->id) {
+                case 0:
+                case 1:
+                    handle_g0g1(line, words);
+                    break;
+                case 2:
+                case 3:
+                    handle_g2g3(line, words, line->id == 2);
                     break;
                 case 4:
-                    cmd_offset = handle_g4(linep, cmd_offset, size);
+                    handle_g4(line, words);
+                    break;
+                case 17:
+                case 18:
+                case 19:
+                    arc_plane = line->id;
                     break;
                 case 20:
                     from_inch = true;
@@ -101,7 +280,7 @@ void FLUX::GCodeParser::parse_command(const char* linep, size_t size) {
                     from_inch = false;
                     break;
                 case 28:
-                    cmd_offset = handle_g28(linep, cmd_offset, size);
+                    handle_g28(line);
                     break;
                 case 90:
                     absolute = true;
@@ -110,286 +289,339 @@ void FLUX::GCodeParser::parse_command(const char* linep, size_t size) {
                     absolute = false;
                     break;
                 case 92:
-                    cmd_offset = handle_g92(linep, cmd_offset, size);
+                    handle_g92(line, words);
                     break;
                 default:
-                    on_error(handler, true, "BAD_COMMAND %.*s", size, linep);
+                    bad_command(line, true, "BAD_COMMAND");
                     break;
             }
             break;
         case 'M':
-            switch(cmdid) {
+            flush_moves();
+            switch(line->id) {
                 case 17:
-                    cmd_offset = handle_m17(linep, cmd_offset, size);
+                    handler->enable_motor();
                     break;
                 case 18:
                 case 84:
-                    cmd_offset = handle_m18m84(linep, cmd_offset, size);
+                    handler->disable_motor();
                     break;
                 case 24:
                 case 25:
                 case 226:
-                    cmd_offset = handle_m24m25m226(linep, cmd_offset, size);
+                    handle_m24m25m226(line, words);
                     break;
                 case 104:
-                    cmd_offset = handle_m104m109(linep, cmd_offset, size, false);
+                    handle_m104m109(line, words, false);
                     break;
                 case 107:
-                    cmd_offset = handle_m107(linep, cmd_offset, size);
+                    handler->set_toolhead_fan_speed(0);
                     break;
                 case 109:
-                    cmd_offset = handle_m104m109(linep, cmd_offset, size, true);
+                    handle_m104m109(line, words, true);
                     break;
                 case 106:
-                    cmd_offset = handle_m106(linep, cmd_offset, size);
+                    handle_m106(line, words);
                     break;
                 default:
-                    on_error(handler, true, "BAD_COMMAND %.*s", size, linep);
+                    bad_command(line, true, "BAD_COMMAND");
                     break;
             }
             break;
         case 'T':
-            if(cmdid >= 0 && cmdid <= 3) {
-                T = cmdid;
+            if(line->id >= 0 && line->id <= 2) {
+                T = line->id;
             } else {
-                on_error(handler, true, "BAD_COMMAND %.*s", size, linep);
+                bad_command(line, true, "BAD_COMMAND");
             }
             break;
         case 'X':
-            if(cmdid == 2) {
-                cmd_offset = handle_x2(linep, cmd_offset, size);
+            flush_moves();
+            if(line->id == 2) {
+                handle_x2(line, words);
             } else {
-                on_error(handler, true, "BAD_COMMAND %.*s", size, linep);
+                bad_command(line, true, "BAD_COMMAND");
             }
             break;
-        case ';':
-            parse_comment(linep, 0, size);
-            return;
-        case '\n':
-            return;
         default:
-            on_error(handler, true, "BAD_COMMAND %.*s", size, linep);
+            bad_command(line, true, "BAD_COMMAND");
             break;
     }
-    parse_comment(linep, cmd_offset, size);
+
+    if(line->comment_offset >= 0) {
+        flush_moves();
+        size_t offset = line->comment_offset;
+        size_t size = line->size;
+        if(size > offset && line->linep[size - 1] == '\n') { size--; }
+        handler->append_comment(line->linep + offset, size - offset);
+    }
 }
 
-void FLUX::GCodeParser::parse_comment(const char* linep, size_t offset, size_t size) {
-    while(offset < size) {
-        if(linep[offset++] == ';') {
-            if(linep[size - 1] == '\n') {
-                handler->append_comment(linep + offset, size - offset - 1);
-            } else {
-                handler->append_comment(linep + offset, size - offset);
+void FLUX::GCodeParser::bad_command(const GCodeLine* line, bool critical, const char* label) {
+    flush_moves();
+    on_error(handler, critical, "%s %.*s", label, (int)line->size, line->linep);
+}
+
+void FLUX::GCodeParser::handle_g0g1(const GCodeLine* line, const GCodeWord* words) {
+    uint8_t flags = 0;
+
+    for(uint32_t i=0;i<line->word_count;i++) {
+        char param = words[i].letter;
+        float val = words[i].value;
+        switch(param) {
+            case 'E':
+                flags |= FLAG_HAS_E(T);
+                if(from_inch) { val = inch2mm(val); }
+                if(absolute) {
+                    filaments[T] = val + filaments_offset[T];
+                } else {
+                    filaments[T] += val + filaments_offset[T];
+                }
+                break;
+            case 'F':
+                if(flags & FLAG_HAS_FEEDRATE) {
+                    flush_moves();
+                    on_error(handler, false, "DULE_F");
+                }
+                flags |= FLAG_HAS_FEEDRATE;
+                feedrate = val;
+                break;
+            case 'X':
+            case 'Y':
+            case 'Z': {
+                if(flags & FLAG_HAS_AXIS(param)) {
+                    flush_moves();
+                    on_error(handler, false, "DULE_%c", param);
+                }
+                flags |= FLAG_HAS_AXIS(param);
+                int axis = param - 'X';
+                if(from_inch) { val = inch2mm(val); }
+                if(absolute) {
+                    position[axis] = val + position_offset[axis];
+                } else {
+                    position[axis] += val + position_offset[axis];
+                }
+                break;
             }
-            return;
         }
     }
+
+    push_move(flags);
 }
 
-int FLUX::GCodeParser::handle_g0g1(const char* linep, int offset, int size) {
-    bool terminated = false;
+
+void FLUX::GCodeParser::handle_g2g3(const GCodeLine* line, const GCodeWord* words, bool clockwise) {
     uint8_t flags = 0;
-    float val;
-
-    while(offset < size && !terminated) {
-        if(move_to_next_char(linep, offset, size, &offset)) {
-            char param = linep[offset];
-            switch(param) {
-                case ';':
-                case '\n':
-                    terminated = true;
-                    break;
-                case 'E':
-                    offset = parse_command_float(linep, offset, size, &val);
-                    flags |= FLAG_HAS_E(T);
-                    if(from_inch) { val = inch2mm(val); }
-                    if(absolute) {
-                        filaments[T] = val + filaments_offset[T];
-                    } else {
-                        filaments[T] += val + filaments_offset[T];
-                    }
-                    break;
-                case 'F':
-                    offset = parse_command_float(linep, offset, size, &val);
-                    if(flags & FLAG_HAS_FEEDRATE) { on_error(handler, false, "DULE_F"); }
-                    flags |= FLAG_HAS_FEEDRATE;
-                    feedrate = val;
-                    break;
-                case 'X':
-                case 'Y':
-                case 'Z':
-                    offset = parse_command_float(linep, offset, size, &val);
-                    if(flags & FLAG_HAS_AXIS(param)) { on_error(handler, false, "DULE_%c", param); }
-                    flags |= FLAG_HAS_AXIS(param);
-                    int axis = param - 'X';
-                    if(from_inch) { val = inch2mm(val); }
-                    if(absolute) {
-                        position[axis] = val + position_offset[axis];
-                    } else {
-                        position[axis] += val + position_offset[axis];
-                    }
-                    break;
+    float target[3] = {position[0], position[1], position[2]};
+    float target_e = filaments[T];
+    // Center offset (I, J, K) from start point
+    float offset[3] = {0, 0, 0};
+    float radius = 0;
+    bool has_offset = false, has_radius = false;
+
+    for(uint32_t i=0;i<line->word_count;i++) {
+        char param = words[i].letter;
+        float val = words[i].value;
+        if(from_inch && param != 'F') { val = inch2mm(val); }
+        switch(param) {
+            case 'E':
+                flags |= FLAG_HAS_E(T);
+                target_e = absolute ? val + filaments_offset[T] : target_e + val + filaments_offset[T];
+                break;
+            case 'F':
+                flags |= FLAG_HAS_FEEDRATE;
+                feedrate = val;
+                break;
+            case 'X':
+            case 'Y':
+            case 'Z': {
+                int axis = param - 'X';
+                flags |= FLAG_HAS_AXIS(param);
+                target[axis] = absolute ? val + position_offset[axis] : target[axis] + val + position_offset[axis];
+                break;
             }
-        } else {
-            break;
+            case 'I':
+            case 'J':
+            case 'K':
+                offset[param - 'I'] = val;
+                has_offset = true;
+                break;
+            case 'R':
+                radius = val;
+                has_radius = true;
+                break;
         }
     }
 
-    handler->moveto(flags, feedrate,
-                    position[0], position[1], position[2],
-                    filaments[0], filaments[1], filaments[2]);
-    return offset;
-}
+    // Plane axes (a, b) in counterclockwise order and the linear axis
+    int a, b, l;
+    switch(arc_plane) {
+        case 18: a = 2; b = 0; l = 1; break;
+        case 19: a = 1; b = 2; l = 0; break;
+        default: a = 0; b = 1; l = 2; break;
+    }
 
+    double start_a = position[a], start_b = position[b];
+    double da = target[a] - start_a, db = target[b] - start_b;
+    double ca, cb;
+
+    if(has_radius && !has_offset) {
+        // Center lies on the bisector of the chord, a negative radius
+        // selects the arc larger than half circle
+        double chord2 = da * da + db * db;
+        double h2 = 4.0 * radius * radius - chord2;
+        if(chord2 == 0 || h2 < -1e-6 * chord2) {
+            bad_command(line, true, "BAD_ARC");
+            return;
+        }
+        double h = -sqrt(h2 > 0 ? h2 : 0) / sqrt(chord2);
+        if(!clockwise) { h = -h; }
+        if(radius < 0) { h = -h; }
+        ca = start_a + 0.5 * (da - db * h);
+        cb = start_b + 0.5 * (db + da * h);
+    } else if(has_offset) {
+        ca = start_a + offset[a];
+        cb = start_b + offset[b];
+    } else {
+        bad_command(line, true, "BAD_ARC");
+        return;
+    }
 
-int FLUX::GCodeParser::handle_g4(const char* linep, int offset, int size) {
-    if(move_to_next_char(linep, offset, size, &offset)) {
-        char cmdchar = linep[offset];
-        float timelength;
-        offset = parse_command_float(linep, offset, size, &timelength);
+    // Radius vectors from center to start and end point
+    double ra = start_a - ca, rb = start_b - cb;
+    double ea = target[a] - ca, eb = target[b] - cb;
+    double r = sqrt(ra * ra + rb * rb);
+    double angle = atan2(ra * eb - rb * ea, ra * ea + rb * eb);
+    if(clockwise) {
+        if(angle >= -1e-6) { angle -= 2 * M_PI; }
+    } else {
+        if(angle <= 1e-6) { angle += 2 * M_PI; }
+    }
 
-        switch(cmdchar) {
+    // Largest angle per segment keeping chord error under arc_tolerance
+    size_t segments = 1;
+    if(r > arc_tolerance && arc_tolerance > 0) {
+        double step = 2 * acos(1 - arc_tolerance / r);
+        double n = ceil(fabs(angle) / step);
+        segments = n > 65536 ? 65536 : (n < 1 ? 1 : (size_t)n);
+    }
+
+    flags |= (32 >> a) | (32 >> b);
+    double start_l = position[l], start_e = filaments[T];
+    double step_cos = cos(angle / segments), step_sin = sin(angle / segments);
+    double va = ra, vb = rb;
+
+    for(size_t i=1;i<segments;i++) {
+        double next_a = va * step_cos - vb * step_sin;
+        vb = va * step_sin + vb * step_cos;
+        va = next_a;
+        if((i & 15) == 0) {
+            // Correct accumulated rotation error
+            double theta = angle * i / segments;
+            va = ra * cos(theta) - rb * sin(theta);
+            vb = ra * sin(theta) + rb * cos(theta);
+        }
+        double ratio = (double)i / segments;
+        position[a] = ca + va;
+        position[b] = cb + vb;
+        position[l] = start_l + (target[l] - start_l) * ratio;
+        filaments[T] = start_e + (target_e - start_e) * ratio;
+        push_move(flags);
+        // Feedrate is only sent with the first segment
+        flags &= ~FLAG_HAS_FEEDRATE;
+    }
+
+    position[0] = target[0];
+    position[1] = target[1];
+    position[2] = target[2];
+    filaments[T] = target_e;
+    push_move(flags);
+}
+
+
+void FLUX::GCodeParser::handle_g4(const GCodeLine* line, const GCodeWord* words) {
+    if(line->word_count) {
+        switch(words[0].letter) {
             case 'P':
-                handler->sleep(timelength * 1000);
-                return offset;
+                handler->sleep(words[0].value * 1000);
+                return;
             case 'S':
-                handler->sleep(timelength);
-                return offset;
+                handler->sleep(words[0].value);
+                return;
         }
     }
-    on_error(handler, false, "BAD_COMMAND %.*s", size, linep);
-    return offset;
+    bad_command(line, false, "BAD_COMMAND");
 }
 
-int FLUX::GCodeParser::handle_g28(const char* linep, int offset, int size) {
-    if(move_to_next_char(linep, offset, size, &offset)) {
-        on_error(handler, false, "G28_PARAM_IGNORED %.*s", size, linep);
+void FLUX::GCodeParser::handle_g28(const GCodeLine* line) {
+    if(line->word_count) {
+        bad_command(line, false, "G28_PARAM_IGNORED");
     }
     handler->home();
-    return offset;
 }
 
-int FLUX::GCodeParser::handle_g92(const char* linep, int offset, int size) {
+void FLUX::GCodeParser::handle_g92(const GCodeLine* line, const GCodeWord* words) {
     bool has_param_error = false;
-    bool terminated = false;
-    float val;
     int axis;
 
-    while(offset < size && !terminated) {
-        if(move_to_next_char(linep, offset, size, &offset)) {
-            char param = linep[offset];
-            offset = parse_command_float(linep, offset, size, &val);
-            switch(param) {
-                case ';':
-                case '\n':
-                    terminated = true;
-                    break;
-                case 'X':
-                case 'Y':
-                case 'Z':
-                    if(from_inch) { val = inch2mm(val); }
-                    axis = param - 'X';
-                    position_offset[axis] = position[axis] - val;
-                    break;
-                case 'E':
-                    if(from_inch) { val = inch2mm(val); }
-                    axis = T;
-                    filaments_offset[axis] = filaments[axis] - val;
-                    break;
-                default:
-                    has_param_error = true;
-            }
-        } else {
-            break;
+    for(uint32_t i=0;i<line->word_count;i++) {
+        char param = words[i].letter;
+        float val = words[i].value;
+        switch(param) {
+            case 'X':
+            case 'Y':
+            case 'Z':
+                if(from_inch) { val = inch2mm(val); }
+                axis = param - 'X';
+                position_offset[axis] = position[axis] - val;
+                break;
+            case 'E':
+                if(from_inch) { val = inch2mm(val); }
+                axis = T;
+                filaments_offset[axis] = filaments[axis] - val;
+                break;
+            default:
+                has_param_error = true;
         }
     }
     if(has_param_error) {
-        on_error(handler, false, "BAD_PARAM %.*s", size, linep);
+        bad_command(line, false, "BAD_PARAM");
     }
-    return offset;
 }
 
-int FLUX::GCodeParser::handle_m17(const char* linep, int offset, int size) {
-    handler->enable_motor();
-    return offset;
-}
-
-int FLUX::GCodeParser::handle_m18m84(const char* linep, int offset, int size) {
-    handler->disable_motor();
-    return offset;
-}
-
-int FLUX::GCodeParser::handle_m24m25m226(const char* linep, int offset, int size) {
-    if(move_to_next_char(linep, offset, size, &offset)) {
-        char cmdchar = linep[offset];
-        int val;
-        offset = parse_command_int(linep, offset, size, &val);
-        if(cmdchar == 'Z') {
-            handler->pause(val != 0);
-            return offset;
-        } else {
-            handler->pause(true);
-            return offset;
-        }
+void FLUX::GCodeParser::handle_m24m25m226(const GCodeLine* line, const GCodeWord* words) {
+    if(line->word_count && words[0].letter == 'Z') {
+        handler->pause((int)words[0].value != 0);
     } else {
         handler->pause(true);
-        return offset;
     }
-    return offset;
 }
 
-int FLUX::GCodeParser::handle_m104m109(const char* linep, int offset, int size, bool wait) {
-    if(move_to_next_char(linep, offset, size, &offset)) {
-        char cmdchar = linep[offset];
-        float temperature;
-        offset = parse_command_float(linep, offset, size, &temperature);
-
-        if(cmdchar == 'S') {
-            handler->set_toolhead_heater_temperature(temperature, wait);
-            return offset;
-        }
+void FLUX::GCodeParser::handle_m104m109(const GCodeLine* line, const GCodeWord* words, bool wait) {
+    if(line->word_count && words[0].letter == 'S') {
+        handler->set_toolhead_heater_temperature(words[0].value, wait);
+        return;
     }
-    on_error(handler, false, "BAD_COMMAND %.*s", size, linep);
-    return offset;    
+    bad_command(line, false, "BAD_COMMAND");
 }
 
-int FLUX::GCodeParser::handle_m106(const char* linep, int offset, int size) {
-    if(move_to_next_char(linep, offset, size, &offset)) {
-        char cmdchar = linep[offset];
-        float strength;
-        offset = parse_command_float(linep, offset, size, &strength);
-
-        if(cmdchar == 'S') {
-            handler->set_toolhead_fan_speed(strength / 255.0);
-            return offset;
-        }
+void FLUX::GCodeParser::handle_m106(const GCodeLine* line, const GCodeWord* words) {
+    if(line->word_count && words[0].letter == 'S') {
+        handler->set_toolhead_fan_speed(words[0].value / 255.0);
+        return;
     }
-    on_error(handler, false, "BAD_COMMAND %.*s", size, linep);
-    return offset;    
+    bad_command(line, false, "BAD_COMMAND");
 }
 
 
-int FLUX::GCodeParser::handle_m107(const char* linep, int offset, int size) {
-    handler->set_toolhead_fan_speed(0);
-    return offset;
-}
-
-
-int FLUX::GCodeParser::handle_x2(const char* linep, int offset, int size) {
-    if(move_to_next_char(linep, offset, size, &offset)) {
-        char cmdchar = linep[offset];
-        float pwm;
-
-        if(cmdchar == 'O') {
-            offset = parse_command_float(linep, offset, size, &pwm);
-            handler->set_toolhead_pwm(pwm / 255.0);
-        } else if(cmdchar == 'F') {
+void FLUX::GCodeParser::handle_x2(const GCodeLine* line, const GCodeWord* words) {
+    if(line->word_count) {
+        if(words[0].letter == 'O') {
+            handler->set_toolhead_pwm(words[0].value / 255.0);
+        } else if(words[0].letter == 'F') {
             handler->set_toolhead_pwm(0);
         }
-        return offset;
+        return;
     }
-    on_error(handler, false, "BAD_COMMAND %.*s", size, linep);
-    return offset;    
+    bad_command(line, false, "BAD_COMMAND");
 }
-
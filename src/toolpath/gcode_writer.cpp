@@ -1,15 +1,72 @@
 
+#include <math.h>
+#include <string.h>
 #include <stdexcept>
 #include "gcode.h"
 
 FLUX::GCodeWriterBase::GCodeWriterBase() {
     t = 0;
+    staging = new char[GCODE_STAGING_CAPACITY];
+    staging_size = 0;
 }
 
-void FLUX::GCodeWriterBase::moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
+FLUX::GCodeWriterBase::~GCodeWriterBase() {
+    delete[] staging;
+}
+
+static inline int format_field(char* out, const char* fmt, float value) {
+    int size = snprintf(out, 64, fmt, value);
+    return size < 64 ? size : 63;
+}
+
+static const double fixed_scale[] = {1, 10, 100, 1000, 10000};
+
+// Same output as snprintf("%.<digits>f", value) without printf machinery.
+// value * 10^digits (digits <= 4) is exact in double for any float, and
+// rint rounds ties to even like glibc does on the exact binary value.
+// Values out of int64 range, inf and nan fall back to snprintf.
+static inline int format_fixed(char* out, float value, int digits) {
+    double scaled = rint((double)value * fixed_scale[digits]);
+    if(!(fabs(scaled) < 9e18)) {
+        char fmt[8] = {'%', '.', (char)('0' + digits), 'f', 0};
+        return format_field(out, fmt, value);
+    }
+
+    char* ptr = out;
+    if(signbit(value)) { *(ptr++) = '-'; }
+    uint64_t n = (uint64_t)fabs(scaled);
+    uint64_t integer = n / (uint64_t)fixed_scale[digits];
+    uint32_t fraction = (uint32_t)(n - integer * (uint64_t)fixed_scale[digits]);
+
+    char swap[20];
+    int size = 0;
+    do {
+        swap[size++] = (char)('0' + integer % 10);
+        integer /= 10;
+    } while(integer);
+    while(size) { *(ptr++) = swap[--size]; }
+
+    if(digits) {
+        *(ptr++) = '.';
+        for(int i=digits;i>0;i--) {
+            ptr[i - 1] = (char)('0' + fraction % 10);
+            fraction /= 10;
+        }
+        ptr += digits;
+    }
+    return ptr - out;
+}
+
+static inline char* append_field(char* ptr, char name, float value) {
+    ptr[0] = ' ';
+    ptr[1] = name;
+    return ptr + 2 + format_fixed(ptr + 2, value, 4);
+}
+
+size_t FLUX::GCodeWriterBase::format_moveto(char* out, int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
+    char* ptr = out;
     int e_count = 0,
-        new_t = -1,
-        size;
+        new_t = -1;
 
     for(int i=0;i<3;i++) {
         if(flags & FLAG_HAS_E(i)) {
@@ -22,165 +79,186 @@ void FLUX::GCodeWriterBase::moveto(int flags, float feedrate, float x, float y,
     } else if(e_count == 1) {
         if(new_t != t) {
             t = new_t;
-            size = snprintf(buffer, 32, "T%i\n", t);
-            write(buffer, size);
+            ptr[0] = 'T';
+            ptr[1] = (char)('0' + t);
+            ptr[2] = '\n';
+            ptr += 3;
         }
     }
 
-    write("G1", 2);
-    if(flags & FLAG_HAS_FEEDRATE) {
-        size = snprintf(buffer, 32, " F%.4f", feedrate);
-        write(buffer, size);
-    }
-    if(flags & FLAG_HAS_X) {
-        size = snprintf(buffer, 32, " X%.4f", x);
-        write(buffer, size);
-    }
-    if(flags & FLAG_HAS_Y) {
-        size = snprintf(buffer, 32, " Y%.4f", y);
-        write(buffer, size);
-    }
-    if(flags & FLAG_HAS_Z) {
-        size = snprintf(buffer, 32, " Z%.4f", z);
-        write(buffer, size);
-    }
+    memcpy(ptr, "G1", 2);
+    ptr += 2;
+    if(flags & FLAG_HAS_FEEDRATE) { ptr = append_field(ptr, 'F', feedrate); }
+    if(flags & FLAG_HAS_X) { ptr = append_field(ptr, 'X', x); }
+    if(flags & FLAG_HAS_Y) { ptr = append_field(ptr, 'Y', y); }
+    if(flags & FLAG_HAS_Z) { ptr = append_field(ptr, 'Z', z); }
 
     if(e_count == 1) {
         switch(t) {
             case 0:
-                size = snprintf(buffer, 32, " E%.4f", e0);
+                ptr = append_field(ptr, 'E', e0);
                 break;
             case 1:
-                size = snprintf(buffer, 32, " E%.4f", e1);
+                ptr = append_field(ptr, 'E', e1);
                 break;
             case 2:
-                size = snprintf(buffer, 32, " E%.4f", e2);
+                ptr = append_field(ptr, 'E', e2);
                 break;
-            default:
-                size = 0;
         }
-        write(buffer, size);
     }
 
-    write("\n", 1);
+    *(ptr++) = '\n';
+    return ptr - out;
+}
+
+void FLUX::GCodeWriterBase::flush(void) {
+    if(staging_size) {
+        size_t size = staging_size;
+        staging_size = 0;
+        write(staging, size);
+    }
+}
+
+void FLUX::GCodeWriterBase::emit(const char* buf, size_t size) {
+    if(size > GCODE_STAGING_CAPACITY) {
+        flush();
+        write(buf, size);
+    } else {
+        memcpy(reserve(size), buf, size);
+        staging_size += size;
+    }
+}
+
+void FLUX::GCodeWriterBase::moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
+    char* out = reserve(GCODE_MOVETO_LINE_MAX);
+    staging_size += format_moveto(out, flags, feedrate, x, y, z, e0, e1, e2);
+}
+
+void FLUX::GCodeWriterBase::moveto_batch(const FLUX::MoveBatch* batch) {
+    for(size_t i=0;i<batch->size;i++) {
+        char* out = reserve(GCODE_MOVETO_LINE_MAX);
+        staging_size += format_moveto(out, batch->flags[i], batch->feedrate[i],
+                                      batch->x[i], batch->y[i], batch->z[i],
+                                      batch->e0[i], batch->e1[i], batch->e2[i]);
+    }
 }
 
 void FLUX::GCodeWriterBase::sleep(float seconds) {
     int size;
     if(seconds > 1 && (((int)(seconds * 1000) % 1000) < 1)) {
-        size = snprintf(buffer, 32, "G4 S%i", (int)(seconds));
-        write(buffer, size);
+        size = snprintf(scratch, sizeof(scratch), "G4 S%i", (int)(seconds));
+        emit(scratch, size);
     } else if(seconds > 0) {
-        size = snprintf(buffer, 32, "G4 P%i", (int)(seconds * 1000));
-        write(buffer, size);
+        size = snprintf(scratch, sizeof(scratch), "G4 P%i", (int)(seconds * 1000));
+        emit(scratch, size);
     }
 
-    write("\n", 1);
+    emit("\n", 1);
 }
 
 void FLUX::GCodeWriterBase::enable_motor(void) {
-    write("M17", 3);
-    write("\n", 1);
+    emit("M17", 3);
+    emit("\n", 1);
 }
 
 void FLUX::GCodeWriterBase::disable_motor(void) {
-    write("M84", 3);
-    write("\n", 1);
+    emit("M84", 3);
+    emit("\n", 1);
 }
 
 void FLUX::GCodeWriterBase::pause(bool to_standby_position) {
     if(to_standby_position) {
-        write("M25\n", 5);
+        emit("M226\n", 5);
     } else {
-        write("M25 Z0\n", 4);
+        emit("M25\n", 4);
     }
 }
 
 void FLUX::GCodeWriterBase::home(void) {
-    write("G28", 3);
-    write("\n", 1);
+    emit("G28", 3);
+    emit("\n", 1);
 }
 
 void FLUX::GCodeWriterBase::set_toolhead_heater_temperature(float temperature, bool wait) {
-    int size;
-    if(wait) {
-        size = snprintf(buffer, 32, "M109 S%.1f", temperature);
-    } else {
-        size = snprintf(buffer, 32, "M104 S%.1f", temperature);
-    }
-    write(buffer, size);
-    write("\n", 1);
+    char* ptr = reserve(72);
+    memcpy(ptr, wait ? "M109 S" : "M104 S", 6);
+    size_t size = 6 + format_fixed(ptr + 6, temperature, 1);
+    ptr[size++] = '\n';
+    staging_size += size;
 }
 
 void FLUX::GCodeWriterBase::set_toolhead_fan_speed(float strength) {
     if(strength > 0) {
         int size;
-        size = snprintf(buffer, 32, "M106 S%i", (int)(strength * 255));
-        write(buffer, size);
-        write("\n", 1);
+        size = snprintf(scratch, sizeof(scratch), "M106 S%i", (int)(strength * 255));
+        emit(scratch, size);
+        emit("\n", 1);
     } else {
-        write("M107\n", 5);
+        emit("M107\n", 5);
     }
 }
 
 void FLUX::GCodeWriterBase::set_toolhead_pwm(float strength) {
     int size;
-    size = snprintf(buffer, 32, "X2O%i", (int)(strength * 255));
-    write(buffer, size);
-    write("\n", 1);
+    size = snprintf(scratch, sizeof(scratch), "X2O%i", (int)(strength * 255));
+    emit(scratch, size);
+    emit("\n", 1);
 }
 
 
 void FLUX::GCodeWriterBase::append_anchor(uint32_t value) {
     int size;
-    size = snprintf(buffer, 32, ";anchor=%i\n", value);
-    write(buffer, size);
-    write("\n", 1);
+    size = snprintf(scratch, sizeof(scratch), ";anchor=%i\n", value);
+    emit(scratch, size);
+    emit("\n", 1);
 }
 
 void FLUX::GCodeWriterBase::append_comment(const char* message, size_t length) {
-    write(";", 1);
-    write(message, length);
-    write("\n", 1);
+    emit(";", 1);
+    emit(message, length);
+    emit("\n", 1);
 }
 
 void FLUX::GCodeWriterBase::on_error(bool critical, const char* message, size_t length) {
     if(critical) {
-        write("\n; >>>>>>>>>> ERROR: ", 21);
+        emit("\n; >>>>>>>>>> ERROR: ", 21);
     } else {
-        write("\n; >>>>>>>>>> WARNING: ", 23);
+        emit("\n; >>>>>>>>>> WARNING: ", 23);
     }
-    write(message, length);
-    write("\n", 1);
+    emit(message, length);
+    emit("\n", 1);
 }
 
 
 // GCodeMemoryWriter
 FLUX::GCodeMemoryWriter::GCodeMemoryWriter(void) {
-    stream = new std::stringstream();
     opened = true;
 }
 
 
-FLUX::GCodeMemoryWriter::~GCodeMemoryWriter(void) {
-    delete stream;
-}
-
-
 void FLUX::GCodeMemoryWriter::write(const char* buf, size_t size) {
     if(opened) {
-        stream->write(buf, size);
+        buffer.insert(buffer.end(), buf, buf + size);
     }
 }
 
 
 void FLUX::GCodeMemoryWriter::terminated(void) {
+    flush();
     opened = false;
 }
 
 
 std::string FLUX::GCodeMemoryWriter::get_buffer(void) {
-    return stream->str();
+    flush();
+    return std::string(buffer.data(), buffer.size());
+}
+
+
+void FLUX::GCodeMemoryWriter::detach_buffer(std::vector<char>* target) {
+    flush();
+    target->swap(buffer);
+    std::vector<char>().swap(buffer);
 }
 
 // GCodeFileWriter
@@ -207,5 +285,6 @@ void FLUX::GCodeFileWriter::write(const char* buf, size_t size) {
 
 
 void FLUX::GCodeFileWriter::terminated(void) {
+    flush();
     if(stream->is_open()) stream->close();
 }
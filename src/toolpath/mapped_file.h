@@ -0,0 +1,104 @@
+
+#ifndef _MAPPED_FILE_H
+#define _MAPPED_FILE_H
+
+#include <stddef.h>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+namespace FLUX {
+    // Read only memory map of a whole file. An empty file is mapped as a
+    // zero size buffer.
+    class MappedFile {
+    protected:
+        const char* ptr;
+        size_t length;
+#ifdef _WIN32
+        HANDLE file_handle;
+        HANDLE map_handle;
+#endif
+    public:
+        MappedFile(const char* filename) {
+            ptr = NULL;
+            length = 0;
+#ifdef _WIN32
+            map_handle = NULL;
+            file_handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                      OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+            if(file_handle == INVALID_HANDLE_VALUE) {
+                throw std::runtime_error("OPEN FILE ERROR");
+            }
+            LARGE_INTEGER filesize;
+            if(!GetFileSizeEx(file_handle, &filesize)) {
+                CloseHandle(file_handle);
+                throw std::runtime_error("OPEN FILE ERROR");
+            }
+            length = (size_t)filesize.QuadPart;
+            if(length == 0) { return; }
+
+            map_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+            if(map_handle) {
+                ptr = (const char*)MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, 0);
+            }
+            if(ptr == NULL) {
+                if(map_handle) CloseHandle(map_handle);
+                CloseHandle(file_handle);
+                throw std::runtime_error("MMAP FILE ERROR");
+            }
+#else
+            int fd = open(filename, O_RDONLY);
+            if(fd < 0) {
+                throw std::runtime_error("OPEN FILE ERROR");
+            }
+            struct stat st;
+            if(fstat(fd, &st) != 0) {
+                close(fd);
+                throw std::runtime_error("OPEN FILE ERROR");
+            }
+            length = (size_t)st.st_size;
+            if(length == 0) {
+                close(fd);
+                return;
+            }
+
+            void* addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if(addr == MAP_FAILED) {
+                throw std::runtime_error("MMAP FILE ERROR");
+            }
+#ifdef MADV_SEQUENTIAL
+            madvise(addr, length, MADV_SEQUENTIAL);
+#endif
+            ptr = (const char*)addr;
+#endif
+        }
+
+        ~MappedFile(void) {
+#ifdef _WIN32
+            if(ptr) UnmapViewOfFile(ptr);
+            if(map_handle) CloseHandle(map_handle);
+            CloseHandle(file_handle);
+#else
+            if(ptr) munmap((void*)ptr, length);
+#endif
+        }
+
+        const char* data(void) const { return ptr; }
+        size_t size(void) const { return length; }
+
+    private:
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+    };
+}
+
+#endif
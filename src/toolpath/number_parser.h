@@ -0,0 +1,209 @@
+
+#ifndef _NUMBER_PARSER_H
+#define _NUMBER_PARSER_H
+
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+// Locale independent decimal scanner for G-code words, in the style of
+// std::from_chars. Accepts [spaces][+-]digits[.digits] and never reads at or
+// beyond `last`. Results are correctly rounded: common inputs are handled by
+// exact float/double arithmetic, the remaining ones fall back to strtof.
+//
+// Unlike strtof, exponents (1e5), hex, inf and nan are not accepted; in
+// G-code `E` is the extruder word.
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NUMBER_PARSER_SWAR 1
+#endif
+#elif defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM64) || defined(__x86_64__) || defined(__i386__)
+#define NUMBER_PARSER_SWAR 1
+#endif
+
+// The exact fast paths rely on float/double operations being evaluated in
+// their own precision (not x87 extended precision).
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define NUMBER_PARSER_FAST_PATH 1
+#endif
+
+
+namespace FLUX {
+    namespace number_parser {
+        static inline bool is_digit(char c) {
+            return (unsigned char)(c - '0') < 10;
+        }
+
+#ifdef NUMBER_PARSER_SWAR
+        static inline uint64_t read8(const char* p) {
+            uint64_t val;
+            memcpy(&val, p, 8);
+            return val;
+        }
+
+        static inline bool is_eight_digits(uint64_t val) {
+            return !((((val + 0x4646464646464646ULL) | (val - 0x3030303030303030ULL)) &
+                      0x8080808080808080ULL));
+        }
+
+        static inline uint32_t parse_eight_digits(uint64_t val) {
+            const uint64_t mask = 0x000000FF000000FFULL;
+            const uint64_t mul1 = 0x000F424000000064ULL;  // 100 + (1000000ULL << 32)
+            const uint64_t mul2 = 0x0000271000000001ULL;  // 1 + (10000ULL << 32)
+            val -= 0x3030303030303030ULL;
+            val = (val * 10) + (val >> 8);
+            val = (((val & mask) * mul1) + (((val >> 16) & mask) * mul2)) >> 32;
+            return (uint32_t)val;
+        }
+#endif
+
+        // Consume digits into mantissa, returns pointer after the digits.
+        // Digits beyond 19 significant ones are counted in `dropped` and
+        // flagged in `truncated` when non zero.
+        static inline const char* scan_digits(const char* p, const char* last,
+                                              uint64_t* mantissa, int* ndigits,
+                                              int* dropped, bool* truncated) {
+#ifdef NUMBER_PARSER_SWAR
+            while(last - p >= 8 && *ndigits <= 11) {
+                uint64_t val = read8(p);
+                if(!is_eight_digits(val)) break;
+                *mantissa = *mantissa * 100000000ULL + parse_eight_digits(val);
+                if(*mantissa) *ndigits += 8;
+                p += 8;
+            }
+#endif
+            while(p < last && is_digit(*p)) {
+                if(*ndigits < 19) {
+                    *mantissa = *mantissa * 10 + (*p - '0');
+                    if(*mantissa) (*ndigits)++;
+                } else {
+                    (*dropped)++;
+                    if(*p != '0') *truncated = true;
+                }
+                p++;
+            }
+            return p;
+        }
+
+        static inline float slow_path(const char* first, const char* p) {
+            char buf[64];
+            size_t length = p - first;
+            if(length < sizeof(buf)) {
+                memcpy(buf, first, length);
+                buf[length] = 0;
+                return strtof(buf, NULL);
+            } else {
+                std::string swap(first, length);
+                return strtof(swap.c_str(), NULL);
+            }
+        }
+    }
+
+    static const float float_pow10[] = {
+        1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+    static const double double_pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    // Parse a decimal number in [first, last). Returns the pointer after the
+    // number, or `first` (with *value = 0) if there is no number.
+    static inline const char* parse_decimal(const char* first, const char* last, float* value) {
+        using namespace number_parser;
+        const char* p = first;
+        while(p < last && (*p == ' ' || *p == '\t')) p++;
+
+        const char* start = p;
+        bool negative = false;
+        if(p < last && (*p == '-' || *p == '+')) {
+            negative = (*p == '-');
+            p++;
+        }
+
+        uint64_t mantissa = 0;
+        int ndigits = 0, dropped = 0, exponent;
+        bool truncated = false;
+
+        const char* int_begin = p;
+        p = scan_digits(p, last, &mantissa, &ndigits, &dropped, &truncated);
+        bool has_digits = p != int_begin;
+        exponent = dropped;
+
+        if(p < last && *p == '.') {
+            const char* frac_begin = ++p;
+            dropped = 0;
+            p = scan_digits(p, last, &mantissa, &ndigits, &dropped, &truncated);
+            exponent -= (int)(p - frac_begin) - dropped;
+            has_digits |= p != frac_begin;
+        }
+
+        if(!has_digits) {
+            *value = 0;
+            return first;
+        }
+
+        if(mantissa == 0) {
+            *value = negative ? -0.0f : 0.0f;
+            return p;
+        }
+
+#ifdef NUMBER_PARSER_FAST_PATH
+        if(!truncated) {
+            if(mantissa <= (1ULL << 24) && exponent >= -10 && exponent <= 10) {
+                float f = (float)mantissa;
+                f = (exponent < 0) ? f / float_pow10[-exponent] : f * float_pow10[exponent];
+                *value = negative ? -f : f;
+                return p;
+            }
+            if(mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+                double d = (double)mantissa;
+                d = (exponent < 0) ? d / double_pow10[-exponent] : d * double_pow10[exponent];
+
+                // d is correctly rounded; narrowing it to float is only
+                // ambiguous if d landed exactly halfway between two floats.
+                uint64_t bits;
+                memcpy(&bits, &d, 8);
+                if((bits & 0x1FFFFFFFULL) != 0x10000000ULL) {
+                    float f = (float)d;
+                    *value = negative ? -f : f;
+                    return p;
+                }
+            }
+        }
+#endif
+
+        *value = slow_path(start, p);
+        return p;
+    }
+
+    // Parse a decimal integer in [first, last), like strtol(..., 10).
+    static inline const char* parse_integer(const char* first, const char* last, int* value) {
+        const char* p = first;
+        while(p < last && (*p == ' ' || *p == '\t')) p++;
+
+        bool negative = false;
+        if(p < last && (*p == '-' || *p == '+')) {
+            negative = (*p == '-');
+            p++;
+        }
+
+        const char* begin = p;
+        int64_t val = 0;
+        while(p < last && number_parser::is_digit(*p)) {
+            if(val < 0x80000000LL) val = val * 10 + (*p - '0');
+            p++;
+        }
+        if(p == begin) {
+            *value = 0;
+            return first;
+        }
+        if(val > 0x7FFFFFFFLL) val = 0x7FFFFFFFLL;
+        *value = negative ? (int)-val : (int)val;
+        return p;
+    }
+}
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <string.h>
+#include "path_recorder_processor.h"
+
+
+static inline bool contains(const char* message, size_t length, const char* keyword) {
+    size_t keyword_length = strlen(keyword);
+    if(length < keyword_length) return false;
+    const char* end = message + length - keyword_length;
+    for(const char* ptr=message;ptr<=end;ptr++) {
+        ptr = (const char*)memchr(ptr, keyword[0], end - ptr + 1);
+        if(!ptr) return false;
+        if(memcmp(ptr, keyword, keyword_length) == 0) return true;
+    }
+    return false;
+}
+
+
+FLUX::PathRecorderProcessor::PathRecorderProcessor(float max_height) {
+    home_height = max_height;
+    position[0] = position[1] = 0;
+    position[2] = max_height;
+    path_type = PATH_TYPE_MOVE;
+    new_layer_pending = false;
+    highlight_layer = -1;
+
+    layer_offsets.push_back(0);
+    append_point(PATH_TYPE_MOVE);
+    position[2] = 0;
+}
+
+
+void FLUX::PathRecorderProcessor::begin_layer(void) {
+    // A layer starts from the last point of previous layer
+    size_t last = types.size() - 1;
+    layer_offsets.push_back(types.size());
+    points.push_back(points[last * 3]);
+    points.push_back(points[last * 3 + 1]);
+    points.push_back(points[last * 3 + 2]);
+    types.push_back(PATH_TYPE_MOVE);
+}
+
+
+void FLUX::PathRecorderProcessor::moveto(int flags, float /* feedrate */, float x, float y, float z,
+                                         float /* e0 */, float /* e1 */, float /* e2 */) {
+    if(new_layer_pending) {
+        new_layer_pending = false;
+        begin_layer();
+    }
+    if(flags & FLAG_HAS_X) position[0] = x;
+    if(flags & FLAG_HAS_Y) position[1] = y;
+    if(flags & FLAG_HAS_Z) position[2] = z;
+
+    if(flags & (FLAG_HAS_X | FLAG_HAS_Y | FLAG_HAS_Z)) {
+        uint8_t type = PATH_TYPE_MOVE;
+        if(flags & (FLAG_HAS_E(0) | FLAG_HAS_E(1) | FLAG_HAS_E(2))) {
+            type = (path_type == PATH_TYPE_MOVE) ? PATH_TYPE_PERIMETER : path_type;
+            if(type == PATH_TYPE_PERIMETER && highlight_layer == (int)layer_offsets.size() - 1) {
+                type = PATH_TYPE_HIGHLIGHT;
+            }
+        }
+        append_point(type);
+    }
+}
+
+
+void FLUX::PathRecorderProcessor::moveto_batch(const FLUX::MoveBatch* batch) {
+    for(size_t i=0;i<batch->size;i++) {
+        moveto(batch->flags[i], batch->feedrate[i], batch->x[i], batch->y[i], batch->z[i],
+               batch->e0[i], batch->e1[i], batch->e2[i]);
+    }
+}
+
+
+void FLUX::PathRecorderProcessor::home(void) {
+    position[0] = position[1] = 0;
+    position[2] = home_height;
+}
+
+
+void FLUX::PathRecorderProcessor::append_comment(const char* message, size_t length) {
+    if(contains(message, length, "FILL")) {
+        path_type = PATH_TYPE_INFILL;
+    } else if(contains(message, length, "SUPPORT")) {
+        path_type = PATH_TYPE_SUPPORT;
+    } else if(contains(message, length, "LAYER")) {
+        path_type = PATH_TYPE_MOVE;
+        new_layer_pending = true;
+    } else if(contains(message, length, "WALL-OUTER")) {
+        path_type = PATH_TYPE_PERIMETER;
+    } else if(contains(message, length, "WALL-INNER")) {
+        path_type = PATH_TYPE_INNERWALL;
+    } else if(contains(message, length, "RAFT")) {
+        path_type = PATH_TYPE_RAFT;
+    } else if(contains(message, length, "SKIRT")) {
+        path_type = PATH_TYPE_SKIRT;
+    } else if(contains(message, length, "SKIN")) {
+        path_type = PATH_TYPE_SKIN;
+    }
+}
+
+
+void FLUX::PathRecorderProcessor::to_js(std::string* output) {
+    char buf[64];
+    size_t count = types.size();
+    output->clear();
+    output->reserve(count * 28 + layer_offsets.size() * 3 + 2);
+    output->push_back('[');
+    for(size_t layer=0;layer<layer_offsets.size();layer++) {
+        size_t begin = layer_offsets[layer];
+        size_t end = (layer + 1 < layer_offsets.size()) ? layer_offsets[layer + 1] : count;
+        if(layer) output->push_back(',');
+        output->push_back('[');
+        for(size_t i=begin;i<end;i++) {
+            int size = snprintf(buf, sizeof(buf), "[%.2f,%.2f,%.2f,%d]",
+                                points[i * 3], points[i * 3 + 1], points[i * 3 + 2], types[i] - 1);
+            if(i != begin) output->push_back(',');
+            output->append(buf, size);
+        }
+        output->push_back(']');
+    }
+    output->push_back(']');
+}
@@ -0,0 +1,78 @@
+
+#ifndef _PATH_RECORDER_PROCESSOR_H
+#define _PATH_RECORDER_PROCESSOR_H
+
+#include <string>
+#include <vector>
+#include "toolpath.h"
+
+// Point types, same values as PathType of the legacy g2f converter
+#define PATH_TYPE_NEWLAYER 0
+#define PATH_TYPE_INFILL 1
+#define PATH_TYPE_PERIMETER 2
+#define PATH_TYPE_SUPPORT 3
+#define PATH_TYPE_MOVE 4
+#define PATH_TYPE_SKIRT 5
+#define PATH_TYPE_INNERWALL 6
+#define PATH_TYPE_RAFT 7
+#define PATH_TYPE_SKIN 8
+#define PATH_TYPE_HIGHLIGHT 9
+
+
+namespace FLUX {
+    // Record the preview path of a toolpath, split into layers and typed
+    // from ";TYPE:..." and ";LAYER:..." comments the way the legacy g2f
+    // converter does. Points are stored flat: `points` holds x, y, z of
+    // each point, `types` one PATH_TYPE_* per point and layer i covers
+    // points [layer_offsets[i], layer_offsets[i + 1]) (the last layer ends
+    // at the last point).
+    class PathRecorderProcessor : public FLUX::ToolpathProcessor {
+    protected:
+        float position[3];
+        float home_height;
+        uint8_t path_type;
+        bool new_layer_pending;
+
+        void begin_layer(void);
+        inline void append_point(uint8_t type) {
+            points.push_back(position[0]);
+            points.push_back(position[1]);
+            points.push_back(position[2]);
+            types.push_back(type);
+        }
+    public:
+        std::vector<float> points;
+        std::vector<uint8_t> types;
+        std::vector<uint32_t> layer_offsets;
+        // Perimeter points in this layer are recorded as PATH_TYPE_HIGHLIGHT
+        int highlight_layer;
+
+        PathRecorderProcessor(float max_height = 230);
+
+        size_t point_count(void) { return types.size(); }
+        size_t layer_count(void) { return layer_offsets.size(); }
+        // Same JSON as the legacy path_to_js_cpp:
+        // [[[x,y,z,type - 1],...],...]
+        void to_js(std::string* output);
+
+        virtual void moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2);
+        virtual void moveto_batch(const FLUX::MoveBatch* batch);
+        virtual void sleep(float /* seconds */) {}
+        virtual void enable_motor(void) {}
+        virtual void disable_motor(void) {}
+        virtual void pause(bool /* to_standby_position */) {}
+        virtual void home(void);
+        virtual void set_toolhead_heater_temperature(float /* temperature */, bool /* wait */) {}
+        virtual void set_toolhead_fan_speed(float /* strength */) {}
+        virtual void set_toolhead_pwm(float /* strength */) {}
+
+        virtual void append_anchor(uint32_t /* value */) {}
+        virtual void append_comment(const char* message, size_t length);
+
+        virtual void on_error(bool /* critical */, const char* /* message */, size_t /* length */) {}
+
+        virtual void terminated(void) {}
+    };
+}
+
+#endif
@@ -0,0 +1,245 @@
+#include <chrono>
+#include "pipeline_processor.h"
+
+
+// Spin, then yield, then sleep while waiting on the other side of the ring
+static inline void backoff(unsigned int* spins) {
+    if(*spins < 64) {
+        (*spins)++;
+    } else if(*spins < 256) {
+        (*spins)++;
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+
+FLUX::PipelineProcessor::PipelineProcessor(FLUX::ToolpathProcessor* target_processor, size_t capacity) {
+    size_t size = 2;
+    while(size < capacity) size <<= 1;
+
+    target = target_processor;
+    ring = new PipelineEvent[size];
+    mask = size - 1;
+    head.store(0);
+    tail.store(0);
+    next_head = cached_head = cached_tail = 0;
+    failed.store(false);
+    consumer = std::thread(&FLUX::PipelineProcessor::run, this);
+}
+
+
+FLUX::PipelineProcessor::~PipelineProcessor(void) {
+    if(consumer.joinable()) {
+        stop(PIPELINE_EVENT_STOP);
+    }
+    delete[] ring;
+}
+
+
+FLUX::PipelineEvent* FLUX::PipelineProcessor::next_event(uint8_t opcode) {
+    size_t position = next_head;
+    unsigned int spins = 0;
+    while(position - cached_tail > mask) {
+        cached_tail = tail.load(std::memory_order_acquire);
+        if(position - cached_tail > mask) {
+            // Consumer may be waiting for unpublished moves
+            publish();
+            backoff(&spins);
+        }
+    }
+    PipelineEvent* event = ring + (position & mask);
+    event->opcode = opcode;
+    return event;
+}
+
+
+void FLUX::PipelineProcessor::stop(uint8_t opcode) {
+    next_event(opcode);
+    commit_event();
+    consumer.join();
+}
+
+
+void FLUX::PipelineProcessor::run(void) {
+    FLUX::MoveBatch batch;
+    size_t position = tail.load(std::memory_order_relaxed);
+
+    while(true) {
+        unsigned int spins = 0;
+        while(position == cached_head) {
+            cached_head = head.load(std::memory_order_acquire);
+            if(position == cached_head) backoff(&spins);
+        }
+
+        PipelineEvent* event = ring + (position & mask);
+        uint8_t opcode = event->opcode;
+        if(!failed.load(std::memory_order_relaxed)) {
+            try {
+                dispatch(event, &batch);
+            } catch(...) {
+                error = std::current_exception();
+                failed.store(true, std::memory_order_release);
+            }
+        }
+        tail.store(++position, std::memory_order_release);
+
+        if(opcode == PIPELINE_EVENT_TERMINATED || opcode == PIPELINE_EVENT_STOP) {
+            return;
+        }
+    }
+}
+
+
+void FLUX::PipelineProcessor::dispatch(const PipelineEvent* event, FLUX::MoveBatch* batch) {
+    if(event->opcode == PIPELINE_EVENT_MOVETO) {
+        if(batch->append(event->flags, event->feedrate, event->x, event->y, event->z,
+                         event->e0, event->e1, event->e2)) {
+            target->moveto_batch(batch);
+            batch->size = 0;
+        }
+        return;
+    }
+
+    if(batch->size) {
+        target->moveto_batch(batch);
+        batch->size = 0;
+    }
+
+    switch(event->opcode) {
+        case PIPELINE_EVENT_SLEEP:
+            target->sleep(event->x);
+            break;
+        case PIPELINE_EVENT_ENABLE_MOTOR:
+            target->enable_motor();
+            break;
+        case PIPELINE_EVENT_DISABLE_MOTOR:
+            target->disable_motor();
+            break;
+        case PIPELINE_EVENT_PAUSE:
+            target->pause(event->flags != 0);
+            break;
+        case PIPELINE_EVENT_HOME:
+            target->home();
+            break;
+        case PIPELINE_EVENT_HEATER_TEMPERATURE:
+            target->set_toolhead_heater_temperature(event->x, event->flags != 0);
+            break;
+        case PIPELINE_EVENT_FAN_SPEED:
+            target->set_toolhead_fan_speed(event->x);
+            break;
+        case PIPELINE_EVENT_PWM:
+            target->set_toolhead_pwm(event->x);
+            break;
+        case PIPELINE_EVENT_ANCHOR:
+            target->append_anchor(event->value);
+            break;
+        case PIPELINE_EVENT_COMMENT:
+            target->append_comment(event->text.data(), event->text.size());
+            break;
+        case PIPELINE_EVENT_ERROR:
+            target->on_error(event->flags != 0, event->text.data(), event->text.size());
+            break;
+        case PIPELINE_EVENT_TERMINATED:
+            target->terminated();
+            break;
+    }
+}
+
+
+void FLUX::PipelineProcessor::moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
+    PipelineEvent* event = next_event(PIPELINE_EVENT_MOVETO);
+    event->flags = flags;
+    event->feedrate = feedrate;
+    event->x = x; event->y = y; event->z = z;
+    event->e0 = e0; event->e1 = e1; event->e2 = e2;
+    commit_move();
+}
+
+
+void FLUX::PipelineProcessor::moveto_batch(const FLUX::MoveBatch* batch) {
+    for(size_t i=0;i<batch->size;i++) {
+        moveto(batch->flags[i], batch->feedrate[i], batch->x[i], batch->y[i], batch->z[i],
+               batch->e0[i], batch->e1[i], batch->e2[i]);
+    }
+}
+
+
+void FLUX::PipelineProcessor::sleep(float seconds) {
+    next_event(PIPELINE_EVENT_SLEEP)->x = seconds;
+    commit_event();
+}
+
+
+void FLUX::PipelineProcessor::enable_motor(void) {
+    next_event(PIPELINE_EVENT_ENABLE_MOTOR);
+    commit_event();
+}
+
+
+void FLUX::PipelineProcessor::disable_motor(void) {
+    next_event(PIPELINE_EVENT_DISABLE_MOTOR);
+    commit_event();
+}
+
+
+void FLUX::PipelineProcessor::pause(bool to_standby_position) {
+    next_event(PIPELINE_EVENT_PAUSE)->flags = to_standby_position;
+    commit_event();
+}
+
+
+void FLUX::PipelineProcessor::home(void) {
+    next_event(PIPELINE_EVENT_HOME);
+    commit_event();
+}
+
+
+void FLUX::PipelineProcessor::set_toolhead_heater_temperature(float temperature, bool wait) {
+    PipelineEvent* event = next_event(PIPELINE_EVENT_HEATER_TEMPERATURE);
+    event->x = temperature;
+    event->flags = wait;
+    commit_event();
+}
+
+
+void FLUX::PipelineProcessor::set_toolhead_fan_speed(float strength) {
+    next_event(PIPELINE_EVENT_FAN_SPEED)->x = strength;
+    commit_event();
+}
+
+
+void FLUX::PipelineProcessor::set_toolhead_pwm(float strength) {
+    next_event(PIPELINE_EVENT_PWM)->x = strength;
+    commit_event();
+}
+
+
+void FLUX::PipelineProcessor::append_anchor(uint32_t value) {
+    next_event(PIPELINE_EVENT_ANCHOR)->value = value;
+    commit_event();
+}
+
+
+void FLUX::PipelineProcessor::append_comment(const char* message, size_t length) {
+    next_event(PIPELINE_EVENT_COMMENT)->text.assign(message, length);
+    commit_event();
+}
+
+
+void FLUX::PipelineProcessor::on_error(bool critical, const char* message, size_t length) {
+    PipelineEvent* event = next_event(PIPELINE_EVENT_ERROR);
+    event->flags = critical;
+    event->text.assign(message, length);
+    commit_event();
+}
+
+
+void FLUX::PipelineProcessor::terminated(void) {
+    if(!consumer.joinable()) return;
+    stop(PIPELINE_EVENT_TERMINATED);
+    if(failed.load(std::memory_order_acquire)) {
+        std::rethrow_exception(error);
+    }
+}
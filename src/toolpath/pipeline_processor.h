@@ -0,0 +1,116 @@
+
+#ifndef _PIPELINE_PROCESSOR_H
+#define _PIPELINE_PROCESSOR_H
+
+#include <atomic>
+#include <exception>
+#include <string>
+#include <thread>
+#include "toolpath.h"
+
+// Opcodes of PipelineEvent
+#define PIPELINE_EVENT_MOVETO 1
+#define PIPELINE_EVENT_SLEEP 2
+#define PIPELINE_EVENT_ENABLE_MOTOR 3
+#define PIPELINE_EVENT_DISABLE_MOTOR 4
+#define PIPELINE_EVENT_PAUSE 5
+#define PIPELINE_EVENT_HOME 6
+#define PIPELINE_EVENT_HEATER_TEMPERATURE 7
+#define PIPELINE_EVENT_FAN_SPEED 8
+#define PIPELINE_EVENT_PWM 9
+#define PIPELINE_EVENT_ANCHOR 10
+#define PIPELINE_EVENT_COMMENT 11
+#define PIPELINE_EVENT_ERROR 12
+#define PIPELINE_EVENT_TERMINATED 13
+// Stop consumer thread without terminating target
+#define PIPELINE_EVENT_STOP 14
+
+#define PIPELINE_PUBLISH_INTERVAL 64
+
+
+namespace FLUX {
+    // One queued event. Moves use all float columns; other events keep their
+    // float argument in `x`, their bool argument in `flags`, an anchor in
+    // `value` and comment/error messages in `text`.
+    struct PipelineEvent {
+        uint8_t opcode;
+        uint8_t flags;
+        uint32_t value;
+        float feedrate;
+        float x, y, z;
+        float e0, e1, e2;
+        std::string text;
+    };
+
+    // Run target on a consumer thread. Events are queued into a lock-free
+    // single producer/single consumer ring of `capacity` (rounded up to a
+    // power of 2) slots; the producer waits while the ring is full.
+    // Consecutive moves are passed to target with moveto_batch.
+    //
+    // Exceptions thrown by target are kept, later events are dropped and
+    // the exception is thrown again from terminated() on the producer
+    // thread. terminated() returns once target has finished, no event may
+    // be sent after it.
+    class PipelineProcessor : public FLUX::ToolpathProcessor {
+    protected:
+        FLUX::ToolpathProcessor* target;
+        PipelineEvent* ring;
+        size_t mask;
+
+        // Producer and consumer fields are kept a whole cache line apart.
+        // Padding instead of alignas(64), plain new does not honour
+        // extended alignment before C++17.
+        char producer_padding[64];
+        // Written by producer, read by consumer. Moves are published every
+        // PIPELINE_PUBLISH_INTERVAL events, other events at once.
+        std::atomic<size_t> head;
+        size_t next_head;
+        size_t cached_tail;
+        char consumer_padding[64];
+        // Written by consumer, read by producer
+        std::atomic<size_t> tail;
+        size_t cached_head;
+        char failed_padding[64];
+        std::atomic<bool> failed;
+        std::exception_ptr error;
+        std::thread consumer;
+
+        PipelineEvent* next_event(uint8_t opcode);
+        inline void publish(void) {
+            head.store(next_head, std::memory_order_release);
+        }
+        inline void commit_event(void) {
+            next_head++;
+            publish();
+        }
+        inline void commit_move(void) {
+            if((++next_head & (PIPELINE_PUBLISH_INTERVAL - 1)) == 0) publish();
+        }
+        void stop(uint8_t opcode);
+        void run(void);
+        void dispatch(const PipelineEvent* event, FLUX::MoveBatch* batch);
+    public:
+        PipelineProcessor(FLUX::ToolpathProcessor* target_processor, size_t capacity = 4096);
+        ~PipelineProcessor(void);
+
+        virtual void moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2);
+        virtual void moveto_batch(const FLUX::MoveBatch* batch);
+        virtual void sleep(float seconds);
+        virtual void enable_motor(void);
+        virtual void disable_motor(void);
+        virtual void pause(bool to_standby_position);
+        virtual void home(void);
+        virtual void set_toolhead_heater_temperature(float temperature, bool wait);
+        virtual void set_toolhead_fan_speed(float strength);
+        virtual void set_toolhead_pwm(float strength);
+
+        virtual void append_anchor(uint32_t value);
+        virtual void append_comment(const char* message, size_t length);
+
+        virtual void on_error(bool critical, const char* message, size_t length);
+
+        virtual void terminated(void);
+    };
+}
+
+#endif
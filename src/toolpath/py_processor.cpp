@@ -1,144 +1,278 @@
-
 #include<stdexcept>
+#include<string.h>
 #include "py_processor.h"
 
 
 FLUX::PythonToolpathProcessor::PythonToolpathProcessor(PyObject *python_callback) {
     callback = python_callback;
+    chunk_callback = NULL;
+    chunk = NULL;
+    chunk_size = chunk_used = 0;
 }
 
 
-void FLUX::PythonToolpathProcessor::moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
-    PyObject *arglist = Py_BuildValue("(s)", "moveto");
-    PyObject *dictlist = Py_BuildValue("{s:i,s:f,s:f,s:f,s:f,s:(fff)}",
-                                       "flags", flags, "feedrate", feedrate,
-                                       "x", x, "y", y, "z", z,
-                                       "e", e0, e1, e2);
-    PyObject_Call(callback, arglist, dictlist);
+FLUX::PythonToolpathProcessor::PythonToolpathProcessor(PyObject *python_callback, PyObject *python_chunk_callback, size_t events_per_chunk) {
+    callback = python_callback;
+    chunk_callback = python_chunk_callback;
+    chunk = NULL;
+    chunk_size = events_per_chunk;
+    chunk_used = 0;
+}
+
+
+FLUX::PythonToolpathProcessor::~PythonToolpathProcessor(void) {
+    Py_XDECREF(chunk);
+}
+
+
+static inline void call_python(PyObject *callback, const char* name, PyObject *dictlist) {
+    if(PyErr_Occurred()) {
+        Py_XDECREF(dictlist);
+        throw std::runtime_error("PYERROR");
+    }
+    PyObject *arglist = Py_BuildValue("(s)", name);
+    PyObject *ret = PyObject_Call(callback, arglist, dictlist);
     Py_DECREF(arglist);
-    Py_DECREF(dictlist);
+    Py_XDECREF(dictlist);
+    Py_XDECREF(ret);
     if(PyErr_Occurred()) {
         throw std::runtime_error("PYERROR");
     }
 }
 
-void FLUX::PythonToolpathProcessor::sleep(float milliseconds) {
-    PyObject *arglist = Py_BuildValue("(s)", "sleep");
-    PyObject *dictlist = Py_BuildValue("{s:f}", "milliseconds", milliseconds);
-    PyObject_Call(callback, arglist, dictlist);
-    Py_DECREF(arglist);
-    Py_DECREF(dictlist);
+
+FLUX::PythonToolpathEvent* FLUX::PythonToolpathProcessor::next_event(uint8_t opcode) {
+    if(chunk == NULL) {
+        chunk = PyByteArray_FromStringAndSize(NULL, chunk_size * sizeof(PythonToolpathEvent));
+        if(chunk == NULL) {
+            throw std::runtime_error("PYERROR");
+        }
+    }
+    PythonToolpathEvent* event = ((PythonToolpathEvent*)PyByteArray_AS_STRING(chunk)) + chunk_used;
+    memset(event, 0, sizeof(PythonToolpathEvent));
+    event->opcode = opcode;
+    return event;
+}
+
+
+#define EVENT_DONE() if(++chunk_used == chunk_size) { flush(); }
+
+
+void FLUX::PythonToolpathProcessor::flush(void) {
+    if(chunk_used == 0) { return; }
+
+    PyObject *buf = chunk;
+    size_t used = chunk_used;
+    // The bytearray now belongs to python, next event starts a new one
+    chunk = NULL;
+    chunk_used = 0;
+    if(used < chunk_size && PyByteArray_Resize(buf, used * sizeof(PythonToolpathEvent)) != 0) {
+        // Events of this chunk are dropped, the python error is raised
+        Py_DECREF(buf);
+        throw std::runtime_error("PYERROR");
+    }
+
+    PyObject *ret = PyObject_CallFunctionObjArgs(chunk_callback, buf, NULL);
+    Py_DECREF(buf);
+    Py_XDECREF(ret);
     if(PyErr_Occurred()) {
         throw std::runtime_error("PYERROR");
     }
 }
 
+
+void FLUX::PythonToolpathProcessor::moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
+    if(chunk_size) {
+        PythonToolpathEvent* event = next_event(PY_EVENT_MOVETO);
+        event->flags = flags;
+        event->feedrate = feedrate;
+        event->x = x; event->y = y; event->z = z;
+        event->e0 = e0; event->e1 = e1; event->e2 = e2;
+        EVENT_DONE();
+        return;
+    }
+
+    call_python(callback, "moveto",
+                Py_BuildValue("{s:i,s:f,s:f,s:f,s:f,s:(fff)}",
+                              "flags", flags, "feedrate", feedrate,
+                              "x", x, "y", y, "z", z,
+                              "e", e0, e1, e2));
+}
+
+void FLUX::PythonToolpathProcessor::moveto_batch(const FLUX::MoveBatch* batch) {
+    if(!chunk_size) {
+        FLUX::ToolpathProcessor::moveto_batch(batch);
+        return;
+    }
+
+    for(size_t i=0;i<batch->size;i++) {
+        PythonToolpathEvent* event = next_event(PY_EVENT_MOVETO);
+        event->flags = batch->flags[i];
+        event->feedrate = batch->feedrate[i];
+        event->x = batch->x[i]; event->y = batch->y[i]; event->z = batch->z[i];
+        event->e0 = batch->e0[i]; event->e1 = batch->e1[i]; event->e2 = batch->e2[i];
+        EVENT_DONE();
+    }
+}
+
+void FLUX::PythonToolpathProcessor::sleep(float milliseconds) {
+    if(chunk_size) {
+        next_event(PY_EVENT_SLEEP)->x = milliseconds;
+        EVENT_DONE();
+        return;
+    }
+    call_python(callback, "sleep", Py_BuildValue("{s:f}", "milliseconds", milliseconds));
+}
+
 void FLUX::PythonToolpathProcessor::enable_motor(void) {
-    PyObject *arglist = Py_BuildValue("(s)", "enable_motor");
-    PyObject_CallObject(callback, arglist);
-    Py_DECREF(arglist);
-    if(PyErr_Occurred()) {
-        throw std::runtime_error("PYERROR");
+    if(chunk_size) {
+        next_event(PY_EVENT_ENABLE_MOTOR);
+        EVENT_DONE();
+        return;
     }
+    call_python(callback, "enable_motor", NULL);
 }
 
 void FLUX::PythonToolpathProcessor::disable_motor(void) {
-    PyObject *arglist = Py_BuildValue("(s)", "disable_motor");
-    PyObject_CallObject(callback, arglist);
-    Py_DECREF(arglist);
-    if(PyErr_Occurred()) {
-        throw std::runtime_error("PYERROR");
+    if(chunk_size) {
+        next_event(PY_EVENT_DISABLE_MOTOR);
+        EVENT_DONE();
+        return;
     }
+    call_python(callback, "disable_motor", NULL);
 }
 
 void FLUX::PythonToolpathProcessor::pause(bool to_standby_position) {
-    PyObject *arglist = Py_BuildValue("(s)", "pause");
-    PyObject *dictlist = Py_BuildValue("{s:b}", "to_standby_position", to_standby_position);
-    PyObject_Call(callback, arglist, dictlist);
-    Py_DECREF(arglist);
-    Py_DECREF(dictlist);
-    if(PyErr_Occurred()) {
-        throw std::runtime_error("PYERROR");
+    if(chunk_size) {
+        next_event(PY_EVENT_PAUSE)->flags = to_standby_position;
+        EVENT_DONE();
+        return;
     }
+    call_python(callback, "pause", Py_BuildValue("{s:b}", "to_standby_position", to_standby_position));
 }
 
 void FLUX::PythonToolpathProcessor::home(void) {
-    PyObject *arglist = Py_BuildValue("(s)", "home");
-    PyObject_CallObject(callback, arglist);
-    Py_DECREF(arglist);
-    if(PyErr_Occurred()) {
-        throw std::runtime_error("PYERROR");
+    if(chunk_size) {
+        next_event(PY_EVENT_HOME);
+        EVENT_DONE();
+        return;
     }
+    call_python(callback, "home", NULL);
 }
 
 void FLUX::PythonToolpathProcessor::set_toolhead_heater_temperature(float temperature, bool wait) {
-    PyObject *arglist = Py_BuildValue("(s)", "set_toolhead_heater_temperature");
-    PyObject *dictlist = Py_BuildValue("{s:f,s:b}", "temperature", temperature, "wait", wait);
-    PyObject_Call(callback, arglist, dictlist);
-    Py_DECREF(arglist);
-    Py_DECREF(dictlist);
-    if(PyErr_Occurred()) {
-        throw std::runtime_error("PYERROR");
+    if(chunk_size) {
+        PythonToolpathEvent* event = next_event(PY_EVENT_HEATER_TEMPERATURE);
+        event->x = temperature;
+        event->flags = wait;
+        EVENT_DONE();
+        return;
     }
+    call_python(callback, "set_toolhead_heater_temperature",
+                Py_BuildValue("{s:f,s:b}", "temperature", temperature, "wait", wait));
 }
 
 void FLUX::PythonToolpathProcessor::set_toolhead_fan_speed(float strength) {
-    PyObject *arglist = Py_BuildValue("(s)", "set_toolhead_fan_speed");
-    PyObject *dictlist = Py_BuildValue("{s:f}", "strength", strength);
-    PyObject_Call(callback, arglist, dictlist);
-    Py_DECREF(arglist);
-    Py_DECREF(dictlist);
-    if(PyErr_Occurred()) {
-        throw std::runtime_error("PYERROR");
+    if(chunk_size) {
+        next_event(PY_EVENT_FAN_SPEED)->x = strength;
+        EVENT_DONE();
+        return;
     }
+    call_python(callback, "set_toolhead_fan_speed", Py_BuildValue("{s:f}", "strength", strength));
 }
 
 void FLUX::PythonToolpathProcessor::set_toolhead_pwm(float strength) {
-    PyObject *arglist = Py_BuildValue("(s)", "set_toolhead_pwm");
-    PyObject *dictlist = Py_BuildValue("{s:f}", "strength", strength);
-    PyObject_Call(callback, arglist, dictlist);
-    Py_DECREF(arglist);
-    Py_DECREF(dictlist);
-    if(PyErr_Occurred()) {
-        throw std::runtime_error("PYERROR");
+    if(chunk_size) {
+        next_event(PY_EVENT_PWM)->x = strength;
+        EVENT_DONE();
+        return;
     }
+    call_python(callback, "set_toolhead_pwm", Py_BuildValue("{s:f}", "strength", strength));
 }
 
+// Events below carry data which does not fit in PythonToolpathEvent, they
+// are always delivered by callback after the buffered events.
+
 void FLUX::PythonToolpathProcessor::append_anchor(uint32_t value) {
-    PyObject *arglist = Py_BuildValue("(s)", "append_anchor");
-    PyObject *dictlist = Py_BuildValue("{s:i}", "value", value);
-    PyObject_Call(callback, arglist, dictlist);
-    Py_DECREF(arglist);
-    Py_DECREF(dictlist);
-    if(PyErr_Occurred()) {
-        throw std::runtime_error("PYERROR");
-    }
+    flush();
+    call_python(callback, "append_anchor", Py_BuildValue("{s:I}", "value", value));
 }
 
 void FLUX::PythonToolpathProcessor::append_comment(const char* message, size_t length) {
-    PyObject *arglist = Py_BuildValue("(s)", "append_comment");
-    PyObject *dictlist = Py_BuildValue("{s:s#}", "message", message, length);
-    PyObject_Call(callback, arglist, dictlist);
-    Py_DECREF(arglist);
-    Py_DECREF(dictlist);
-    if(PyErr_Occurred()) {
+    flush();
+    call_python(callback, "append_comment", Py_BuildValue("{s:s#}", "message", message, (Py_ssize_t)length));
+}
+
+void FLUX::PythonToolpathProcessor::on_error(bool critical, const char* message, size_t length) {
+    flush();
+    call_python(callback, "on_error",
+                Py_BuildValue("{s:b,s:s#}",
+                              "critical", critical,
+                              "message", message, (Py_ssize_t)length));
+}
+
+void FLUX::PythonToolpathProcessor::terminated(void) {
+    flush();
+}
+
+
+FLUX::PythonWriteBuffer::PythonWriteBuffer(PyObject *file) {
+    write_method = PyObject_GetAttrString(file, "write");
+    if(write_method == NULL) {
         throw std::runtime_error("PYERROR");
     }
+    setp(buffer, buffer + sizeof(buffer));
 }
 
-void FLUX::PythonToolpathProcessor::on_error(bool critical, const char* message, size_t length) {
-    PyObject *arglist = Py_BuildValue("(s)", "on_error");
-    PyObject *dictlist = Py_BuildValue("{s:b,s:s#}",
-                                       "critical", critical,
-                                       "message", message, length);
-    PyObject_Call(callback, arglist, dictlist);
-    Py_DECREF(arglist);
-    Py_DECREF(dictlist);
+FLUX::PythonWriteBuffer::~PythonWriteBuffer(void) {
+    Py_XDECREF(write_method);
+}
+
+bool FLUX::PythonWriteBuffer::send(const char* data, size_t size) {
     if(PyErr_Occurred()) {
-        throw std::runtime_error("PYERROR");
+        return false;
+    }
+    PyObject *bytes = PyBytes_FromStringAndSize(data, size);
+    if(bytes == NULL) {
+        return false;
     }
+    PyObject *ret = PyObject_CallFunctionObjArgs(write_method, bytes, NULL);
+    Py_DECREF(bytes);
+    Py_XDECREF(ret);
+    return ret != NULL;
 }
 
-void FLUX::PythonToolpathProcessor::terminated(void) {
+int FLUX::PythonWriteBuffer::sync(void) {
+    size_t size = pptr() - pbase();
+    if(size) {
+        setp(buffer, buffer + sizeof(buffer));
+        if(!send(buffer, size)) {
+            return -1;
+        }
+    }
+    return 0;
+}
 
+int FLUX::PythonWriteBuffer::overflow(int c) {
+    if(sync() != 0) {
+        return traits_type::eof();
+    }
+    if(c != traits_type::eof()) {
+        *pptr() = (char)c;
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize FLUX::PythonWriteBuffer::xsputn(const char* data, std::streamsize size) {
+    if(size < epptr() - pptr()) {
+        memcpy(pptr(), data, size);
+        pbump((int)size);
+        return size;
+    }
+    // Large blocks are sent directly
+    if(sync() != 0 || !send(data, size)) {
+        return 0;
+    }
+    return size;
 }
@@ -1,14 +1,56 @@
+#define PY_SSIZE_T_CLEAN
 
 #include<Python.h>
+#include<ostream>
+#include<streambuf>
 #include "toolpath.h"
 
+// Opcodes of PythonToolpathEvent
+#define PY_EVENT_MOVETO 1
+#define PY_EVENT_SLEEP 2
+#define PY_EVENT_ENABLE_MOTOR 3
+#define PY_EVENT_DISABLE_MOTOR 4
+#define PY_EVENT_PAUSE 5
+#define PY_EVENT_HOME 6
+#define PY_EVENT_HEATER_TEMPERATURE 7
+#define PY_EVENT_FAN_SPEED 8
+#define PY_EVENT_PWM 9
+
 namespace FLUX {
+    // One buffered event. Moves use all columns; other events keep their
+    // float argument in `x` and their bool argument (wait,
+    // to_standby_position) in `flags`.
+    struct PythonToolpathEvent {
+        uint8_t opcode;
+        uint8_t flags;
+        uint16_t reserved;
+        float feedrate;
+        float x, y, z;
+        float e0, e1, e2;
+    };
+
     class PythonToolpathProcessor: FLUX::ToolpathProcessor {
+    protected:
+        // Buffered mode: events are packed into `chunk` (a bytearray owned by
+        // python once delivered) and passed to chunk_callback every
+        // chunk_size events
+        PyObject *chunk_callback;
+        PyObject *chunk;
+        size_t chunk_size;
+        size_t chunk_used;
+
+        PythonToolpathEvent* next_event(uint8_t opcode);
     public:
         PyObject *callback;
         PythonToolpathProcessor(PyObject *python_callback);
+        PythonToolpathProcessor(PyObject *python_callback, PyObject *python_chunk_callback, size_t events_per_chunk);
+        ~PythonToolpathProcessor(void);
+
+        // Deliver buffered events now
+        void flush(void);
 
         virtual void moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2);
+        virtual void moveto_batch(const FLUX::MoveBatch* batch);
         virtual void sleep(float milliseconds);
         virtual void enable_motor(void);
         virtual void disable_motor(void);
@@ -26,4 +68,28 @@ namespace FLUX {
         virtual void terminated(void);
     };
 
-}
\ No newline at end of file
+    // std::streambuf passing data to write() of a python file like object in
+    // blocks. Must be used with the GIL held; a python exception makes the
+    // stream fail and is left set.
+    class PythonWriteBuffer : public std::streambuf {
+    protected:
+        PyObject *write_method;
+        char buffer[65536];
+        bool send(const char* data, size_t size);
+        virtual int overflow(int c);
+        virtual int sync(void);
+        virtual std::streamsize xsputn(const char* data, std::streamsize size);
+    public:
+        PythonWriteBuffer(PyObject *file);
+        ~PythonWriteBuffer(void);
+    };
+
+    class PythonOutputStream : public std::ostream {
+    protected:
+        PythonWriteBuffer buffer;
+    public:
+        PythonOutputStream(PyObject *file) : std::ostream(NULL), buffer(file) {
+            rdbuf(&buffer);
+        }
+    };
+}
@@ -0,0 +1,223 @@
+#include <math.h>
+#include <string.h>
+#include "simplify_processor.h"
+
+// Encoded size of a FCode V1 move command
+static inline size_t move_size(int flags) {
+    size_t size = 1;
+    for(int f=flags & 127;f;f&=f-1) size += 4;
+    return size;
+}
+
+FLUX::SimplifyProcessor::SimplifyProcessor(FLUX::ToolpathProcessor* target_processor, float tolerance) {
+    target = target_processor;
+    chord_tolerance = tolerance;
+    removed_commands = 0;
+    removed_bytes = 0;
+
+    for(int i=0;i<6;i++) {
+        current[i] = emitted[i] = 0;
+        known[i] = emitted_known[i] = false;
+    }
+    current_feedrate = emitted_feedrate = 0;
+    pwm = fan_speed = 0;
+    has_pwm = has_fan_speed = false;
+
+    pending = false;
+    pending_feedrate = 0;
+    pending_e_mask = 0;
+    merged_size = 0;
+}
+
+bool FLUX::SimplifyProcessor::can_merge(const float* next, int e_mask) {
+    if(!pending || merged_size == SIMPLIFY_MERGE_MAX) return false;
+    if(e_mask != pending_e_mask || current_feedrate != pending_feedrate) return false;
+    for(int i=0;i<3;i++) {
+        if(!emitted_known[i] || !known[i]) return false;
+    }
+    for(int i=3;i<6;i++) {
+        if((e_mask & (32 >> i)) && !emitted_known[i]) return false;
+    }
+
+    // Chord from the start of the pending segment to the new end point
+    float dx = next[0] - emitted[0], dy = next[1] - emitted[1], dz = next[2] - emitted[2];
+    float length2 = dx * dx + dy * dy + dz * dz;
+    if(!(length2 > 0)) return false;
+
+    float tolerance2 = chord_tolerance * chord_tolerance;
+    float last_t = 0;
+    for(size_t n=0;n<=merged_size;n++) {
+        const float* point = (n < merged_size) ? merged[n] : current;
+        float px = point[0] - emitted[0], py = point[1] - emitted[1], pz = point[2] - emitted[2];
+        float t = (px * dx + py * dy + pz * dz) / length2;
+        // Points must advance along the chord
+        if(t < last_t || t > 1) return false;
+        last_t = t;
+
+        float ox = px - t * dx, oy = py - t * dy, oz = pz - t * dz;
+        if(ox * ox + oy * oy + oz * oz > tolerance2) return false;
+
+        // Extrusion must stay proportional to travel
+        for(int i=3;i<6;i++) {
+            if(!(e_mask & (32 >> i))) continue;
+            float delta = next[i] - emitted[i];
+            float expected = emitted[i] + t * delta;
+            if(fabsf(point[i] - expected) > fabsf(delta) * 0.01f + 1e-5f) return false;
+        }
+    }
+    return true;
+}
+
+void FLUX::SimplifyProcessor::emit_pending(void) {
+    if(!pending) return;
+    pending = false;
+
+    int flags = 0;
+    for(int i=0;i<6;i++) {
+        if(known[i] && (!emitted_known[i] || emitted[i] != current[i])) {
+            flags |= 32 >> i;
+            emitted[i] = current[i];
+            emitted_known[i] = true;
+        }
+    }
+    if(pending_feedrate > 0 && pending_feedrate != emitted_feedrate) {
+        flags |= FLAG_HAS_FEEDRATE;
+        emitted_feedrate = pending_feedrate;
+    }
+    removed_bytes -= move_size(flags);
+
+    if(batch.append(flags, pending_feedrate, current[0], current[1], current[2],
+                    current[3], current[4], current[5])) {
+        target->moveto_batch(&batch);
+        batch.size = 0;
+    }
+}
+
+void FLUX::SimplifyProcessor::flush(void) {
+    emit_pending();
+    if(batch.size) {
+        target->moveto_batch(&batch);
+        batch.size = 0;
+    }
+}
+
+void FLUX::SimplifyProcessor::moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
+    float next[6];
+    float values[6] = {x, y, z, e0, e1, e2};
+    bool changed = false;
+    int e_mask = 0;
+
+    // Counted as removed until it is emitted, see emit_pending
+    removed_bytes += move_size(flags);
+
+    if(flags & FLAG_HAS_FEEDRATE) current_feedrate = feedrate;
+    for(int i=0;i<6;i++) {
+        if((flags & (32 >> i)) && (!known[i] || current[i] != values[i])) {
+            next[i] = values[i];
+            changed = true;
+            if(i >= 3) e_mask |= 32 >> i;
+        } else {
+            next[i] = current[i];
+        }
+    }
+
+    if(!changed) {
+        // Zero length or feedrate only, feedrate is applied to next move
+        removed_commands++;
+        return;
+    }
+
+    if(can_merge(next, e_mask)) {
+        memcpy(merged[merged_size++], current, sizeof(current));
+        removed_commands++;
+    } else {
+        emit_pending();
+        pending = true;
+        pending_feedrate = current_feedrate;
+        pending_e_mask = e_mask;
+        merged_size = 0;
+    }
+
+    memcpy(current, next, sizeof(current));
+    for(int i=0;i<6;i++) {
+        if(flags & (32 >> i)) known[i] = true;
+    }
+}
+
+void FLUX::SimplifyProcessor::sleep(float seconds) {
+    flush();
+    target->sleep(seconds);
+}
+
+void FLUX::SimplifyProcessor::enable_motor(void) {
+    flush();
+    target->enable_motor();
+}
+
+void FLUX::SimplifyProcessor::disable_motor(void) {
+    flush();
+    target->disable_motor();
+}
+
+void FLUX::SimplifyProcessor::pause(bool to_standby_position) {
+    flush();
+    target->pause(to_standby_position);
+}
+
+void FLUX::SimplifyProcessor::home(void) {
+    flush();
+    // Home position is decided by target
+    for(int i=0;i<3;i++) {
+        known[i] = emitted_known[i] = false;
+    }
+    target->home();
+}
+
+void FLUX::SimplifyProcessor::set_toolhead_heater_temperature(float temperature, bool wait) {
+    flush();
+    target->set_toolhead_heater_temperature(temperature, wait);
+}
+
+void FLUX::SimplifyProcessor::set_toolhead_fan_speed(float strength) {
+    if(has_fan_speed && fan_speed == strength) {
+        removed_commands++;
+        removed_bytes += 5;
+        return;
+    }
+    flush();
+    fan_speed = strength;
+    has_fan_speed = true;
+    target->set_toolhead_fan_speed(strength);
+}
+
+void FLUX::SimplifyProcessor::set_toolhead_pwm(float strength) {
+    if(has_pwm && pwm == strength) {
+        removed_commands++;
+        removed_bytes += 5;
+        return;
+    }
+    flush();
+    pwm = strength;
+    has_pwm = true;
+    target->set_toolhead_pwm(strength);
+}
+
+void FLUX::SimplifyProcessor::append_anchor(uint32_t value) {
+    flush();
+    target->append_anchor(value);
+}
+
+void FLUX::SimplifyProcessor::append_comment(const char* message, size_t length) {
+    flush();
+    target->append_comment(message, length);
+}
+
+void FLUX::SimplifyProcessor::on_error(bool critical, const char* message, size_t length) {
+    flush();
+    target->on_error(critical, message, length);
+}
+
+void FLUX::SimplifyProcessor::terminated(void) {
+    flush();
+    target->terminated();
+}
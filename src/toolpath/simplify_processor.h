@@ -0,0 +1,76 @@
+
+#ifndef _SIMPLIFY_PROCESSOR_H
+#define _SIMPLIFY_PROCESSOR_H
+
+#include "toolpath.h"
+
+// Longest run of moves merged into one
+#define SIMPLIFY_MERGE_MAX 64
+
+
+namespace FLUX {
+    // Pass-through stage removing commands which do not change the result:
+    //   * zero length moves and feedrate only moves (feedrate is carried to
+    //     the next move)
+    //   * runs of collinear moves with the same feedrate and extrusion ratio,
+    //     merged while every point stays within chord_tolerance (mm) of the
+    //     merged segment
+    //   * axis, E and F words repeating the current value
+    //   * set_toolhead_pwm/set_toolhead_fan_speed repeating the current value
+    // removed_commands and removed_bytes count what was dropped, bytes are
+    // measured in FCode V1 encoding.
+    class SimplifyProcessor : public FLUX::ToolpathProcessor {
+    protected:
+        FLUX::ToolpathProcessor* target;
+        FLUX::MoveBatch batch;
+
+        // Index 0-2: X Y Z, 3-5: E0 E1 E2
+        float current[6];
+        bool known[6];
+        float current_feedrate;
+
+        // State of target after all emitted moves
+        float emitted[6];
+        bool emitted_known[6];
+        float emitted_feedrate;
+        float pwm, fan_speed;
+        bool has_pwm, has_fan_speed;
+
+        // Pending (not yet emitted) merged segment, from emitted[] to
+        // current[], and the intermediate points it replaces
+        bool pending;
+        float pending_feedrate;
+        int pending_e_mask;
+        size_t merged_size;
+        float merged[SIMPLIFY_MERGE_MAX][6];
+
+        bool can_merge(const float* next, int e_mask);
+        void emit_pending(void);
+        void flush(void);
+    public:
+        float chord_tolerance;
+        size_t removed_commands;
+        size_t removed_bytes;
+
+        SimplifyProcessor(FLUX::ToolpathProcessor* target_processor, float tolerance);
+
+        virtual void moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2);
+        virtual void sleep(float seconds);
+        virtual void enable_motor(void);
+        virtual void disable_motor(void);
+        virtual void pause(bool to_standby_position);
+        virtual void home(void);
+        virtual void set_toolhead_heater_temperature(float temperature, bool wait);
+        virtual void set_toolhead_fan_speed(float strength);
+        virtual void set_toolhead_pwm(float strength);
+
+        virtual void append_anchor(uint32_t value);
+        virtual void append_comment(const char* message, size_t length);
+
+        virtual void on_error(bool critical, const char* message, size_t length);
+
+        virtual void terminated(void);
+    };
+}
+
+#endif
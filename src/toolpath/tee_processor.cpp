@@ -0,0 +1,85 @@
+#include "tee_processor.h"
+
+void FLUX::TeeProcessor::moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) {
+    for(auto it=targets.begin();it!=targets.end();++it) {
+        (*it)->moveto(flags, feedrate, x, y, z, e0, e1, e2);
+    }
+}
+
+void FLUX::TeeProcessor::moveto_batch(const FLUX::MoveBatch* batch) {
+    for(auto it=targets.begin();it!=targets.end();++it) {
+        (*it)->moveto_batch(batch);
+    }
+}
+
+void FLUX::TeeProcessor::sleep(float seconds) {
+    for(auto it=targets.begin();it!=targets.end();++it) {
+        (*it)->sleep(seconds);
+    }
+}
+
+void FLUX::TeeProcessor::enable_motor(void) {
+    for(auto it=targets.begin();it!=targets.end();++it) {
+        (*it)->enable_motor();
+    }
+}
+
+void FLUX::TeeProcessor::disable_motor(void) {
+    for(auto it=targets.begin();it!=targets.end();++it) {
+        (*it)->disable_motor();
+    }
+}
+
+void FLUX::TeeProcessor::pause(bool to_standby_position) {
+    for(auto it=targets.begin();it!=targets.end();++it) {
+        (*it)->pause(to_standby_position);
+    }
+}
+
+void FLUX::TeeProcessor::home(void) {
+    for(auto it=targets.begin();it!=targets.end();++it) {
+        (*it)->home();
+    }
+}
+
+void FLUX::TeeProcessor::set_toolhead_heater_temperature(float temperature, bool wait) {
+    for(auto it=targets.begin();it!=targets.end();++it) {
+        (*it)->set_toolhead_heater_temperature(temperature, wait);
+    }
+}
+
+void FLUX::TeeProcessor::set_toolhead_fan_speed(float strength) {
+    for(auto it=targets.begin();it!=targets.end();++it) {
+        (*it)->set_toolhead_fan_speed(strength);
+    }
+}
+
+void FLUX::TeeProcessor::set_toolhead_pwm(float strength) {
+    for(auto it=targets.begin();it!=targets.end();++it) {
+        (*it)->set_toolhead_pwm(strength);
+    }
+}
+
+void FLUX::TeeProcessor::append_anchor(uint32_t value) {
+    for(auto it=targets.begin();it!=targets.end();++it) {
+        (*it)->append_anchor(value);
+    }
+}
+
+void FLUX::TeeProcessor::append_comment(const char* message, size_t length) {
+    for(auto it=targets.begin();it!=targets.end();++it) {
+        (*it)->append_comment(message, length);
+    }
+}
+
+void FLUX::TeeProcessor::on_error(bool critical, const char* message, size_t length) {
+    for(auto it=targets.begin();it!=targets.end();++it) {
+        (*it)->on_error(critical, message, length);
+    }
+}
+
+void FLUX::TeeProcessor::terminated(void) {
+    for(auto it=targets.begin();it!=targets.end();++it) {
+        (*it)->terminated();
+    }
+}
@@ -0,0 +1,39 @@
+
+#ifndef _TEE_PROCESSOR_H
+#define _TEE_PROCESSOR_H
+
+#include <vector>
+#include "toolpath.h"
+
+
+namespace FLUX {
+    // Forward every event to each target in the order they were added, so
+    // one parse can feed several writers and collectors.
+    class TeeProcessor : public FLUX::ToolpathProcessor {
+    public:
+        std::vector<FLUX::ToolpathProcessor*> targets;
+
+        TeeProcessor(void) {}
+        void add_target(FLUX::ToolpathProcessor* target) { targets.push_back(target); }
+
+        virtual void moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2);
+        virtual void moveto_batch(const FLUX::MoveBatch* batch);
+        virtual void sleep(float seconds);
+        virtual void enable_motor(void);
+        virtual void disable_motor(void);
+        virtual void pause(bool to_standby_position);
+        virtual void home(void);
+        virtual void set_toolhead_heater_temperature(float temperature, bool wait);
+        virtual void set_toolhead_fan_speed(float strength);
+        virtual void set_toolhead_pwm(float strength);
+
+        virtual void append_anchor(uint32_t value);
+        virtual void append_comment(const char* message, size_t length);
+
+        virtual void on_error(bool critical, const char* message, size_t length);
+
+        virtual void terminated(void);
+    };
+}
+
+#endif
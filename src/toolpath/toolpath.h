@@ -2,6 +2,7 @@
 #ifndef _TOOLPATH_H
 #define _TOOLPATH_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define FLAG_HAS_FEEDRATE 64
@@ -11,11 +12,47 @@
 #define FLAG_HAS_AXIS(A) ( 1 << (5 - A + 'X')) 
 #define FLAG_HAS_E(T) (1 << (2 - T))
 
+#define MOVE_BATCH_CAPACITY 256
+
 
 namespace FLUX {
+    // Structure-of-arrays block of moves, the i-th move is
+    // moveto(flags[i], feedrate[i], x[i], y[i], z[i], e0[i], e1[i], e2[i]).
+    struct MoveBatch {
+        size_t size;
+        uint8_t flags[MOVE_BATCH_CAPACITY];
+        float feedrate[MOVE_BATCH_CAPACITY];
+        float x[MOVE_BATCH_CAPACITY];
+        float y[MOVE_BATCH_CAPACITY];
+        float z[MOVE_BATCH_CAPACITY];
+        float e0[MOVE_BATCH_CAPACITY];
+        float e1[MOVE_BATCH_CAPACITY];
+        float e2[MOVE_BATCH_CAPACITY];
+
+        MoveBatch(void) { size = 0; }
+
+        // Return true if the batch is full after appending.
+        inline bool append(int f, float feed, float mx, float my, float mz, float me0, float me1, float me2) {
+            flags[size] = f; feedrate[size] = feed;
+            x[size] = mx; y[size] = my; z[size] = mz;
+            e0[size] = me0; e1[size] = me1; e2[size] = me2;
+            return ++size == MOVE_BATCH_CAPACITY;
+        }
+    };
+
     class ToolpathProcessor {
     public:
+        virtual ~ToolpathProcessor(void) {}
+
         virtual void moveto(int flags, float feedrate, float x, float y, float z, float e0, float e1, float e2) = 0;
+        // Deliver a block of consecutive moves. Processors which do not
+        // implement it natively receive them one by one through moveto.
+        virtual void moveto_batch(const MoveBatch* batch) {
+            for(size_t i=0;i<batch->size;i++) {
+                moveto(batch->flags[i], batch->feedrate[i], batch->x[i], batch->y[i], batch->z[i],
+                       batch->e0[i], batch->e1[i], batch->e2[i]);
+            }
+        }
         virtual void sleep(float seconds) = 0;
         virtual void enable_motor(void) = 0;
         virtual void disable_motor(void) = 0;
@@ -6,6 +6,9 @@
 #include "float.h"
 #include "math.h"
 #include "g2f_module.h"
+#include "../toolpath/number_parser.h"
+#include "../toolpath/mapped_file.h"
+#include "../toolpath/crc32.h"
 
 float FLT_SAFE = -(FLT_MAX/10);
 #define quick_abs(x) (x>0?x:-x)
@@ -13,45 +16,109 @@ float FLT_SAFE = -(FLT_MAX/10);
 float MAX_HEIGHT = 230;
 
 
-float atof_with_char_ptr(char *s, char** sptr) {
-  bool neg = false;
-  float a = 0.0;
-  int e = 0;
-  int c;
-  if (*s == '-') {
-    neg = true;
-    s++;
-  }
-  while ((c = *s++) != '\0' && isdigit(c)) {
-    a = a*10.0 + (c - '0');
-  }
-  if (c == '.') {
-    while ((c = *s++) != '\0' && isdigit(c)) {
-      a = a*10.0 + (c - '0');
-      e = e-1;
+float atof_with_char_ptr(char *s, const char* end, char** sptr) {
+  float a;
+  *sptr = (char*)FLUX::parse_decimal(s, end, &a);
+  return a;
+}
+
+// Comment of a gcode line, points into the line. ptr is NULL if the line has
+// no comment.
+typedef struct {
+  const char* ptr;
+  size_t size;
+} CommentView;
+
+// Path type tags written in slic3r and cura comments
+typedef enum {
+  TAG_INFILL,
+  TAG_SUPPORT,
+  TAG_BRIM,
+  TAG_MOVE,
+  TAG_TO_NEXT_LAYER,
+  TAG_PERIMETER,
+  TAG_SKIRT,
+  TAG_DRAW,
+  TAG_CURA_FILL,
+  TAG_CURA_SUPPORT,
+  TAG_CURA_LAYER,
+  TAG_CURA_WALL_OUTER,
+  TAG_CURA_WALL_INNER,
+  TAG_CURA_RAFT,
+  TAG_CURA_SKIRT,
+  TAG_CURA_SKIN,
+  TAG_COUNT
+} CommentTag;
+
+#define HAS_TAG(tags, tag) ((tags) & (1u << (tag)))
+
+static const char* comment_tags[TAG_COUNT] = {
+  "infill", "support", "brim", "move", "to next layer", "perimeter", "skirt", "draw",
+  "FILL", "SUPPORT", "LAYER", "WALL-OUTER", "WALL-INNER", "RAFT", "SKIRT", "SKIN"
+};
+
+// Aho-Corasick automaton over comment_tags, finds every tag contained in a
+// comment in a single pass. One state per tag prefix, so 16 bit states hold
+// up to 65535 tag characters.
+class CommentTagMatcher {
+  vector<uint16_t> next;  // state * 256 + char -> state
+  vector<uint32_t> found;  // tags ending at state
+public:
+  CommentTagMatcher() {
+    vector<int> trie(256, -1);
+    found.push_back(0);
+    for (int t = 0; t < TAG_COUNT; t++) {
+      int state = 0;
+      for (const char* c = comment_tags[t]; *c; c++) {
+        int& child = trie[state * 256 + (unsigned char)*c];
+        if (child < 0) {
+          child = found.size();
+          found.push_back(0);
+          trie.resize(trie.size() + 256, -1);
+        }
+        state = child;
+      }
+      found[state] |= 1u << t;
+    }
+
+    // Breadth first, fill missing transitions from the failure state
+    next.resize(trie.size());
+    vector<int> fail(found.size(), 0);
+    vector<int> queue;
+    for (int c = 0; c < 256; c++) {
+      int child = trie[c];
+      next[c] = child < 0 ? 0 : child;
+      if (child > 0) queue.push_back(child);
+    }
+    for (size_t i = 0; i < queue.size(); i++) {
+      int state = queue[i];
+      found[state] |= found[fail[state]];
+      for (int c = 0; c < 256; c++) {
+        int child = trie[state * 256 + c];
+        if (child < 0) {
+          next[state * 256 + c] = next[fail[state] * 256 + c];
+        } else {
+          fail[child] = next[fail[state] * 256 + c];
+          next[state * 256 + c] = child;
+          queue.push_back(child);
+        }
+      }
     }
   }
-  
-  while (e > 0) {
-    a *= 10.0;
-    e--;
-  }
-  while (e < 0) {
-    a *= 0.1;
-    e++;
+
+  uint32_t match(CommentView comment) const {
+    uint32_t tags = 0;
+    unsigned state = 0;
+    const unsigned char* ptr = (const unsigned char*)comment.ptr;
+    for (size_t i = 0; i < comment.size; i++) {
+      state = next[state * 256 + ptr[i]];
+      tags |= found[state];
+    }
+    return tags;
   }
+};
 
-  *sptr = s - 1;
-  return neg ? -a : a;
-}
-
-char* substr(const char* str, int start) {
-  int len = strlen(str);
-  char* newstr = (char*)malloc(len - start + 1); 
-  strncpy(newstr, &str[start], len-start);
-  newstr[len - start] = '\0';
-  return newstr;
-}
+static const CommentTagMatcher comment_tag_matcher;
 
 void write_char(char** dest, char n) {
   strncpy(*dest, (char*)&n, 1);
@@ -79,12 +146,12 @@ struct token_result{
 
 typedef struct token_result TokenResult;
 
-TokenResult find_next_token(char** ptr) {
+TokenResult find_next_token(char** ptr, const char* end) {
   TokenResult result;
   result.ch = '?';
   result.valid = 0;
   
-  while(true) {
+  while(*ptr < end) {
     switch(**ptr) {
       case 0:
         return result;
@@ -102,7 +169,7 @@ TokenResult find_next_token(char** ptr) {
       case 'S':
       case 'P':
         result.ch = **ptr;
-        result.f = atof_with_char_ptr((*ptr)+1, ptr);
+        result.f = atof_with_char_ptr((*ptr)+1, end, ptr);
         result.valid = 1;
         //printf("Found Char %c, Num %lf\n", tkr.ch, tkr.f);
         return result;
@@ -142,20 +209,18 @@ FCode* createFCodePtr() {
   fillZero(fc->current_pos,7);
 
   fc->HEAD_TYPE = NULL;
+  fc->printing_temperature = 0;
+  fc->highlight_layer = -1;
 
   fc->is_cura = 1;
 
   fc->record_path = 1;
   fc->layer_now = 0;
 
-  fc->native_path = new vector< vector<PathVector> >();
+  fc->native_path = new PreviewPath();
   fc->pause_at_layers = new vector<int>();
 
-  PathVector p = {0, 0, MAX_HEIGHT, TYPE_MOVE};
-  vector<PathVector> first_layer;
-  first_layer.push_back(p);
-
-  fc->native_path->push_back(first_layer);
+  fc->native_path->append(0, 0, MAX_HEIGHT, TYPE_MOVE);
 
   fc->counter_between_layers = 0;
   fc->record_z = 0;
@@ -165,7 +230,13 @@ FCode* createFCodePtr() {
   return fc;
 }
 
-int XYZEF(char* str, FCode* fc, float *num) {
+void freeFCodePtr(FCode* fc) {
+  delete fc->native_path;
+  delete fc->pause_at_layers;
+  free(fc);
+}
+
+int XYZEF(char* str, const char* end, FCode* fc, float *num) {
     // """
     // Parses data into a list: [F, X, Y, Z, E1, E2, E3]
     // and forms the proper command
@@ -175,7 +246,7 @@ int XYZEF(char* str, FCode* fc, float *num) {
     int command = 0;
 
     while(true) {
-      TokenResult token = find_next_token(&str);
+      TokenResult token = find_next_token(&str, end);
       if (!token.valid) break;
       switch(token.ch) {
         case 'F':
@@ -208,11 +279,11 @@ int XYZEF(char* str, FCode* fc, float *num) {
 
 
 
-void process_path(FCode* fc, char* comment, bool move_flag, bool extrude_flag) {
+void process_path(FCode* fc, CommentView comment, bool move_flag, bool extrude_flag) {
   // """
   // convert to path list(for visualizing)
   // """
-  if (fc->is_cura || comment == NULL) {
+  if (fc->is_cura || comment.ptr == NULL) {
     // Cura
     fc->counter_between_layers++;
     PathType line_type = TYPE_MOVE;
@@ -220,13 +291,8 @@ void process_path(FCode* fc, char* comment, bool move_flag, bool extrude_flag) {
         fc->path_type = TYPE_MOVE;
         fc->record_z = fc->current_pos[3];
         fc->counter_between_layers = 0;
-        fc->layer_now = fc->native_path->size();
-
-        vector<PathVector> new_layer;
-        PathVector p = fc->native_path->back().back();
-        p.path_type = fc->path_type;
-        new_layer.push_back(p);
-        fc->native_path->push_back(new_layer);
+        fc->native_path->new_layer(fc->path_type);
+        fc->layer_now = fc->native_path->layer_count() - 1;
     }
     if (move_flag) {
         if (extrude_flag) {
@@ -241,8 +307,7 @@ void process_path(FCode* fc, char* comment, bool move_flag, bool extrude_flag) {
         if (line_type == TYPE_PERIMETER && fc->highlight_layer == fc->layer_now) { 
           line_type = TYPE_HIGHLIGHT;
         }
-        PathVector p = {fc->current_pos[1], fc->current_pos[2], fc->current_pos[3], line_type};
-        fc->native_path->back().push_back(p);
+        fc->native_path->append(fc->current_pos[1], fc->current_pos[2], fc->current_pos[3], line_type);
     }
   } else {
     bool splitted = false;
@@ -250,32 +315,28 @@ void process_path(FCode* fc, char* comment, bool move_flag, bool extrude_flag) {
     PathType line_type = TYPE_MOVE;
 
     if (move_flag) {
-        if (strstr(comment, "infill")) {
+        uint32_t tags = comment_tag_matcher.match(comment);
+        if (HAS_TAG(tags, TAG_INFILL)) {
             line_type = TYPE_INFILL;
-        } else if(strstr(comment, "support")) {
+        } else if(HAS_TAG(tags, TAG_SUPPORT)) {
             line_type = TYPE_SUPPORT;
-        } else if(strstr(comment,"brim")) {
+        } else if(HAS_TAG(tags, TAG_BRIM)) {
             line_type = TYPE_SUPPORT;
-        } else if(strstr(comment,"move")) {
+        } else if(HAS_TAG(tags, TAG_MOVE)) {
             line_type = TYPE_MOVE;
-            if(strstr(comment,"to next layer")){
+            if(HAS_TAG(tags, TAG_TO_NEXT_LAYER)){
                 fc->record_z = fc->current_pos[3];
                 splitted = true;
 
                 fc->counter_between_layers = 0;
-                fc->layer_now = fc->native_path->size();
-
-                vector<PathVector> new_layer;
-                PathVector p = fc->native_path->back().back();
-                p.path_type = fc->path_type;
-                new_layer.push_back(p);
-                fc->native_path->push_back(new_layer);
+                fc->native_path->new_layer(fc->path_type);
+                fc->layer_now = fc->native_path->layer_count() - 1;
             }
-        } else if(strstr(comment,"perimeter")) {
+        } else if(HAS_TAG(tags, TAG_PERIMETER)) {
             line_type = TYPE_PERIMETER;
-        } else if(strstr(comment,"skirt")) {
+        } else if(HAS_TAG(tags, TAG_SKIRT)) {
             line_type = TYPE_SKIRT;
-        } else if(strstr(comment,"draw")) {
+        } else if(HAS_TAG(tags, TAG_DRAW)) {
             line_type = TYPE_INFILL;
         }else {
             line_type = extrude_flag ? TYPE_PERIMETER : TYPE_MOVE;
@@ -284,26 +345,21 @@ void process_path(FCode* fc, char* comment, bool move_flag, bool extrude_flag) {
         if (line_type == TYPE_PERIMETER && fc->highlight_layer == fc->layer_now) { 
           line_type = TYPE_HIGHLIGHT;
         }
-        PathVector p = {fc->current_pos[1], fc->current_pos[2], fc->current_pos[3], line_type};
-        fc->native_path->back().push_back(p);
+        fc->native_path->append(fc->current_pos[1], fc->current_pos[2], fc->current_pos[3], line_type);
         
-        if (strlen(comment) == 0 && !splitted && fc->current_pos[3] - fc->record_z > 0.3) {
+        if (comment.size == 0 && !splitted && fc->current_pos[3] - fc->record_z > 0.3) {
           // 0.3 is the max layer height in fluxstudio
-          vector<PathVector> new_layer;
-          PathVector p = fc->native_path->back().back();
-          p.path_type = fc->path_type;
-          new_layer.push_back(p);
-          fc->native_path->push_back(new_layer);
+          fc->native_path->new_layer(fc->path_type);
 
           fc->record_z = fc->current_pos[3];
           fc->counter_between_layers = 0;
-          fc->layer_now = fc->native_path->size();
+          fc->layer_now = fc->native_path->layer_count();
       }
     }
   }
 }
 
-void analyze_metadata(float* data, char* comment, FCode* fc) {
+void analyze_metadata(float* data, CommentView comment, FCode* fc) {
   //  """
   // input_list: [F, X, Y, Z, E1, E2, E3]
   // compute filament need for each extruder
@@ -365,24 +421,30 @@ int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output) {
   // printf("Tool %d\n", fc->tool);
   char* output_ptr = fcode_output;
 
-  char* comment_ptr = strchr(line, ';');
-  char* comment = NULL;
+  size_t line_size = strlen(line);
+  char* comment_ptr = (char*)memchr(line, ';', line_size);
+  CommentView comment = {NULL, 0};
   //TODO: Fix comment list
   //Parse comments
+  char no_command[] = "000";
   if (line[0] == ':') {
-    comment = substr(line, 1);
+    comment.ptr = line + 1;
+    comment.size = line_size - 1;
     //comment_list.push(comment);
-    strcpy(line, "000");
+    line = no_command;
+    line_size = 3;
   } else if (comment_ptr!=NULL) {
-    comment = substr(comment_ptr+1, 0);
+    comment.ptr = comment_ptr + 1;
+    comment.size = line + line_size - comment.ptr;
     //comment_list.push(comment);
   }
 
-  if (strlen(line) == 0) return 0;
+  if (line_size == 0) return 0;
 
   char* cmd = line;
+  const char* line_end = line + line_size;
 
-  TokenResult parsed_command = find_next_token(&cmd);
+  TokenResult parsed_command = find_next_token(&cmd, line_end);
 
   //Command parse
   char cmd_type = parsed_command.ch;
@@ -401,7 +463,7 @@ int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output) {
     switch(cmd_no) {
       case 0:
       case 1:
-        subcommand = XYZEF(cmd, fc, data);
+        subcommand = XYZEF(cmd, line_end, fc, data);
         //data: [F, X, Y, Z, E1, E2, E3]
 
         // TODO fix g92 offset ? to be tested
@@ -446,10 +508,10 @@ int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output) {
         break;
       case 4: //Pause for a while
         write_char(&output_ptr, 4);
-        token = find_next_token(&cmd);
+        token = find_next_token(&cmd, line_end);
         if (token.valid) {
           float ms = (token.ch == 'S') ? token.f * 1000 : token.f;
-          token = find_next_token(&cmd);
+          token = find_next_token(&cmd, line_end);
           if (ms < 0) {
             ms = 0;
           }
@@ -477,7 +539,7 @@ int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output) {
         write_char(&output_ptr, 3);
         break;
       case 92: //Set Position
-        subcommand = XYZEF(cmd, fc, data);
+        subcommand = XYZEF(cmd, line_end, fc, data);
         if (subcommand == 0) {
           for (int i = 0; i < 7; i++) {
             fc->G92_delta[i] = 0.0;
@@ -508,7 +570,7 @@ int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output) {
         command_code = 16;
         if (cmd_no == 109) command_code |= (1 << 3);
         while(true) {
-          token = find_next_token(&cmd);
+          token = find_next_token(&cmd, line_end);
           if (!token.valid) break;
           if (token.ch == 'S') {
             temperature = token.f;
@@ -532,7 +594,7 @@ int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output) {
         if (cmd_no == 107) {
           write_float(&output_ptr, 0.0);
         } else if (cmd_no == 106) {
-            token = find_next_token(&cmd);
+            token = find_next_token(&cmd, line_end);
             if (token.valid) {
               write_float(&output_ptr, token.f / 255.0);
             } else {
@@ -549,7 +611,7 @@ int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output) {
     switch(cmd_no) {
       case 2:
         write_char(&output_ptr, 32);
-        token = find_next_token(&cmd);
+        token = find_next_token(&cmd, line_end);
         float strength = (token.ch == 'O') ? token.f/255 : 0;
         write_float(&output_ptr, strength);
         fc->HEAD_TYPE = "LASER";
@@ -564,24 +626,23 @@ int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output) {
         fc->tool = 1;
         break;
     }
-  } else if (comment!=NULL) {
-    char* cura_comment = comment;
-    if (strlen(cura_comment)>6) cura_comment = cura_comment + 6; 
-    if (strstr(comment, "FILL") != NULL) {
+  } else if (comment.ptr!=NULL) {
+    uint32_t tags = comment_tag_matcher.match(comment);
+    if (HAS_TAG(tags, TAG_CURA_FILL)) {
         fc->path_type = TYPE_INFILL;
-    } else if (strstr(comment, "SUPPORT") != NULL) {
+    } else if (HAS_TAG(tags, TAG_CURA_SUPPORT)) {
         fc->path_type = TYPE_SUPPORT;
-    } else if (strstr(comment, "LAYER") != NULL) {
+    } else if (HAS_TAG(tags, TAG_CURA_LAYER)) {
         fc->path_type = TYPE_NEWLAYER;
-    } else if (strstr(comment, "WALL-OUTER") != NULL) {
+    } else if (HAS_TAG(tags, TAG_CURA_WALL_OUTER)) {
         fc->path_type = TYPE_PERIMETER;
-    } else if (strstr(comment, "WALL-INNER") != NULL) {
+    } else if (HAS_TAG(tags, TAG_CURA_WALL_INNER)) {
         fc->path_type = TYPE_INNERWALL;
-    } else if (strstr(comment, "RAFT") != NULL) {
+    } else if (HAS_TAG(tags, TAG_CURA_RAFT)) {
         fc->path_type = TYPE_RAFT;
-    } else if (strstr(comment, "SKIRT") != NULL) {
+    } else if (HAS_TAG(tags, TAG_CURA_SKIRT)) {
         fc->path_type = TYPE_SKIRT;
-    } else if (strstr(comment, "SKIN") != NULL) {
+    } else if (HAS_TAG(tags, TAG_CURA_SKIN)) {
         fc->path_type = TYPE_SKIN;
     } 
   }
@@ -590,11 +651,80 @@ int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output) {
   return (int)(output_ptr - fcode_output);
 }
 
+// Output staging size, flushed when less than one line output (same 2048
+// bytes as the per line api) is left
+#define G2F_STAGING_SIZE 65536
+#define G2F_LINE_OUTPUT_SIZE 2048
+
+static bool flush_staging(const char* staging, size_t size, FILE* output, vector<char>* buffer, uint32_t* crc) {
+  *crc = FLUX::crc32(*crc, staging, size);
+  if (output) {
+    return fwrite(staging, 1, size, output) == size;
+  }
+  buffer->insert(buffer->end(), staging, staging + size);
+  return true;
+}
+
+long convert_to_fcode_buffer(const char* gcode, size_t size, FCode* fc, FILE* output, vector<char>* buffer, uint32_t* crc) {
+  vector<char> staging(G2F_STAGING_SIZE);
+  vector<char> line(256);
+  size_t used = 0;
+  long script_length = 0;
+  const char* ptr = gcode;
+  const char* end = gcode + size;
+  *crc = 0;
+
+  while (ptr < end) {
+    // Lines end with \n, \r\n or \r, passed with a single \n like a text
+    // mode python stream
+    const char* eol = (const char*)memchr(ptr, '\n', end - ptr);
+    const char* line_end = eol ? eol : end;
+    const char* cr = (const char*)memchr(ptr, '\r', line_end - ptr);
+    const char* next;
+    bool has_newline;
+    if (cr) {
+      line_end = cr;
+      next = (cr + 1 < end && cr[1] == '\n') ? cr + 2 : cr + 1;
+      has_newline = true;
+    } else {
+      next = eol ? eol + 1 : end;
+      has_newline = eol != NULL;
+    }
+
+    // Copied to terminate the line with NUL
+    size_t length = line_end - ptr;
+    if (line.size() < length + 5) line.resize(length + 5);
+    memcpy(line.data(), ptr, length);
+    if (has_newline) line[length++] = '\n';
+    line[length] = 0;
+
+    fc->index = 12 + script_length + used;
+    used += convert_to_fcode_by_line(line.data(), fc, staging.data() + used);
+    if (used > G2F_STAGING_SIZE - G2F_LINE_OUTPUT_SIZE) {
+      if (!flush_staging(staging.data(), used, output, buffer, crc)) return -1;
+      script_length += used;
+      used = 0;
+    }
+    ptr = next;
+  }
+
+  if (used) {
+    if (!flush_staging(staging.data(), used, output, buffer, crc)) return -1;
+    script_length += used;
+  }
+  return script_length;
+}
+
+long convert_to_fcode_file(const char* gcode_path, FCode* fc, FILE* output, vector<char>* buffer, uint32_t* crc) {
+  FLUX::MappedFile infile(gcode_path);
+  return convert_to_fcode_buffer(infile.data(), infile.size(), fc, output, buffer, crc);
+}
+
 // PathVector createPathPoint(float x, float y, float z, PathType t) {
 
 // }
 
-void trim_ends_cpp(vector< vector< PathVector > >* path) {
+void trim_ends_cpp(PreviewPath* path) {
     // """
     // trim the moving(non-extruding) part in path's both end
     // """
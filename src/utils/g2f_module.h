@@ -1,6 +1,9 @@
+#include <stdio.h>
+#include <stdint.h>
 #include <vector>
 #include <string>
 #include "path_vector.h"
+#include "preview_path.h"
 
 using namespace std;
 
@@ -45,7 +48,7 @@ typedef struct{
   char* HEAD_TYPE;
   int layer_now;
   PathType path_type;
-  vector< vector<PathVector> >* native_path;
+  PreviewPath* native_path;
   vector<int>* pause_at_layers;
   int counter_between_layers;
   float record_z;
@@ -59,7 +62,14 @@ typedef struct{
 } FCode;
 
 FCode* createFCodePtr();
+void freeFCodePtr(FCode* fc);
 int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output);
-void trim_ends_cpp(vector< vector< PathVector > >* output);
+// Convert a whole gcode buffer into fcode script. Script is written to output
+// if it is not NULL, otherwise appended to buffer. Returns script length, or
+// -1 if writing output failed. Script crc32 is stored in crc.
+long convert_to_fcode_buffer(const char* gcode, size_t size, FCode* fc, FILE* output, vector<char>* buffer, uint32_t* crc);
+// Same as convert_to_fcode_buffer, gcode file is memory mapped
+long convert_to_fcode_file(const char* gcode_path, FCode* fc, FILE* output, vector<char>* buffer, uint32_t* crc);
+void trim_ends_cpp(PreviewPath* output);
 
 #endif
\ No newline at end of file
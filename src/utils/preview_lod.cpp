@@ -0,0 +1,133 @@
+#include <math.h>
+#include "preview_lod.h"
+
+
+PreviewPathLOD::PreviewPathLOD(const PreviewPath* source) {
+  path = source;
+  levels.resize(PREVIEW_LOD_LEVELS);
+}
+
+PreviewPathLOD::~PreviewPathLOD() {
+  for (size_t level = 0; level < levels.size(); level++) {
+    for (size_t layer = 0; layer < levels[level].size(); layer++) {
+      delete levels[level][layer];
+    }
+  }
+}
+
+size_t PreviewPathLOD::level_of(float tolerance) {
+  if (!(tolerance >= PREVIEW_LOD_BASE)) return 0;
+  int exponent;
+  frexp(tolerance / PREVIEW_LOD_BASE, &exponent);
+  // tolerance / base is in [2^(exponent - 1), 2^exponent)
+  return exponent < PREVIEW_LOD_LEVELS ? exponent : PREVIEW_LOD_LEVELS - 1;
+}
+
+static float distance_sq_to_segment(const PathVector& p, const PathVector& a, const PathVector& b) {
+  float dx = b.x - a.x, dy = b.y - a.y, dz = b.z - a.z;
+  float px = p.x - a.x, py = p.y - a.y, pz = p.z - a.z;
+  float length_sq = dx * dx + dy * dy + dz * dz;
+  if (length_sq > 0) {
+    float t = (px * dx + py * dy + pz * dz) / length_sq;
+    if (t > 1) t = 1;
+    if (t > 0) {
+      px -= t * dx;
+      py -= t * dy;
+      pz -= t * dz;
+    }
+  }
+  return px * px + py * py + pz * pz;
+}
+
+// Marks points of [first, last] to keep, first and last are kept by caller
+static void douglas_peucker(const std::vector<PathVector>& points, size_t first, size_t last,
+                            float tolerance_sq, std::vector<char>* keep) {
+  std::vector< std::pair<size_t, size_t> > stack;
+  stack.push_back(std::make_pair(first, last));
+  while (!stack.empty()) {
+    size_t a = stack.back().first, b = stack.back().second;
+    stack.pop_back();
+    float max_distance = tolerance_sq;
+    size_t farthest = 0;
+    for (size_t i = a + 1; i < b; i++) {
+      float distance = distance_sq_to_segment(points[i], points[a], points[b]);
+      if (distance > max_distance) {
+        max_distance = distance;
+        farthest = i;
+      }
+    }
+    if (farthest) {
+      (*keep)[farthest] = 1;
+      stack.push_back(std::make_pair(a, farthest));
+      stack.push_back(std::make_pair(farthest, b));
+    }
+  }
+}
+
+const PreviewPathLOD::LODLayer* PreviewPathLOD::simplify(size_t level, size_t layer, std::vector<PathVector>* scratch) {
+  std::vector<LODLayer*>& cache = levels[level];
+  if (cache.size() < path->layer_count()) cache.resize(path->layer_count(), NULL);
+  if (cache[layer]) return cache[layer];
+
+  size_t begin = path->layer_begin(layer), size = path->layer_end(layer) - begin;
+  PreviewPathReader reader(path, begin);
+  scratch->resize(size);
+  for (size_t i = 0; i < size; i++) (*scratch)[i] = reader.next();
+  const std::vector<PathVector>& points = *scratch;
+
+  // Type of point i is the type of the segment ending at it, a run of one
+  // type is the points [first, last] with types of first + 1 .. last equal
+  float tolerance = PREVIEW_LOD_BASE * ldexpf(1, (int)level - 1);
+  std::vector<char> keep(size, 0);
+  size_t first = 0;
+  for (size_t i = 1; i <= size; i++) {
+    if (i == size || (i > first + 1 && points[i].path_type != points[i - 1].path_type)) {
+      size_t last = i - 1;
+      keep[first] = keep[last] = 1;
+      if (last > first + 1) douglas_peucker(points, first, last, tolerance * tolerance, &keep);
+      first = last;
+    }
+  }
+
+  LODLayer* simplified = new LODLayer();
+  for (size_t i = 0; i < size; i++) {
+    if (!keep[i]) continue;
+    simplified->xyz.push_back(points[i].x);
+    simplified->xyz.push_back(points[i].y);
+    simplified->xyz.push_back(points[i].z);
+    simplified->types.push_back(points[i].path_type - 1);
+  }
+  cache[layer] = simplified;
+  return simplified;
+}
+
+void PreviewPathLOD::query(size_t first_layer, size_t last_layer, float tolerance,
+                           std::vector<float>* xyz, std::vector<uint8_t>* types, std::vector<uint32_t>* layers) {
+  std::lock_guard<std::mutex> guard(lock);
+  size_t level = level_of(tolerance);
+  std::vector<PathVector> scratch;
+  if (last_layer > path->layer_count()) last_layer = path->layer_count();
+  uint32_t count = 0;
+
+  for (size_t layer = first_layer; layer < last_layer; layer++) {
+    layers->push_back(count);
+    if (level == 0) {
+      size_t begin = path->layer_begin(layer), end = path->layer_end(layer);
+      PreviewPathReader reader(path, begin);
+      for (size_t i = begin; i < end; i++) {
+        PathVector p = reader.next();
+        xyz->push_back(p.x);
+        xyz->push_back(p.y);
+        xyz->push_back(p.z);
+        types->push_back(p.path_type - 1);
+      }
+      count += end - begin;
+    } else {
+      const LODLayer* simplified = simplify(level, layer, &scratch);
+      xyz->insert(xyz->end(), simplified->xyz.begin(), simplified->xyz.end());
+      types->insert(types->end(), simplified->types.begin(), simplified->types.end());
+      count += simplified->types.size();
+    }
+  }
+  layers->push_back(count);
+}
@@ -0,0 +1,48 @@
+#ifndef PreviewLODClass
+
+#define PreviewLODClass
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include "preview_path.h"
+
+// Finest simplification tolerance in mm, same as the JSON precision. Level 0
+// keeps every point, tolerance of level n is PREVIEW_LOD_BASE * 2^(n - 1).
+#define PREVIEW_LOD_BASE 0.01f
+#define PREVIEW_LOD_LEVELS 24
+
+// Douglas-Peucker simplified levels of a preview path. A point where path
+// type changes is always kept, so each type run is simplified on its own.
+// Kept points of a layer at a level are computed once, on first query.
+class PreviewPathLOD {
+  typedef struct {
+    std::vector<float> xyz;
+    std::vector<uint8_t> types;
+  } LODLayer;
+
+  const PreviewPath* path;
+  std::vector< std::vector<LODLayer*> > levels;  // [level][layer], NULL until computed
+  std::mutex lock;
+
+  PreviewPathLOD(const PreviewPathLOD&);
+  PreviewPathLOD& operator=(const PreviewPathLOD&);
+
+  const LODLayer* simplify(size_t level, size_t layer, std::vector<PathVector>* scratch);
+
+public:
+  PreviewPathLOD(const PreviewPath* source);
+  ~PreviewPathLOD();
+
+  // Level used for a tolerance in mm, the coarsest one not above it. A
+  // screen-space tolerance is given as pixels * mm per pixel.
+  static size_t level_of(float tolerance);
+
+  // Appends layers [first_layer, last_layer) simplified within tolerance,
+  // in the layout of path_to_binary: 3 floats and a type per point, layer
+  // offsets from the first appended point (layer count + 1 entries).
+  void query(size_t first_layer, size_t last_layer, float tolerance,
+             std::vector<float>* xyz, std::vector<uint8_t>* types, std::vector<uint32_t>* layers);
+};
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef PreviewPathClass
+
+#define PreviewPathClass
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+#include "path_vector.h"
+
+// First chunk holds 4096 points, chunk k holds 4096 << k points
+#define PREVIEW_CHUNK_BITS 12
+
+// Preview path stored by columns: x/y pairs and path type of each point live
+// in geometric chunks that are never moved, z is stored once per run of
+// points at the same height, and each layer is a point offset. A point costs
+// 9 bytes and a layer 8 bytes.
+class PreviewPath {
+  friend class PreviewPathReader;
+
+  typedef struct {
+    size_t begin;
+    float z;
+  } ZRun;
+
+  std::vector<char*> chunks;  // 2 * capacity floats of x/y, capacity types
+  std::vector<size_t> layers;  // first point of each layer
+  std::vector<ZRun> z_runs;
+  size_t count;
+  float* last_xy;
+  uint8_t* last_type;
+
+  PreviewPath(const PreviewPath&);
+  PreviewPath& operator=(const PreviewPath&);
+
+public:
+  static size_t chunk_capacity(size_t k) { return (size_t)1 << (PREVIEW_CHUNK_BITS + k); }
+  static size_t chunk_begin(size_t k) { return chunk_capacity(k) - chunk_capacity(0); }
+
+  PreviewPath() {
+    count = 0;
+    last_xy = NULL;
+    last_type = NULL;
+    layers.push_back(0);
+  }
+
+  ~PreviewPath() {
+    for (size_t k = 0; k < chunks.size(); k++) free(chunks[k]);
+  }
+
+  size_t size() const { return count; }
+  size_t layer_count() const { return layers.size(); }
+  size_t layer_begin(size_t layer) const { return layers[layer]; }
+  size_t layer_end(size_t layer) const {
+    return layer + 1 < layers.size() ? layers[layer + 1] : count;
+  }
+
+  // Appends a point to the last layer
+  void append(float x, float y, float z, int path_type) {
+    size_t k = chunks.size();
+    if (count == chunk_begin(k)) {
+      char* chunk = (char*)malloc(chunk_capacity(k) * (2 * sizeof(float) + 1));
+      if (!chunk) throw std::bad_alloc();
+      chunks.push_back(chunk);
+      last_xy = (float*)chunk;
+      last_type = (uint8_t*)(last_xy + 2 * chunk_capacity(k));
+    } else {
+      last_xy += 2;
+      last_type += 1;
+    }
+    last_xy[0] = x;
+    last_xy[1] = y;
+    *last_type = (uint8_t)path_type;
+    if (z_runs.empty() || z_runs.back().z != z) {
+      ZRun run = {count, z};
+      z_runs.push_back(run);
+    }
+    count++;
+  }
+
+  // Starts a new layer from a copy of the last point
+  void new_layer(int path_type) {
+    layers.push_back(count);
+    if (count) append(last_xy[0], last_xy[1], z_runs.back().z, path_type);
+  }
+
+  PathVector back() const {
+    PathVector p = {last_xy[0], last_xy[1], z_runs.back().z, *last_type};
+    return p;
+  }
+};
+
+// Reads points in order from a given index
+class PreviewPathReader {
+  const PreviewPath* path;
+  size_t index;
+  size_t chunk;
+  size_t chunk_end;
+  size_t run;
+  const float* xy;
+  const uint8_t* type;
+
+  void seek_chunk() {
+    size_t capacity = PreviewPath::chunk_capacity(chunk);
+    size_t offset = index - PreviewPath::chunk_begin(chunk);
+    const float* chunk_xy = (const float*)path->chunks[chunk];
+    xy = chunk_xy + 2 * offset;
+    type = (const uint8_t*)(chunk_xy + 2 * capacity) + offset;
+    chunk_end = PreviewPath::chunk_begin(chunk + 1);
+  }
+
+public:
+  PreviewPathReader(const PreviewPath* source, size_t begin) {
+    path = source;
+    index = begin;
+    chunk = 0;
+    while (PreviewPath::chunk_begin(chunk + 1) <= begin) chunk++;
+    size_t lo = 0, hi = path->z_runs.size();
+    while (hi - lo > 1) {
+      size_t mid = (lo + hi) / 2;
+      if (path->z_runs[mid].begin <= begin) lo = mid; else hi = mid;
+    }
+    run = lo;
+    xy = NULL;
+    type = NULL;
+    chunk_end = (size_t)-1;
+    if (index < path->count) seek_chunk();
+  }
+
+  // Caller keeps reading within path size
+  PathVector next() {
+    if (index == chunk_end) {
+      chunk++;
+      seek_chunk();
+    }
+    while (run + 1 < path->z_runs.size() && path->z_runs[run + 1].begin <= index) run++;
+    PathVector p = {xy[0], xy[1], path->z_runs[run].z, *type};
+    xy += 2;
+    type += 1;
+    index++;
+    return p;
+  }
+};
+
+#endif
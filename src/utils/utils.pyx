@@ -3,7 +3,6 @@ import binascii
 import logging
 import struct
 import sys
-from zlib import crc32
 from math import sqrt, sin, cos, pi, atan2
 import time
 from re import findall
@@ -16,6 +15,11 @@ from fluxclient.hw_profile import HW_PROFILE
 import cython
 from libcpp.vector cimport vector
 from libcpp.string cimport string
+from libc.stdint cimport uint8_t, uint32_t
+from cpython cimport array
+import array
+from libc.stdio cimport FILE, fopen, fclose
+from libc.string cimport memcpy
 
 from fluxclient.utils._utils import Tools
 from cpython.mem cimport PyMem_Malloc, PyMem_Realloc, PyMem_Free
@@ -24,11 +28,22 @@ logger = logging.getLogger(__name__)
 
 cimport libc.stdlib
 
+cdef extern from "preview_path.h":
+    cdef cppclass PreviewPath:
+        size_t size()
+        size_t layer_count()
+
+cdef extern from "preview_lod.h":
+    cdef cppclass PreviewPathLOD:
+        PreviewPathLOD(PreviewPath* source)
+        void query(size_t first_layer, size_t last_layer, float tolerance,
+                   vector[float]* xyz, vector[uint8_t]* types, vector[uint32_t]* layers) except + nogil
+
 cdef extern from "utils_module.h": 
     ctypedef struct PathVector:
         pass
-    string path_to_js(vector[vector[vector [float]]] output)
-    string path_to_js_cpp(vector[vector[PathVector]]* output)
+    string path_to_js(const vector[vector[vector [float]]]& output) except + nogil
+    string path_to_js_cpp(PreviewPath* output) except + nogil
 
 cdef extern from "path_vector.h":
     ctypedef struct PathVector:
@@ -38,20 +53,19 @@ cdef extern from "path_vector.h":
         int path_type 
 
 cdef class NativePath:
-    cdef vector[vector[PathVector]]* ptr
+    cdef PreviewPath* ptr
+    cdef object owner  # keeps the object holding ptr alive
     
     def __init__(self):
         pass
 
-    cdef void setPtr(self, vector[vector[PathVector]]* pt):
+    cdef void setPtr(self, PreviewPath* pt, object owner):
         self.ptr = pt
+        self.owner = owner
 
-    cdef vector[vector[PathVector]]* getPtr(self):
+    cdef PreviewPath* getPtr(self):
         return self.ptr
 
-    def __dealloc__(self):
-        PyMem_Free(self.ptr)
-
 
 cdef class Tools: 
     def __init__(self):
@@ -60,11 +74,16 @@ cdef class Tools:
     cpdef path_to_js(self, path):
         cdef vector[vector[vector [float]]] origin;
         cdef NativePath native = NativePath();
+        cdef string result
         if(type(path) is type(native)):
             native = path
-            return path_to_js_cpp(native.ptr)
+            with nogil:
+                result = path_to_js_cpp(native.ptr)
         else:
-            return path_to_js(path)
+            origin = path
+            with nogil:
+                result = path_to_js(origin)
+        return result
 
 cdef extern from "g2f_module.h":
 
@@ -87,7 +106,7 @@ cdef extern from "g2f_module.h":
         char* HEAD_TYPE
         int layer_now
         PathType path_type
-        vector[vector[PathVector]]* native_path
+        PreviewPath* native_path
         vector[int]* pause_at_layers
         int counter_between_layers
         float record_z
@@ -98,15 +117,23 @@ cdef extern from "g2f_module.h":
         char is_backed_to_normal_temperature # For first layer temperature settings
 
     int convert_to_fcode_by_line(char* line, FCode* fc, char* fcode_output);
+    long convert_to_fcode_buffer(const char* gcode, size_t size, FCode* fc, FILE* output, vector[char]* buffer, uint32_t* crc) nogil
+    long convert_to_fcode_file(const char* gcode_path, FCode* fc, FILE* output, vector[char]* buffer, uint32_t* crc) except + nogil
     char* c_open_file(char* path)
     FCode* createFCodePtr()
-    void trim_ends_cpp(vector[vector[PathVector]]* output);
+    void freeFCodePtr(FCode* fc)
+    void trim_ends_cpp(PreviewPath* output);
+
+cdef extern from "../toolpath/crc32.h":
+    uint32_t native_crc32 "FLUX::crc32"(uint32_t crc, const void *buf, size_t size) nogil
 
 cdef extern from "../utils/utils_module.h":
-    string path_to_js_cpp(vector[vector[PathVector]]* output)
+    string path_to_js_cpp(PreviewPath* output) except + nogil
+    void path_to_binary(PreviewPath* path, float* xyz, uint8_t* types, uint32_t* layers) nogil
 
 cdef class GcodeToFcodeCpp:
     cdef FCode* fc
+    cdef PreviewPathLOD* lod
     cdef unsigned long crc
     cdef public object image
     cdef public object md
@@ -179,24 +206,84 @@ cdef class GcodeToFcodeCpp:
         self.G92_delta[2] += z
 
     cpdef get_path(self, path_type='js'):
+        """
+        Returns the preview path, 'js' is a JSON string of
+        [[[x, y, z, type], ...], ...] layers. 'binary' is a dict of
+        little-endian arrays: 'xyz' Float32 (3 per point), 'type' Uint8 (same
+        value as JSON, -1 as 255) and 'layers' Uint32 layer offsets in points
+        (layer count + 1 entries).
+        """
+        cdef array.array xyz, types, layers
+        cdef PreviewPath* path
+        cdef string js
         if path_type == 'js':
             self.T.join()
             if self.path_js is None:
-                self.path_js = path_to_js_cpp(self.fc.native_path).decode()
+                path = self.fc.native_path
+                with nogil:
+                    js = path_to_js_cpp(path)
+                self.path_js = js.decode()
             return self.path_js
+        elif path_type == 'binary':
+            self.T.join()
+            path = self.fc.native_path
+            xyz = array.clone(array.array('f'), path.size() * 3, zero=False)
+            types = array.clone(array.array('B'), path.size(), zero=False)
+            layers = array.clone(array.array('I'), path.layer_count() + 1, zero=False)
+            with nogil:
+                path_to_binary(path, xyz.data.as_floats, <uint8_t*>types.data.as_uchars,
+                               <uint32_t*>layers.data.as_uints)
+            if sys.byteorder == 'big':
+                xyz.byteswap()
+                layers.byteswap()
+            return {'xyz': xyz, 'type': types, 'layers': layers}
         else:
             if self.path:
                 return self.path
             else:
                 return None
 
+    def get_path_lod(self, first_layer, last_layer, tolerance):
+        """
+        Returns layers [first_layer, last_layer) of the preview path
+        simplified within tolerance mm (screen-space tolerance in pixels times
+        mm per pixel), in the layout of get_path('binary'). Layer offsets
+        start from 0. Path type changes are kept. Each simplified layer is
+        cached, so repeated queries at a zoom level are cheap.
+        """
+        cdef vector[float] c_xyz
+        cdef vector[uint8_t] c_types
+        cdef vector[uint32_t] c_layers
+        cdef array.array xyz, types, layers
+        cdef size_t c_first = max(first_layer, 0)
+        cdef size_t c_last = max(last_layer, 0)
+        cdef float c_tolerance = tolerance
+
+        self.T.join()
+        if self.lod == NULL:
+            self.lod = new PreviewPathLOD(self.fc.native_path)
+        with nogil:
+            self.lod.query(c_first, c_last, c_tolerance, &c_xyz, &c_types, &c_layers)
+
+        xyz = array.clone(array.array('f'), c_xyz.size(), zero=False)
+        types = array.clone(array.array('B'), c_types.size(), zero=False)
+        layers = array.clone(array.array('I'), c_layers.size(), zero=False)
+        if c_xyz.size():
+            memcpy(xyz.data.as_floats, c_xyz.data(), c_xyz.size() * sizeof(float))
+            memcpy(types.data.as_uchars, c_types.data(), c_types.size())
+        memcpy(layers.data.as_uints, c_layers.data(), c_layers.size() * sizeof(uint32_t))
+        if sys.byteorder == 'big':
+            xyz.byteswap()
+            layers.byteswap()
+        return {'xyz': xyz, 'type': types, 'layers': layers}
+
     cpdef trim_ends(self, path):
         """
         trim the moving(non-extruding) part in path's both end
         """
         cdef NativePath np = NativePath();
         trim_ends_cpp(self.fc.native_path)
-        np.ptr = self.fc.native_path
+        np.setPtr(self.fc.native_path, self)
         return np
 
         
@@ -209,7 +296,7 @@ cdef class GcodeToFcodeCpp:
 
         stream.write(struct.pack('<I', len(md_join)))
         stream.write(md_join)
-        stream.write(struct.pack('<I', crc32(md_join)))
+        stream.write(struct.pack('<I', native_crc32(0, <const char*>md_join, len(md_join))))
 
         if self.image is None:
             stream.write(struct.pack('<I', 0))
@@ -217,19 +304,16 @@ cdef class GcodeToFcodeCpp:
             stream.write(struct.pack('<I', len(self.image)))
             stream.write(self.image)
 
-    def process(self, input_stream, output_stream):
+    cdef FCode* init_fcode(self):
         """
-        Process a input_stream consist of gcode strings and write the fcode into output_stream
+        Creates the FCode C instance and applies config to it
         """
-        packer = lambda x: struct.pack('<B', x)  # easy alias for struct.pack('<B', x)
-        packer_f = lambda x: struct.pack('<f', x)  # easy alias for struct.pack('<f', x)
-
-        cdef char output[2048]
-        cdef int script_length = 0
-        cdef int output_len = 0
         cdef FCode* fc = createFCodePtr()
         # Initiate new FCode C instance
         self.fc = fc
+        del self.lod
+        self.lod = NULL
+        self.crc = 0
         
         if self.config is not None:
             if self.engine == 'cura':
@@ -248,6 +332,60 @@ cdef class GcodeToFcodeCpp:
         fc.G92_delta[3] = self.G92_delta[2]
       
         logger.info("[G2FCPP] FCode Tool = " + str(<int>fc.tool))
+        return fc
+
+    def finish_metadata(self, output_stream, comment_list):
+        """
+        Fills metadata from the converted FCode and writes it into output_stream
+        """
+        cdef FCode* fc = self.fc
+
+        if len(self.empty_layer) > 0 and self.empty_layer[0] == 0:  # clean up first empty layer
+            self.empty_layer.pop(0)
+
+        # warning: fileformat didn't consider multi-extruder, use first extruder instead
+        # todo: test
+        if self.md['HEAD_TYPE'] is None:
+            if fc.filament[0] and fc.HEAD_TYPE == NULL:
+                self.md['HEAD_TYPE'] = 'EXTRUDER'
+            elif fc.HEAD_TYPE == NULL:
+                self.md['HEAD_TYPE'] = "" + fc.HEAD_TYPE
+            else:
+                self.md['HEAD_TYPE'] = "None";
+
+        if self.md['HEAD_TYPE'] == 'EXTRUDER':
+            self.md['FILAMENT_USED'] = ','.join(map(str, fc.filament))
+            # self.md['CORRECTION'] = 'A'
+            self.md['SETTING'] = str(comment_list[-137:])
+        else:
+            self.md['CORRECTION'] = 'N'
+
+        self.md['TRAVEL_DIST'] = str(fc.distance)
+        fc.max_range[3] = sqrt(fc.max_range[3])
+        for v, k in enumerate(['X', 'Y', 'Z', 'R']):
+            self.md['MAX_' + k] = str(fc.max_range[v])
+
+        self.md['TIME_COST'] = str(fc.time_need)
+        self.md['CREATED_AT'] = time.strftime('%Y-%m-%dT%H:%M:%SZ', time.localtime(time.time()))
+        self.md['AUTHOR'] = getuser()  # TODO: use fluxstudio user name?
+        
+        if self.config and self.config.get('geometric_error_correction_on', '0') == '1':
+            self.md['BACKLASH'] = 'Y' 
+
+        logger.info("[G2FCPP] Finished parsing");
+        self.write_metadata(output_stream, self.md)
+
+    def process(self, input_stream, output_stream):
+        """
+        Process a input_stream consist of gcode strings and write the fcode into output_stream
+        """
+        packer = lambda x: struct.pack('<B', x)  # easy alias for struct.pack('<B', x)
+        packer_f = lambda x: struct.pack('<f', x)  # easy alias for struct.pack('<f', x)
+
+        cdef char output[2048]
+        cdef int script_length = 0
+        cdef int output_len = 0
+        cdef FCode* fc = self.init_fcode()
 
         try:
             output_stream.write(self.header())
@@ -263,64 +401,101 @@ cdef class GcodeToFcodeCpp:
                 output_len = convert_to_fcode_by_line(py_byte_string, fc, output)
                 
                 output_stream.write(output[:output_len])
+                self.crc = native_crc32(self.crc, output, output_len)
                 script_length += output_len
                     
 
             self.T = Thread(target=self.sub_convert_path)
             self.T.start()
 
-            # Calculate File CRC
-            output_stream.seek(12, 0);
+            # File CRC is accumulated while writing
             logger.info("[G2FCPP] Full Length " + str(script_length));
-            data = output_stream.read(script_length)
-            self.crc = crc32(data);
             logger.info("[G2FCPP] Full CRC " + str(self.crc));
-            output_stream.seek(0, 2)  # 
             # Write back crc and length info 
             output_stream.write(struct.pack('<I', self.crc))
             output_stream.seek(8, 0)
             output_stream.write(struct.pack('<I', script_length))
             output_stream.seek(0, 2)  # go back to file end
 
-            if len(self.empty_layer) > 0 and self.empty_layer[0] == 0:  # clean up first empty layer
-                self.empty_layer.pop(0)
-
-            # warning: fileformat didn't consider multi-extruder, use first extruder instead
-            # todo: test
-            if self.md['HEAD_TYPE'] is None:
-                if fc.filament[0] and fc.HEAD_TYPE == NULL:
-                    self.md['HEAD_TYPE'] = 'EXTRUDER'
-                elif fc.HEAD_TYPE == NULL:
-                    self.md['HEAD_TYPE'] = "" + fc.HEAD_TYPE
-                else:
-                    self.md['HEAD_TYPE'] = "None";
-
-            if self.md['HEAD_TYPE'] == 'EXTRUDER':
-                self.md['FILAMENT_USED'] = ','.join(map(str, fc.filament))
-                # self.md['CORRECTION'] = 'A'
-                self.md['SETTING'] = str(comment_list[-137:])
-            else:
-                self.md['CORRECTION'] = 'N'
+            self.finish_metadata(output_stream, comment_list)
+
+        except Exception as e:
+            logger.exception("G_to_F fail")
+            return 'broken'
 
-            self.md['TRAVEL_DIST'] = str(fc.distance)
-            fc.max_range[3] = sqrt(fc.max_range[3])
-            for v, k in enumerate(['X', 'Y', 'Z', 'R']):
-                self.md['MAX_' + k] = str(fc.max_range[v])
+    def convert_file(self, input, output):
+        """
+        Same as process, but the whole conversion runs in C++ without the GIL.
+        input is a gcode file path or a bytes-like buffer, output is a fcode
+        file path or a writable stream (need not be seekable).
+        """
+        cdef FCode* fc = self.init_fcode()
+        cdef string c_input_path
+        cdef const unsigned char[::1] input_view
+        cdef const char* input_ptr = NULL
+        cdef size_t input_size = 0
+        cdef bint from_path = isinstance(input, str)
+        cdef FILE* script_file = NULL
+        cdef vector[char] script
+        cdef uint32_t crc = 0
+        cdef long script_length = 0
 
-            self.md['TIME_COST'] = str(fc.time_need)
-            self.md['CREATED_AT'] = time.strftime('%Y-%m-%dT%H:%M:%SZ', time.localtime(time.time()))
-            self.md['AUTHOR'] = getuser()  # TODO: use fluxstudio user name?
-            
-            if self.config and self.config.get('geometric_error_correction_on', '0') == '1':
-                self.md['BACKLASH'] = 'Y' 
+        try:
+            if from_path:
+                c_input_path = input.encode()
+            else:
+                input_view = input
+                input_size = input_view.shape[0]
+                if input_size:
+                    input_ptr = <const char*>&input_view[0]
+
+            if isinstance(output, str):
+                with open(output, 'wb') as f:
+                    f.write(self.header())
+                    f.write(struct.pack('<I', 0))  # script length, will be modify in the end
+                script_file = fopen(output.encode(), "ab")
+                if script_file == NULL:
+                    raise IOError("Can not open %s" % output)
 
-            logger.info("[G2FCPP] Finished parsing");
-            self.write_metadata(output_stream, self.md)
+            logger.info("[G2FCPP] Start parsing...")
+            try:
+                with nogil:
+                    if from_path:
+                        script_length = convert_to_fcode_file(c_input_path.c_str(), fc, script_file, &script, &crc)
+                    else:
+                        script_length = convert_to_fcode_buffer(input_ptr, input_size, fc, script_file, &script, &crc)
+            finally:
+                if script_file != NULL:
+                    fclose(script_file)
+            if script_length < 0:
+                raise IOError("Write fcode script failed")
+            self.crc = crc
+
+            self.T = Thread(target=self.sub_convert_path)
+            self.T.start()
 
+            logger.info("[G2FCPP] Full Length " + str(script_length));
+            logger.info("[G2FCPP] Full CRC " + str(self.crc));
+            if script_file != NULL:
+                with open(output, 'r+b') as f:
+                    f.seek(8, 0)
+                    f.write(struct.pack('<I', script_length))
+                    f.seek(0, 2)
+                    f.write(struct.pack('<I', self.crc))
+                    self.finish_metadata(f, [])
+            else:
+                output.write(self.header())
+                output.write(struct.pack('<I', script_length))
+                if script.size():
+                    output.write((<char*>script.data())[:script.size()])
+                output.write(struct.pack('<I', self.crc))
+                self.finish_metadata(output, [])
 
         except Exception as e:
             logger.exception("G_to_F fail")
             return 'broken'
 
     def __dealloc__(self):
-        PyMem_Free(self.fc)
+        del self.lod
+        if self.fc != NULL:
+            freeFCodePtr(self.fc)
@@ -1,80 +1,199 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
-#include <list>
-#include <numeric>
+#include <string.h>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 #include "utils_module.h"
 
-std::string path_to_js(std::vector< std::vector< std::vector<float> > > path){
-  char buf[50];
-  std::string c_string("[");
-  for (size_t layer = 0; layer < path.size(); layer += 1){
-    c_string += "[";
-      for (size_t point = 0; point < path[layer].size(); point += 1){
-        // sprintf(buf, "[%g,%g,%g,%d]", path[layer][point][0], path[layer][point][1], path[layer][point][2], (int)path[layer][point][3]);
-        sprintf(buf, "[%.2f,%.2f,%.2f,%d]", path[layer][point][0], path[layer][point][1], path[layer][point][2], (int)path[layer][point][3]);
-        c_string += buf;
-        c_string += ",";
-      }
-      c_string.erase(c_string.end() - 1);
-    c_string += "],";
+// Longest text of a point: 3 fallback "%.2f" floats (up to 47 chars) and an int
+#define POINT_JSON_MAX 160
+
+// Same text as sprintf("%.2f") of a float. A float times 100 is exact in
+// double, so rounding it half to even gives the rounding printf does.
+static inline char* write_fixed2(char* dest, float value){
+  double scaled = (double)value * 100;
+  if (!(fabs(scaled) < 1e15)) {
+    return dest + sprintf(dest, "%.2f", value);
   }
-  c_string.erase(c_string.end() - 1);
-  c_string += "]";
-  return c_string;
+  unsigned long long q = (unsigned long long)nearbyint(fabs(scaled));
+  if (signbit(value)) *(dest++) = '-';
+  unsigned long long integer = q / 100;
+  unsigned fraction = (unsigned)(q % 100);
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = '0' + integer % 10;
+    integer /= 10;
+  } while (integer);
+  while (n) *(dest++) = digits[--n];
+  dest[0] = '.';
+  dest[1] = '0' + fraction / 10;
+  dest[2] = '0' + fraction % 10;
+  return dest + 3;
+}
+
+static inline char* write_int(char* dest, int value){
+  unsigned magnitude = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+  if (value < 0) *(dest++) = '-';
+  char digits[12];
+  int n = 0;
+  do {
+    digits[n++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude);
+  while (n) *(dest++) = digits[--n];
+  return dest;
 }
 
-class StringBuilder{
-  list<string> m_data;
-  int m_total_length;
+// Same text as sprintf("[%.2f,%.2f,%.2f,%d]")
+static inline char* write_point(char* dest, float x, float y, float z, int type){
+  *(dest++) = '[';
+  dest = write_fixed2(dest, x);
+  *(dest++) = ',';
+  dest = write_fixed2(dest, y);
+  *(dest++) = ',';
+  dest = write_fixed2(dest, z);
+  *(dest++) = ',';
+  dest = write_int(dest, type);
+  *(dest++) = ']';
+  return dest;
+}
+
+// Text buffer of one layer, sized for typical points up front
+class LayerBuffer{
 public:
-  StringBuilder(){
-    m_total_length = 0;
+  std::vector<char> data;
+  size_t used;
+
+  void reset(size_t points){
+    used = 0;
+    if (data.size() < points * 24 + POINT_JSON_MAX) data.resize(points * 24 + POINT_JSON_MAX);
   }
-  void append(string str){
-    m_data.push_back(str);
-    m_total_length += str.length();
+  // Returns room for one more point
+  char* reserve_point(){
+    if (data.size() - used < POINT_JSON_MAX) data.resize(data.size() * 2);
+    return data.data() + used;
   }
-  int length(){
-    return m_total_length;
+  void put(char c){
+    if (used == data.size()) data.resize(data.size() * 2 + 1);
+    data[used++] = c;
   }
-  string toString(){
-    string output = "";
-    output.reserve(m_total_length);
-    for (list<string>::iterator i = m_data.begin(); i != m_data.end(); ++i)
-    {
-      output+= *i;
+};
+
+// Paths with fewer points are formatted on the calling thread only
+#define PARALLEL_JSON_MIN_POINTS 65536
+
+// Formats every layer into its own buffer with format_layer(layer, buffer),
+// on all cores when the path has at least PARALLEL_JSON_MIN_POINTS points,
+// then joins them with "," into one string. empty_text is the text of no
+// layers. The first exception thrown by format_layer is thrown again.
+template <typename FormatLayer>
+static std::string join_layers(size_t layer_count, size_t point_count, const char* empty_text, FormatLayer format_layer){
+  if (layer_count == 0) return std::string(empty_text);
+
+  std::vector<LayerBuffer> layers(layer_count);
+  std::atomic<size_t> next(0);
+  std::mutex error_lock;
+  std::exception_ptr error;
+  auto stop = [&]() {
+    std::lock_guard<std::mutex> guard(error_lock);
+    if (!error) error = std::current_exception();
+    next = layer_count;
+  };
+  auto worker = [&]() {
+    try {
+      for (size_t i = next++; i < layer_count; i = next++) {
+        format_layer(i, &layers[i]);
+      }
+    } catch (...) {
+      stop();
     }
-    return output;
+  };
+
+  size_t thread_count = 1;
+  if (point_count >= PARALLEL_JSON_MIN_POINTS) {
+    thread_count = std::thread::hardware_concurrency();
+    if (thread_count > layer_count) thread_count = layer_count;
   }
-};
+  std::vector<std::thread> threads;
+  try {
+    for (size_t i = 1; i < thread_count; i++) threads.push_back(std::thread(worker));
+  } catch (...) {
+    // Layers left are formatted by started threads and this one
+  }
+  worker();
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+  if (error) std::rethrow_exception(error);
+
+  size_t total = layer_count + 1;
+  for (size_t i = 0; i < layer_count; i++) total += layers[i].used;
+  std::string output;
+  output.reserve(total);
+  output += "[";
+  for (size_t i = 0; i < layer_count; i++) {
+    if (i) output += ",";
+    output.append(layers[i].data.data(), layers[i].used);
+    std::vector<char>().swap(layers[i].data);
+  }
+  output += "]";
+  return output;
+}
 
-std::string path_to_js_cpp(vector< vector< PathVector > >* path){
-  
-  char buf[50];
-  // std::string sb("[");
-  StringBuilder builder;
-  builder.append("[");
-  // int m_reserve = 1024;
-  // sb.reserve(m_reserve);
-  for (size_t layer = 0; layer < path->size(); layer += 1){
-    //sb+= "[";
-    builder.append("[");
-    int layer_size = (*path)[layer].size();
-    // m_reserve += layer_size*50;
-    // sb.reserve(m_reserve);
-    for (int i = 0; i < layer_size; i++){
-      sprintf(buf, "[%.2f,%.2f,%.2f,%d]",(*path)[layer][i].x,(*path)[layer][i].y,(*path)[layer][i].z,(*path)[layer][i].path_type - 1);
-      builder.append(string(buf));
-      if(i != layer_size-1) builder.append(",");
+std::string path_to_js(const std::vector< std::vector< std::vector<float> > >& path){
+  // An empty layer is written as "]", an empty path as "]"
+  size_t point_count = 0;
+  for (size_t layer = 0; layer < path.size(); layer += 1) point_count += path[layer].size();
+  return join_layers(path.size(), point_count, "]", [&](size_t layer, LayerBuffer* buffer) {
+    const std::vector< std::vector<float> >& points = path[layer];
+    buffer->reset(points.size());
+    if (points.empty()) {
+      buffer->put(']');
+      return;
+    }
+    buffer->put('[');
+    for (size_t point = 0; point < points.size(); point += 1){
+      if (point) buffer->put(',');
+      const std::vector<float>& p = points[point];
+      char* end = write_point(buffer->reserve_point(), p[0], p[1], p[2], (int)p[3]);
+      buffer->used = end - buffer->data.data();
     }
-    builder.append("]");
-    if(layer != path->size()-1){
-      builder.append(",");
+    buffer->put(']');
+  });
+}
+
+std::string path_to_js_cpp(PreviewPath* path){
+  return join_layers(path->layer_count(), path->size(), "[]", [&](size_t layer, LayerBuffer* buffer) {
+    size_t begin = path->layer_begin(layer), end = path->layer_end(layer);
+    PreviewPathReader reader(path, begin);
+    buffer->reset(end - begin);
+    buffer->put('[');
+    for (size_t i = begin; i < end; i++){
+      if (i != begin) buffer->put(',');
+      PathVector p = reader.next();
+      char* point_end = write_point(buffer->reserve_point(), p.x, p.y, p.z, p.path_type - 1);
+      buffer->used = point_end - buffer->data.data();
     }
+    buffer->put(']');
+  });
+}
+
+void path_to_binary(PreviewPath* path, float* xyz, uint8_t* types, uint32_t* layers){
+  for (size_t layer = 0; layer < path->layer_count(); layer += 1){
+    layers[layer] = path->layer_begin(layer);
+  }
+  layers[path->layer_count()] = path->size();
+
+  PreviewPathReader reader(path, 0);
+  for (size_t i = 0; i < path->size(); i++){
+    PathVector p = reader.next();
+    xyz[0] = p.x;
+    xyz[1] = p.y;
+    xyz[2] = p.z;
+    xyz += 3;
+    types[i] = p.path_type - 1;
   }
-  builder.append("]");
-  // fprintf(stderr, "path_to_js_cpp end, size = %d\n", builder.length());
-  return builder.toString();
 }
@@ -3,5 +3,8 @@
 #include <string>
 #include "g2f_module.h"
 
-std::string path_to_js(std::vector< std::vector< std::vector<float> > > output);
-std::string path_to_js_cpp(std::vector< std::vector< PathVector > >* output);
\ No newline at end of file
+std::string path_to_js(const std::vector< std::vector< std::vector<float> > >& output);
+std::string path_to_js_cpp(PreviewPath* output);
+// Fills xyz (3 floats per point), path types (same value as path_to_js_cpp)
+// and layer offsets (layer count + 1 entries, last one is the point count)
+void path_to_binary(PreviewPath* path, float* xyz, uint8_t* types, uint32_t* layers);
\ No newline at end of file
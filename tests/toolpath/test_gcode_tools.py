@@ -1,5 +1,11 @@
 
+import io
+import math
+import os
+import struct
+import tempfile
 import unittest
+import zlib
 from fluxclient.toolpath import _toolpath
 
 
@@ -29,6 +35,37 @@ class TestGCodeParser(unittest.TestCase):
         self.parser.parse_command(b"G1F9000 X50.5 Y50 ;YAHOO\n")
         self.assertEqual([], self.calllist)
 
+    def test_g2g3(self):
+        points = []
+        proc = _toolpath.PyToolpathProcessor(
+            lambda cmd, **kw: points.append((kw["x"], kw["y"], kw["z"])))
+        self.parser.set_processor(proc)
+        self.parser.set_arc_tolerance(0.01)
+        self.parser.parse_command(b"G1 X10 Y0 Z0\n")
+        self.parser.parse_command(b"G3 X0 Y10 I-10 J0\n")
+        self.parser.parse_command(b"G2 X10 Y0 R10\n")
+        self.parser.parse_command(b"G2 X10 Y0 I-10 Z1\n")
+
+        self.assertEqual(points[18], (0.0, 10.0, 0.0))
+        self.assertEqual(points[36], (10.0, 0.0, 0.0))
+        self.assertEqual(points[-1], (10.0, 0.0, 1.0))
+        for x, y, _ in points:
+            self.assertAlmostEqual(math.hypot(x, y), 10, places=4)
+        # Counterclockwise then clockwise through the first quadrant
+        self.assertTrue(all(y >= 0 for _, y, _ in points[:37]))
+        # Clockwise full circle passes (0, -10)
+        self.assertTrue(any(y < -9.99 for _, y, _ in points[37:]))
+
+    def test_g2_bad_radius(self):
+        self.calllist = [
+            ("moveto", {'x': 10.0}),
+            ("on_error", {'critical': True,
+                          'message': "BAD_ARC G2 X30 Y0 R1"}),
+        ]
+        self.parser.parse_command(b"G1 X10 Y0\n")
+        self.parser.parse_command(b"G2 X30 Y0 R1")
+        self.assertEqual([], self.calllist)
+
     def test_x2(self):
         self.calllist = [
             ("set_toolhead_pwm", {'strength': 0}),
@@ -47,6 +84,603 @@ class TestGCodeParser(unittest.TestCase):
         self.parser.parse_command(b";YAHOO\n")
         self.assertEqual([], self.calllist)
 
+    def test_parse_buffer(self):
+        self.calllist = [
+            ("moveto", {'flags': 112, 'feedrate': 9000.0,
+                        'x': 50.5, 'y': 50.0}),
+            ("append_comment", {'message': "YAHOO"}),
+            ("home", {}),
+            ("moveto", {'flags': 8, 'z': 12.5}),
+        ]
+        self.parser.parse_buffer(
+            memoryview(b"G1F9000 X50.5 Y50 ;YAHOO\n\nG28\nG1 Z12.5"))
+        self.assertEqual([], self.calllist)
+
+    def test_parse_from_file(self):
+        self.calllist = [
+            ("moveto", {'flags': 32, 'x': 3.0}),
+            ("append_comment", {'message': "END"}),
+        ]
+        with tempfile.NamedTemporaryFile() as f:
+            f.write(b"G1 X3\n;END\n")
+            f.flush()
+            self.parser.parse_from_file(f.name)
+        self.assertEqual([], self.calllist)
+
+    def test_parse_from_file_native(self):
+        writer = _toolpath.GCodeMemoryWriter()
+        self.parser.set_processor(writer)
+        with tempfile.NamedTemporaryFile() as f:
+            f.write(b"G1 F600 X3 Y4\nG28\n")
+            f.flush()
+            self.parser.parse_from_file(f.name)
+        writer.terminated()
+        self.assertEqual(writer.get_buffer(),
+                         b"G1 F600.0000 X3.0000 Y4.0000\nG28\n")
+
+    def test_parse_buffer_parallel(self):
+        lines = []
+        for i in range(60000):
+            if i % 1000 == 0:
+                lines.append("G91\nG1 E-1 F2400\nG90\nG92 E0 ;reset")
+            lines.append("G1 X%.3f Y%.3f E%.4f" % (i % 170, i % 97, i * 0.01))
+        buf = ("\n".join(lines)).encode()
+
+        results = []
+        for threads in (1, 4):
+            writer = _toolpath.GCodeMemoryWriter()
+            parser = _toolpath.GCodeParser()
+            parser.set_processor(writer)
+            parser.parse_buffer(buf, threads=threads)
+            writer.terminated()
+            results.append(writer.get_buffer())
+        self.assertGreater(len(buf), 1 << 20)
+        self.assertEqual(results[0], results[1])
+
+    def test_batched_moves_to_fcode(self):
+        source = (b"G28\nM104 S200\nG1 F1200 X1 Y1\nG1 X2 E1\nG91\n"
+                  b"G1 X1 E1\nG90\n;comment\nG1 X5 Y5 E3\nX2O10\nG1 X0\n")
+
+        by_buffer = _toolpath.FCodeV1MemoryWriter("EXTRUDER", {}, ())
+        parser = _toolpath.GCodeParser()
+        parser.set_processor(by_buffer)
+        parser.parse_buffer(source)
+        by_buffer.terminated()
+
+        by_line = _toolpath.FCodeV1MemoryWriter("EXTRUDER", {}, ())
+        parser = _toolpath.GCodeParser()
+        parser.set_processor(by_line)
+        for line in source.split(b"\n"):
+            parser.parse_command(line)
+        by_line.terminated()
+
+        self.assertEqual(by_buffer.get_buffer(), by_line.get_buffer())
+        self.assertEqual(by_buffer.get_time_cost(), by_line.get_time_cost())
+
+
+class TestMemoryWriterBuffer(unittest.TestCase):
+    def create_writers(self):
+        writers = (_toolpath.GCodeMemoryWriter(),
+                   _toolpath.FCodeV1MemoryWriter("EXTRUDER", {}, ()))
+        for writer in writers:
+            writer.home()
+            writer.moveto(feedrate=1200, x=1, y=2)
+        return writers
+
+    def test_memoryview(self):
+        for writer in self.create_writers():
+            self.assertRaises(BufferError, memoryview, writer)
+            writer.terminated()
+            expected = writer.get_buffer()
+            with memoryview(writer) as view:
+                self.assertTrue(view.readonly)
+                self.assertEqual(view.tobytes(), expected)
+                self.assertRaises(BufferError, writer.detach)
+
+    def test_detach(self):
+        for writer in self.create_writers():
+            writer.terminated()
+            expected = writer.get_buffer()
+            buf = writer.detach()
+            self.assertEqual(len(buf), len(expected))
+            self.assertEqual(bytes(buf), expected)
+            self.assertEqual(memoryview(buf).tobytes(), expected)
+            self.assertEqual(writer.get_buffer(), b"")
+
+
+class TestFCodeV1Parser(unittest.TestCase):
+    source = (b"G28\nM104 S200\nG1 F1200 X1 Y1\nG1 X2 E1\nM106 S255\n"
+              b"G1 X0\nG1 Z5\n")
+
+    def make_fcode(self):
+        writer = _toolpath.FCodeV1MemoryWriter("EXTRUDER", {"AUTHOR": "flux"},
+                                               (b"PREVIEW",))
+        parser = _toolpath.GCodeParser()
+        parser.set_processor(writer)
+        parser.parse_buffer(self.source)
+        writer.terminated()
+        return writer.get_buffer()
+
+    def pack_fcode(self, script, metadata=b""):
+        return (b"FCx0001\n" + struct.pack("<I", len(script)) + script +
+                struct.pack("<I", zlib.crc32(script)) +
+                struct.pack("<I", len(metadata)) + metadata +
+                struct.pack("<II", zlib.crc32(metadata), 0))
+
+    def test_parse_buffer(self):
+        writer = _toolpath.GCodeMemoryWriter()
+        parser = _toolpath.FCodeV1Parser()
+        parser.set_processor(writer)
+        metadata, previews = parser.parse_buffer(self.make_fcode())
+        writer.terminated()
+
+        self.assertEqual(metadata["AUTHOR"], "flux")
+        self.assertEqual(metadata["HEAD_TYPE"], "EXTRUDER")
+        self.assertEqual(previews, (b"PREVIEW",))
+        lines = writer.get_buffer().split(b"\n")
+        self.assertEqual(lines[:7], [
+            b"G28", b"M104 S200.0", b"G1 F1200.0000 X1.0000 Y1.0000",
+            b"G1 X2.0000 E1.0000", b"M106 S255", b"G1 X0.0000",
+            b"G1 Z5.0000"])
+        self.assertIn(b";AUTHOR=flux", lines)
+
+    def test_parse_from_file(self):
+        with tempfile.NamedTemporaryFile(suffix=".fc") as f:
+            f.write(self.make_fcode())
+            f.flush()
+            writer = _toolpath.GCodeMemoryWriter()
+            parser = _toolpath.FCodeV1Parser()
+            parser.set_processor(writer)
+            metadata, previews = parser.parse_from_file(f.name)
+        self.assertEqual(metadata["AUTHOR"], "flux")
+        self.assertEqual(previews, (b"PREVIEW",))
+
+    def test_bad_contents(self):
+        parser = _toolpath.FCodeV1Parser()
+        parser.set_processor(_toolpath.GCodeMemoryWriter())
+        buf = bytearray(self.make_fcode())
+
+        self.assertRaises(ValueError, parser.parse_buffer, b"FCx0002\n")
+        self.assertRaises(ValueError, parser.parse_buffer, buf[:len(buf) - 2])
+        buf[20] ^= 1
+        self.assertRaises(ValueError, parser.parse_buffer, buf)
+
+    def test_unused_command(self):
+        writer = _toolpath.GCodeMemoryWriter()
+        parser = _toolpath.FCodeV1Parser()
+        parser.set_processor(writer)
+        # Command 64 | 32 | 1 has 2 float parameters and is skipped
+        move = struct.pack("<B2f", 128 | 32 | 16, 1, 2)
+        parser.parse_buffer(self.pack_fcode(b"\x61" + b"\0" * 8 + move))
+        writer.terminated()
+        self.assertEqual(writer.get_buffer(), b"G1 X1.0000 Y2.0000\n")
+
+        for size in range(8):
+            self.assertRaises(ValueError, parser.parse_buffer,
+                              self.pack_fcode(b"\x61" + b"\0" * size))
+
+    def test_resume_from_layer(self):
+        writer = _toolpath.FCodeV1MemoryWriter("EXTRUDER", {}, ())
+        parser = _toolpath.GCodeParser()
+        parser.set_processor(writer)
+        parser.parse_buffer(b"M104 S200\nG28\n;LAYER:0\nG1 F1200 X1 Y1 Z0.2 E1\n"
+                            b"M106 S255\n;LAYER:1\nG1 Z0.4\nG1 X3 E3\n")
+        writer.terminated()
+
+        output = _toolpath.GCodeMemoryWriter()
+        reader = _toolpath.FCodeV1Parser()
+        reader.set_processor(output)
+        metadata, _ = reader.resume_buffer(writer.get_buffer(), 1)
+        output.terminated()
+
+        index = reader.get_index()
+        self.assertEqual([(i["type"], i["value"]) for i in index],
+                         [("layer", 0), ("layer", 1)])
+        self.assertEqual(index[1]["e"], (1.0, 0.0, 0.0))
+        self.assertTrue(index[1]["absolute"])
+        # Travel from home without extruding, E continues from 0
+        self.assertEqual(output.get_buffer().split(b"\n")[:6], [
+            b"M109 S200.0", b"M106 S255", b"G28",
+            b"G1 F1200.0000 X1.0000 Y1.0000 Z0.2000",
+            b"G1 Z0.4000", b"G1 X3.0000 E2.0000"])
+        self.assertNotIn(b";INDEX", output.get_buffer())
+        self.assertRaises(ValueError, reader.resume_buffer,
+                          writer.get_buffer(), 2)
+
+    def test_resume_relative(self):
+        # Hand built file: absolute move, G91, relative move. Entry L0 is
+        # in relative mode, A7 has no positioning mode (older files).
+        script = (struct.pack("<B5f", 128 | 64 | 32 | 16 | 8 | 4,
+                              1200, 1, 1, 0.2, 1) +
+                  b"\x03" + struct.pack("<B2f", 128 | 32 | 4, 2, 2))
+        index = ("L0,%i,1200,1,1,0.2,1,0,0,0,0,0,0;"
+                 "A7,0,0,0,0,0,0,0,0,0,0,0" % (len(script) - 9))
+        fcode = self.pack_fcode(script, b"INDEX=" + index.encode())
+
+        output = _toolpath.GCodeMemoryWriter()
+        reader = _toolpath.FCodeV1Parser()
+        reader.set_processor(output)
+        reader.resume_buffer(fcode, 0)
+        output.terminated()
+        self.assertEqual([i["absolute"] for i in reader.get_index()],
+                         [False, True])
+        self.assertEqual(output.get_buffer().split(b"\n")[:3], [
+            b"G28", b"G1 F1200.0000 X1.0000 Y1.0000 Z0.2000",
+            b"G1 X3.0000 E2.0000"])
+
+    def test_layer_count_header_is_not_a_layer(self):
+        for writer, reader in (
+                (_toolpath.FCodeV1MemoryWriter("EXTRUDER", {}, ()), _toolpath.FCodeV1Parser()),
+                (_toolpath.FCodeV2MemoryWriter("EXTRUDER", {}, ()), _toolpath.FCodeV2Parser())):
+            parser = _toolpath.GCodeParser()
+            parser.set_processor(writer)
+            parser.parse_buffer(b";LAYER_COUNT:2\nG28\n;LAYER:0\n"
+                                b"G1 F1200 X1 Y1 Z0.2 E1\n;LAYER:1\nG1 Z0.4\n"
+                                b";LAYER_CHANGE\nG1 Z0.6\n")
+            writer.terminated()
+
+            output = _toolpath.GCodeMemoryWriter()
+            reader.set_processor(output)
+            reader.parse_buffer(writer.get_buffer())
+            self.assertEqual([(i["type"], i["value"]) for i in reader.get_index()],
+                             [("layer", 0), ("layer", 1), ("layer", 2)])
+            self.assertAlmostEqual(reader.get_index()[1]["z"], 0.2, places=6)
+
+
+class TestFCodeV2(unittest.TestCase):
+    source = (b"G28\nM104 S200\nG1 F1200 X1.001 Y1 Z0.2\n;LAYER:0\n"
+              b"G1 X-2.5 E1.23456\nM106 S255\nG1 X100.123 Y-0.0004\n"
+              b";LAYER:1\nG1 Z5\n") * 20
+
+    def convert(self, writer, source=source):
+        parser = _toolpath.GCodeParser()
+        parser.set_processor(writer)
+        parser.parse_buffer(source)
+        writer.terminated()
+        return writer.get_buffer()
+
+    def decode(self, reader, fcode, entry=None):
+        output = _toolpath.GCodeMemoryWriter()
+        reader.set_processor(output)
+        if entry is None:
+            metadata, previews = reader.parse_buffer(fcode)
+        else:
+            metadata, previews = reader.resume_buffer(fcode, entry)
+        output.terminated()
+        return output.get_buffer(), metadata, previews
+
+    def test_same_as_v1(self):
+        v1 = self.convert(_toolpath.FCodeV1MemoryWriter("EXTRUDER", {}, ()))
+        expected, v1_metadata, _ = self.decode(_toolpath.FCodeV1Parser(), v1)
+        expected = expected.split(b";VERSION")[0]
+
+        for level in (0, 6):
+            v2 = self.convert(_toolpath.FCodeV2MemoryWriter(
+                "EXTRUDER", {"AUTHOR": "flux"}, (b"PREVIEW",),
+                compress_level=level))
+            self.assertLess(len(v2), len(v1))
+            output, metadata, previews = self.decode(
+                _toolpath.FCodeV2Parser(), v2)
+            self.assertEqual(metadata["VERSION"], "2")
+            self.assertEqual(metadata["AUTHOR"], "flux")
+            self.assertEqual(metadata["TIME_COST"], v1_metadata["TIME_COST"])
+            self.assertEqual(previews, (b"PREVIEW",))
+            # Y-0.0004 is rounded to 1 um
+            self.assertEqual(output.split(b";VERSION")[0],
+                             expected.replace(b"Y-0.0004", b"Y0.0000"))
+
+    def test_resume_after_home(self):
+        source = (b"M104 S200\nG1 F1200 X1 Y1 Z0.2 E1\nG28\n;LAYER:0\n"
+                  b"G1 X3 E3\n")
+        v1 = self.convert(_toolpath.FCodeV1MemoryWriter("EXTRUDER", {}, ()),
+                          source)
+        v2 = self.convert(_toolpath.FCodeV2MemoryWriter(
+            "EXTRUDER", {}, (), compress_level=1), source)
+        expected = self.decode(_toolpath.FCodeV1Parser(), v1, 0)[0]
+        output = self.decode(_toolpath.FCodeV2Parser(), v2, 0)[0]
+        self.assertEqual(output.split(b";")[0], expected.split(b";")[0])
+        # Writer repeats the home position before the layer, so the reader
+        # restarts from a known quantized position
+        output = self.decode(_toolpath.FCodeV2Parser(), v2)[0]
+        self.assertEqual(output.split(b"\n")[2:5], [
+            b"G28", b"G1 X0.0000 Y0.0000 Z240.0000", b"G1 X3.0000 E3.0000"])
+
+    def test_bad_contents(self):
+        parser = _toolpath.FCodeV2Parser()
+        parser.set_processor(_toolpath.GCodeMemoryWriter())
+        buf = bytearray(self.convert(_toolpath.FCodeV2MemoryWriter(
+            "EXTRUDER", {}, (), compress_level=6)))
+
+        self.assertRaises(ValueError, parser.parse_buffer, b"FCx0001\n")
+        self.assertRaises(ValueError, parser.parse_buffer, buf[:len(buf) - 2])
+        buf[40] ^= 1
+        self.assertRaises(ValueError, parser.parse_buffer, buf)
+        self.assertRaises(ValueError, _toolpath.FCodeV2MemoryWriter,
+                          "EXTRUDER", {}, (), resolution=0)
+
+
+class TestFCodeV1StreamWriter(unittest.TestCase):
+    source = b"G28\nM104 S200\nG1 F1200 X1 Y1\nG1 X2 E1\n" * 5000
+
+    def convert(self, writer):
+        parser = _toolpath.GCodeParser()
+        parser.set_processor(writer)
+        parser.parse_buffer(self.source)
+        writer.terminated()
+
+    def test_same_as_memory_writer(self):
+        expected = _toolpath.FCodeV1MemoryWriter("EXTRUDER", {"AUTHOR": "flux"}, (b"PREVIEW",))
+        self.convert(expected)
+
+        for spill_threshold in (64 << 20, 1024):
+            output = io.BytesIO()
+            writer = _toolpath.FCodeV1StreamWriter(
+                output, "EXTRUDER", {"AUTHOR": "flux"}, (b"PREVIEW",),
+                spill_threshold=spill_threshold)
+            self.convert(writer)
+            self.assertEqual(output.getvalue(), expected.get_buffer())
+
+    def test_write_error(self):
+        class ClosedPipe(object):
+            def write(self, buf):
+                raise BrokenPipeError()
+
+        writer = _toolpath.FCodeV1StreamWriter(ClosedPipe(), "EXTRUDER", {}, ())
+        self.assertRaises(BrokenPipeError, self.convert, writer)
+
+
+class TestFCodeConcat(unittest.TestCase):
+    def make_fcode(self, directory, name, source, head_type="EXTRUDER"):
+        writer = _toolpath.FCodeV1MemoryWriter(head_type, {"AUTHOR": name},
+                                               (name.encode(),))
+        parser = _toolpath.GCodeParser()
+        parser.set_processor(writer)
+        parser.parse_buffer(source)
+        writer.terminated()
+        filename = os.path.join(directory, name + ".fc")
+        with open(filename, "wb") as f:
+            f.write(writer.get_buffer())
+        return filename
+
+    def read_script(self, filename):
+        with open(filename, "rb") as f:
+            fcode = f.read()
+        size = int.from_bytes(fcode[8:12], "little")
+        return fcode[12:12 + size]
+
+    def test_concat(self):
+        with tempfile.TemporaryDirectory() as directory:
+            a = self.make_fcode(directory, "a", b";LAYER:0\nG1 F1200 X1 Y1 Z0.2 E1\n"
+                                b";LAYER:1\nG1 Z0.4 X3 E3.5\n")
+            b = self.make_fcode(directory, "b", b";LAYER:0\nG1 F1200 X5 Y5 E2\n"
+                                b"G92 E0\nG1 X6 E1\n")
+            output = io.BytesIO()
+            metadata = _toolpath.fcode_concat([a, b], output,
+                                              b"G1 F3000 X0 Y0 E0.5\n")
+
+            gcode = _toolpath.GCodeMemoryWriter()
+            reader = _toolpath.FCodeV1Parser()
+            reader.set_processor(gcode)
+            self.assertEqual(reader.parse_buffer(output.getvalue()),
+                             (metadata, (b"a",)))
+            gcode.terminated()
+
+        # E continues from the previous job
+        self.assertEqual(gcode.get_buffer().split(b"\n")[:6], [
+            b"G1 F1200.0000 X1.0000 Y1.0000 Z0.2000 E1.0000",
+            b"G1 X3.0000 Z0.4000 E3.5000",
+            b"G1 F3000.0000 X0.0000 Y0.0000 E4.0000",
+            b"G1 F1200.0000 X5.0000 Y5.0000 E6.0000",
+            b"G1 X6.0000 E7.0000", b";VERSION=1"])
+        self.assertEqual(metadata["AUTHOR"], "a")
+        self.assertEqual(metadata["FILAMENT_USED"], "7.00")
+        self.assertEqual(metadata["MAX_X"], "6.20")
+        self.assertEqual(metadata["MAX_Z"], "0.60")
+        self.assertEqual([(i["value"], i["e"][0]) for i in reader.get_index()],
+                         [(0, 0.0), (1, 1.0), (2, 4.0)])
+
+    def test_laser_jobs_are_copied(self):
+        with tempfile.TemporaryDirectory() as directory:
+            a = self.make_fcode(directory, "a", b"G1 F1200 X1 Y1\nX2O255\n",
+                                "LASER")
+            b = self.make_fcode(directory, "b", b"G1 F600 X5 Y5\n", "LASER")
+            output = os.path.join(directory, "output.fc")
+            metadata = _toolpath.fcode_concat([a, b, a], output)
+            joined = self.read_script(output)
+            script_a = self.read_script(a)
+            script_b = self.read_script(b)
+            reader = _toolpath.FCodeV1Parser()
+            reader.set_processor(_toolpath.GCodeMemoryWriter())
+            time_cost = sum(float(reader.parse_from_file(fn)[0]["TIME_COST"])
+                            for fn in (a, b, a))
+
+            e = self.make_fcode(directory, "e", b"G1 X1 E1\n")
+            self.assertRaises(ValueError, _toolpath.fcode_concat, [a, e],
+                              io.BytesIO())
+
+        self.assertEqual(joined, script_a + script_b + script_a)
+        self.assertEqual(metadata["TIME_COST"], "%.2f" % time_cost)
+        self.assertEqual(metadata["HEAD_TYPE"], "LASER")
+
+
+class TestBufferedPyToolpathProcessor(unittest.TestCase):
+    def setUp(self):
+        self.received = []
+        self.proc = _toolpath.PyToolpathProcessor(self.callback, chunk_size=2)
+        self.parser = _toolpath.GCodeParser()
+        self.parser.set_processor(self.proc)
+
+    def callback(self, cmd, **kw):
+        if cmd == "events":
+            self.received.append(("events", kw["events"].copy()))
+        else:
+            self.received.append((cmd, kw))
+
+    def test_chunks(self):
+        self.parser.parse_buffer(b"G1 F600 X1 Y2\nG1 X3 E1\nG28\n"
+                                 b";HI\nM104 S200\n")
+        self.proc.terminated()
+
+        self.assertEqual([c for c, _ in self.received],
+                         ["events", "events", "append_comment", "events"])
+        first = self.received[0][1]
+        self.assertEqual(first.dtype, _toolpath.EVENT_DTYPE)
+        self.assertEqual(list(first["opcode"]), [_toolpath.EVENT_MOVETO] * 2)
+        self.assertEqual(list(first["flags"]), [112, 36])
+        self.assertEqual(list(first["x"]), [1.0, 3.0])
+        self.assertEqual(list(first["e0"]), [0.0, 1.0])
+
+        second = self.received[1][1]
+        self.assertEqual(list(second["opcode"]), [_toolpath.EVENT_HOME])
+        self.assertEqual(self.received[2][1], {"message": "HI"})
+
+        last = self.received[3][1]
+        self.assertEqual(list(last["opcode"]),
+                         [_toolpath.EVENT_HEATER_TEMPERATURE])
+        self.assertEqual(last["x"][0], 200.0)
+        self.assertEqual(last["flags"][0], 0)
+
+
+class TestSimplifyProcessor(unittest.TestCase):
+    def setUp(self):
+        self.writer = _toolpath.GCodeMemoryWriter()
+        self.proc = _toolpath.SimplifyProcessor(self.writer, 0.01)
+        self.parser = _toolpath.GCodeParser()
+        self.parser.set_processor(self.proc)
+
+    def test_collinear_merge(self):
+        self.parser.parse_buffer(b"G1 F1200 X0 Y0 Z0.2 E0\n"
+                                 b"G1 X1 E0.1\nG1 X2 E0.2\nG1 X3 Y0.001 E0.3\n"
+                                 b"G1 X4 E0.6\nG1 X4 Y1 E0.7\n")
+        self.proc.terminated()
+        self.assertEqual(self.writer.get_buffer(),
+                         b"G1 F1200.0000 X0.0000 Y0.0000 Z0.2000 E0.0000\n"
+                         b"G1 X3.0000 Y0.0010 E0.3000\n"
+                         b"G1 X4.0000 E0.6000\n"
+                         b"G1 Y1.0000 E0.7000\n")
+        self.assertEqual(self.proc.get_removed_commands(), 2)
+
+    def test_redundant_state(self):
+        self.parser.parse_buffer(b"G1 F1200 X1 Y1\nG1 X1 Y1\nG1 F600\n"
+                                 b"G1 F600 X2 Y1\nG1 F600 X2 Y3\n"
+                                 b"M106 S255\nM106 S255\nG1 X2 Y3\n")
+        self.proc.terminated()
+        self.assertEqual(self.writer.get_buffer(),
+                         b"G1 F1200.0000 X1.0000 Y1.0000\n"
+                         b"G1 F600.0000 X2.0000\nG1 Y3.0000\n"
+                         b"M106 S255\n")
+        self.assertEqual(self.proc.get_removed_commands(), 4)
+        # Moves 13+9+5+13+13+9 bytes in, 13+9+5 out, and one M106
+        self.assertEqual(self.proc.get_removed_bytes(), 40)
+
+    def test_keep_order(self):
+        self.parser.parse_buffer(b"G1 F1200 X1 Y0\nG1 X2\n;LAYER\nG1 X3\n"
+                                 b"G28\nG1 X3\n")
+        self.proc.terminated()
+        self.assertEqual(self.writer.get_buffer(),
+                         b"G1 F1200.0000 X1.0000 Y0.0000\nG1 X2.0000\n"
+                         b";LAYER\nG1 X3.0000\nG28\nG1 X3.0000\n")
+
+
+class TestTeeProcessor(unittest.TestCase):
+    def test_fan_out(self):
+        events = []
+        gcode = _toolpath.GCodeMemoryWriter()
+        fcode = _toolpath.FCodeV1MemoryWriter("EXTRUDER", {}, ())
+        pyproc = _toolpath.PyToolpathProcessor(
+            lambda cmd, **kw: events.append(cmd))
+        tee = _toolpath.TeeProcessor(gcode, fcode, pyproc)
+        parser = _toolpath.GCodeParser()
+        parser.set_processor(tee)
+        parser.parse_buffer(b"G1 F600 X1 Y2\nG1 X3 E1\nM104 S200\n")
+        tee.terminated()
+
+        self.assertEqual(gcode.get_buffer(),
+                         b"G1 F600.0000 X1.0000 Y2.0000\nG1 X3.0000 E1.0000\n"
+                         b"M104 S200.0\n")
+        self.assertEqual(
+            events, ["moveto", "moveto", "set_toolhead_heater_temperature"])
+
+        reference = _toolpath.FCodeV1MemoryWriter("EXTRUDER", {}, ())
+        parser.set_processor(reference)
+        parser.parse_buffer(b"G1 F600 X1 Y2\nG1 X3 E1\nM104 S200\n")
+        reference.terminated()
+        self.assertEqual(fcode.get_buffer(), reference.get_buffer())
+
+
+class TestPipelineProcessor(unittest.TestCase):
+    def convert(self, gcode, pipeline):
+        writer = _toolpath.FCodeV1MemoryWriter("EXTRUDER", {}, ())
+        proc = _toolpath.PipelineProcessor(writer, 16) if pipeline else writer
+        parser = _toolpath.GCodeParser()
+        parser.set_processor(proc)
+        parser.parse_buffer(gcode)
+        proc.terminated()
+        return writer.get_buffer()
+
+    def test_same_as_serial(self):
+        gcode = b"".join(b"G1 F%i X%i Y%i E%i\n;C%i\n" % (i, i % 100, i, i, i)
+                         for i in range(3000)) + b"M104 S200\nG28\n"
+        self.assertEqual(self.convert(gcode, True), self.convert(gcode, False))
+
+    def test_require_gil(self):
+        with self.assertRaises(ValueError):
+            _toolpath.PipelineProcessor(
+                _toolpath.PyToolpathProcessor(lambda cmd, **kw: None))
+
+    def test_require_gil_stream_writer(self):
+        # Stream writer calls write() of a python object from its thread
+        output = io.BytesIO()
+        with self.assertRaises(ValueError):
+            _toolpath.PipelineProcessor(
+                _toolpath.FCodeV1StreamWriter(output, "EXTRUDER", {}, ()))
+        with self.assertRaises(ValueError):
+            _toolpath.PipelineProcessor(_toolpath.TeeProcessor(
+                _toolpath.FCodeV1MemoryWriter("EXTRUDER", {}, ()),
+                _toolpath.FCodeV1StreamWriter(output, "EXTRUDER", {}, ())))
+        self.assertEqual(output.getvalue(), b"")
+
+    def test_drop_unterminated(self):
+        # Pipeline holds the last reference to its target
+        proc = _toolpath.PipelineProcessor(
+            _toolpath.FCodeV1MemoryWriter("EXTRUDER", {}, ()), 16)
+        for i in range(3000):
+            proc.moveto(x=i, y=i, e0=i)
+        del proc
+
+
+class TestPathRecorderProcessor(unittest.TestCase):
+    GCODE = (b"G28\n;LAYER:0\nG0 F9000 X10 Y10 Z0.3\n;TYPE:SKIRT\n"
+             b"G1 F1200 X20 Y10 E1\n;TYPE:WALL-OUTER\nG1 X10 Y20 E3\n"
+             b";LAYER:1\nG0 X10 Y10 Z0.5\n;TYPE:FILL\nG1 X12 Y10 E5\n")
+
+    def record(self, highlight_layer=-1):
+        recorder = _toolpath.PathRecorderProcessor(highlight_layer)
+        parser = _toolpath.GCodeParser()
+        parser.set_processor(recorder)
+        parser.parse_buffer(self.GCODE)
+        recorder.terminated()
+        return recorder
+
+    def test_layers(self):
+        recorder = self.record()
+        points, types, offsets = recorder.get_path()
+        self.assertEqual(recorder.get_layer_count(), 3)
+        self.assertEqual(list(offsets), [0, 1, 5])
+        self.assertEqual(list(types), [4, 4, 4, 5, 2, 4, 4, 1])
+        self.assertEqual(points.shape, (8, 3))
+        self.assertEqual(list(points[7]), [12.0, 10.0, 0.5])
+        self.assertEqual(
+            recorder.get_path_js(),
+            "[[[0.00,0.00,230.00,3]],"
+            "[[0.00,0.00,230.00,3],[10.00,10.00,0.30,3],[20.00,10.00,0.30,4],"
+            "[10.00,20.00,0.30,1]],"
+            "[[10.00,20.00,0.30,3],[10.00,10.00,0.50,3],[12.00,10.00,0.50,0]]]")
+
+    def test_highlight(self):
+        _, types, _ = self.record(highlight_layer=1).get_path()
+        self.assertEqual(list(types), [4, 4, 4, 5, 9, 4, 4, 1])
+
 
 class TestGCodeWriter(unittest.TestCase):
     def setUp(self):
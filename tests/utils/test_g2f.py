@@ -0,0 +1,197 @@
+
+import io
+import json
+import math
+import os
+import random
+import struct
+import tempfile
+import unittest
+
+try:
+    from fluxclient.utils._utils import GcodeToFcodeCpp
+except ImportError:
+    GcodeToFcodeCpp = None
+
+
+def make_gcode(lines=3000):
+    # Slicer-like input with layers, retractions, G92, type tags, comment
+    # only lines and blank lines
+    rnd = random.Random(1)
+    tags = ["", " ; infill", " ; perimeter", " ; support material",
+            " ; move to next layer (1)", ";TYPE:FILL", ";TYPE:WALL-OUTER",
+            ";TYPE:SKIN", ";TYPE:SUPPORT"]
+    output = ["G21", "G90", "M104 S200", "M109 S200", "G28", "G92 E0", ""]
+    e, z = 0, 0.2
+    for i in range(lines):
+        if i % 300 == 0:
+            output.append(";LAYER:%i" % (i // 300))
+            output.append("G1 Z%.2f F1800" % z)
+            z += 0.2
+        if i % 97 == 0:
+            output.append("G92 E0 ; reset")
+            e = 0
+        if i % 53 == 0:
+            output.append(rnd.choice(tags).strip() or ";")
+        e += rnd.choice((0, 0.0123))
+        output.append("G1 X%.3f Y%.3f E%.5f%s" % (
+            rnd.uniform(40, 160), rnd.uniform(40, 160), e, rnd.choice(tags)))
+    return "\n".join(output).encode()
+
+
+def split_fcode(buf):
+    """Script block and metadata without CREATED_AT"""
+    script_size = struct.unpack("<I", buf[8:12])[0]
+    script = buf[:16 + script_size]
+    metadata_size = struct.unpack("<I", buf[16 + script_size:20 + script_size])[0]
+    metadata = buf[20 + script_size:20 + script_size + metadata_size]
+    items = dict(item.split(b"=", 1) for item in metadata.split(b"\0"))
+    items.pop(b"CREATED_AT")
+    return script, items
+
+
+@unittest.skipIf(GcodeToFcodeCpp is None, "_utils extension is not built")
+class TestConvertFile(unittest.TestCase):
+    def convert(self, engine, input, output=None):
+        g2f = GcodeToFcodeCpp()
+        g2f.engine = engine
+        if output is None:
+            output = io.BytesIO()
+            self.assertIsNone(g2f.convert_file(input, output))
+            return g2f, output.getvalue()
+        self.assertIsNone(g2f.convert_file(input, output))
+        with open(output, "rb") as f:
+            return g2f, f.read()
+
+    def test_same_as_process(self):
+        source = make_gcode()
+        with tempfile.TemporaryDirectory() as directory:
+            for newline in (b"\n", b"\r\n", b"\r"):
+                gcode = source.replace(b"\n", newline)
+                gcode_path = os.path.join(directory, "input.gcode")
+                with open(gcode_path, "wb") as f:
+                    f.write(gcode)
+
+                for engine in ("cura", "slic3r"):
+                    g2f = GcodeToFcodeCpp()
+                    g2f.engine = engine
+                    expected = io.BytesIO()
+                    # Text mode splits \n, \r\n and \r lines
+                    with open(gcode_path, "r") as f:
+                        self.assertIsNone(g2f.process(f, expected))
+                    expected = split_fcode(expected.getvalue())
+                    expected_path = g2f.get_path()
+
+                    for input, output in (
+                            (gcode_path, None), (gcode, None),
+                            (bytearray(gcode), None),
+                            (gcode_path, os.path.join(directory, "output.fc"))):
+                        g2f, fcode = self.convert(engine, input, output)
+                        self.assertEqual(split_fcode(fcode), expected)
+                        self.assertEqual(g2f.get_path(), expected_path)
+
+    def test_empty_input(self):
+        g2f, fcode = self.convert("cura", b"")
+        script, _ = split_fcode(fcode)
+        self.assertEqual(script, b"FCx0001\n" + struct.pack("<II", 0, 0))
+
+
+@unittest.skipIf(GcodeToFcodeCpp is None, "_utils extension is not built")
+class TestPreviewPath(unittest.TestCase):
+    def setUp(self):
+        self.g2f = GcodeToFcodeCpp()
+        self.g2f.engine = "cura"
+        self.assertIsNone(self.g2f.convert_file(make_gcode(), io.BytesIO()))
+
+    def test_binary_same_as_js(self):
+        layers = json.loads(self.g2f.get_path('js'))
+        path = self.g2f.get_path('binary')
+        xyz, types, offsets = path['xyz'], path['type'], path['layers']
+        self.assertEqual((xyz.typecode, types.typecode, offsets.typecode),
+                         ('f', 'B', 'I'))
+
+        self.assertEqual(len(offsets), len(layers) + 1)
+        self.assertEqual(offsets[0], 0)
+        self.assertEqual(offsets[-1], len(types))
+        self.assertEqual(len(xyz), 3 * len(types))
+        for layer, points in enumerate(layers):
+            begin, end = offsets[layer], offsets[layer + 1]
+            self.assertEqual(end - begin, len(points))
+            for i, (x, y, z, t) in enumerate(points, begin):
+                # JSON values are rounded to 2 decimals
+                for value, expected in zip(xyz[3 * i:3 * i + 3], (x, y, z)):
+                    self.assertLessEqual(abs(value - expected), 0.0051)
+                self.assertEqual(types[i], t & 255)
+
+    def test_lod(self):
+        # Layers of fine circles, the outer wall changes to fill halfway
+        gcode = ["G28", "G92 E0"]
+        e = 0
+        for layer in range(4):
+            gcode.append(";LAYER:%i" % layer)
+            gcode.append("G1 Z%.1f" % (0.2 * layer + 0.2))
+            gcode.append(";TYPE:WALL-OUTER")
+            for i in range(401):
+                if i == 200:
+                    gcode.append(";TYPE:FILL")
+                angle = i * math.pi / 200
+                e += 0.01
+                gcode.append("G1 X%.3f Y%.3f E%.3f" % (
+                    100 + 30 * math.cos(angle), 100 + 30 * math.sin(angle), e))
+        g2f = GcodeToFcodeCpp()
+        g2f.engine = "cura"
+        self.assertIsNone(g2f.convert_file("\n".join(gcode).encode(), io.BytesIO()))
+
+        full = g2f.get_path('binary')
+        layer_count = len(full['layers']) - 1
+        # Level 0 keeps every point
+        for tolerance in (0, 0.005):
+            self.assertEqual(g2f.get_path_lod(0, layer_count, tolerance), full)
+
+        for tolerance in (0.05, 0.5, 3):
+            lod = g2f.get_path_lod(0, layer_count, tolerance)
+            self.assertLess(len(lod['type']), len(full['type']))
+            self.assertEqual(len(lod['layers']), layer_count + 1)
+            for layer in range(layer_count):
+                self.check_simplified(full, lod, layer, tolerance)
+            # Cached layers give the same result, offsets restart from 0
+            part = g2f.get_path_lod(1, 3, tolerance)
+            begin, end = lod['layers'][1], lod['layers'][3]
+            self.assertEqual(list(part['type']), list(lod['type'][begin:end]))
+            self.assertEqual(list(part['xyz']), list(lod['xyz'][3 * begin:3 * end]))
+            self.assertEqual(list(part['layers']),
+                             [n - begin for n in lod['layers'][1:4]])
+
+    def check_simplified(self, full, lod, layer, tolerance):
+        def points(path):
+            begin, end = path['layers'][layer], path['layers'][layer + 1]
+            return [(tuple(path['xyz'][3 * i:3 * i + 3]), path['type'][i])
+                    for i in range(begin, end)]
+
+        original, kept = points(full), points(lod)
+        # Kept points are original points in order, ends are kept
+        indexes = []
+        for point in kept:
+            start = indexes[-1] + 1 if indexes else 0
+            indexes.append(original.index(point, start))
+        if not original:
+            return
+        self.assertEqual((indexes[0], indexes[-1]), (0, len(original) - 1))
+
+        for a, b in zip(indexes, indexes[1:]):
+            start, end = original[a][0], original[b][0]
+            for i in range(a + 1, b):
+                # Type of a point is the type of the segment ending at it
+                self.assertEqual(original[i][1], original[b][1])
+                self.assertLessEqual(distance_to_segment(original[i][0], start, end),
+                                     tolerance + 1e-4)
+
+
+def distance_to_segment(p, a, b):
+    d = [b[i] - a[i] for i in range(3)]
+    v = [p[i] - a[i] for i in range(3)]
+    length_sq = sum(x * x for x in d)
+    t = 0
+    if length_sq > 0:
+        t = min(max(sum(v[i] * d[i] for i in range(3)) / length_sq, 0), 1)
+    return math.sqrt(sum((v[i] - t * d[i]) ** 2 for i in range(3)))